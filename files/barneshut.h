@@ -0,0 +1,398 @@
+#ifndef BARNESHUT_H_INCLUDED
+#define BARNESHUT_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "gravity.h"
+#include "parallel.h"
+
+// Barnes-Hut octree gravity
+// Bodies are sorted into an octree and distant groups of bodies are treated as a single
+// mass at their centre of mass (plus an optional quadrupole correction). A group is
+// "distant" when its size divided by its distance is smaller than the opening angle theta.
+// Smaller theta is more accurate and slower, theta = 0 is direct summation.
+//
+// Building the tree is the expensive part, so when the bodies have barely moved since the
+// last build the existing tree is refit instead: the bodies stay in the same leaves and
+// only the masses, centres and bounds of the nodes are worked out again.
+class BarnesHutGravity : public GravitySolver
+{
+public:
+    double theta = 0.5;// Opening angle
+    bool quadrupole = false;// Add the quadrupole term to far nodes
+    int leafSize = 8;// Most bodies in a leaf before it is split
+    // Rebuild at least every this many force evaluations, even if bodies barely moved
+    // A step is one evaluation with leapfrog, but several with yoshida4 or block timesteps.
+    int rebuildEvaluations = 16;
+    double refitTolerance = 0.05;// Rebuild once any body has moved this fraction of the root size
+
+    int builds = 0;// Number of full builds so far
+    int refits = 0;// Number of refits so far
+
+    BarnesHutGravity (double theta = 0.5, bool quadrupole = false): theta(theta), quadrupole(quadrupole) {}
+
+    void Invalidate ()
+    {
+        valid = false;
+    }
+
+    const char *Name () const { return "barneshut"; }
+
+    void ComputeAccelerations (const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc)
+    {
+        ComputeAccelerationsOn(s, active, active, G, acc);
+    }
+
+    void ComputeAccelerationsOn (const BodyStore &s, const std::vector<int> &active, const std::vector<int> &targets,
+                                 double G, Accelerations &acc)
+    {
+        if (active.empty()) return;
+
+        if (NeedsRebuild(s, active))
+        {
+            Build(s, active);
+            builds++;
+            evaluationsSinceBuild = 0;
+        }
+        else
+        {
+            Refit(s);
+            refits++;
+        }
+        evaluationsSinceBuild++;
+
+        // Every body walks the tree on its own, so they can be split across threads
+        ParallelFor(pool, int(targets.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = targets[k];
+                Vec3 a = AccelerationAt(s, i, G);
+                acc.x[i] = a.x;
+                acc.y[i] = a.y;
+                acc.z[i] = a.z;
+            }
+        }, 64);
+    }
+
+    // Acceleration on body i from the current tree
+    Vec3 AccelerationAt (const BodyStore &s, int i, double G) const
+    {
+        double px = s.x[i], py = s.y[i], pz = s.z[i];
+        double ax = 0, ay = 0, az = 0;
+        double theta2 = theta*theta;
+
+        int stack[8*MAX_DEPTH + 8];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const Node &node = nodes[stack[--top]];
+            if (node.mass == 0) continue;
+
+            double dx = node.cx - px;
+            double dy = node.cy - py;
+            double dz = node.cz - pz;
+            double r2 = dx*dx + dy*dy + dz*dz;
+
+            // Far enough away to use the node as a whole, and i isn't inside it
+            bool inside = px >= node.minX && px <= node.maxX && py >= node.minY && py <= node.maxY && pz >= node.minZ && pz <= node.maxZ;
+            if (!inside && node.size*node.size < theta2*r2)
+            {
+                double r = sqrt(r2);
+                double inv3 = 1/(r2*r);
+                double k = G*node.mass*inv3;
+                ax += dx*k;
+                ay += dy*k;
+                az += dz*k;
+
+                if (quadrupole)
+                {
+                    // Vector from the node to the body
+                    double ux = -dx, uy = -dy, uz = -dz;
+                    double qx = node.qxx*ux + node.qxy*uy + node.qxz*uz;
+                    double qy = node.qxy*ux + node.qyy*uy + node.qyz*uz;
+                    double qz = node.qxz*ux + node.qyz*uy + node.qzz*uz;
+                    double uqu = ux*qx + uy*qy + uz*qz;
+                    double inv5 = inv3/r2;
+                    double inv7 = inv5/r2;
+                    ax += G*(qx*inv5 - 2.5*uqu*ux*inv7);
+                    ay += G*(qy*inv5 - 2.5*uqu*uy*inv7);
+                    az += G*(qz*inv5 - 2.5*uqu*uz*inv7);
+                }
+                continue;
+            }
+
+            if (node.childCount == 0)
+            {
+                // Leaf: add every body in it directly
+                for (int k = node.start; k < node.end; k++)
+                {
+                    int q = order[k];
+                    if (q == i) continue;
+                    double bx = s.x[q] - px;
+                    double by = s.y[q] - py;
+                    double bz = s.z[q] - pz;
+                    double b2 = bx*bx + by*by + bz*bz;
+                    double kq = G*s.mass[q]/(b2*sqrt(b2));
+                    ax += bx*kq;
+                    ay += by*kq;
+                    az += bz*kq;
+                }
+                continue;
+            }
+
+            for (int c = 0; c < node.childCount; c++) stack[top++] = node.firstChild + c;
+        }
+        return Vec3(ax, ay, az);
+    }
+
+private:
+    static const int MAX_DEPTH = 48;// Stops bodies in the same place from being split forever
+
+    struct Node
+    {
+        // Cell the node was built from
+        double cellX, cellY, cellZ, half;
+        // Bounds of the bodies actually in the node (updated by refits)
+        double minX, minY, minZ, maxX, maxY, maxZ;
+        double size;// Largest side of the bounds
+        // Mass and centre of mass
+        double mass, cx, cy, cz;
+        // Traceless quadrupole moment about the centre of mass
+        double qxx, qyy, qzz, qxy, qxz, qyz;
+        int start, end;// Range of order[] holding the node's bodies
+        int firstChild, childCount;// Children are stored next to each other
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> order;// Body indices sorted so every node owns a contiguous range
+    std::vector<int> scratch;// Used while partitioning
+    std::vector<double> builtX, builtY, builtZ;// Where every body was at the last build
+    bool valid = false;
+    int evaluationsSinceBuild = 0;// Force evaluations since the last build
+    double rootSize = 0;
+
+    bool NeedsRebuild (const BodyStore &s, const std::vector<int> &active)
+    {
+        if (!valid || order.size() != active.size() || evaluationsSinceBuild >= rebuildEvaluations) return true;
+
+        double limit = refitTolerance*rootSize;
+        double limit2 = limit*limit;
+        for (int i : active)
+        {
+            double dx = s.x[i] - builtX[i];
+            double dy = s.y[i] - builtY[i];
+            double dz = s.z[i] - builtZ[i];
+            if (dx*dx + dy*dy + dz*dz > limit2) return true;
+        }
+        return false;
+    }
+
+    void Build (const BodyStore &s, const std::vector<int> &active)
+    {
+        order.assign(active.begin(), active.end());
+        scratch.resize(order.size());
+        if (int(builtX.size()) < s.Size())
+        {
+            builtX.resize(s.Size());
+            builtY.resize(s.Size());
+            builtZ.resize(s.Size());
+        }
+
+        // Bounding cube of every body
+        double minX = s.x[order[0]], maxX = minX;
+        double minY = s.y[order[0]], maxY = minY;
+        double minZ = s.z[order[0]], maxZ = minZ;
+        for (int i : order)
+        {
+            minX = std::min(minX, s.x[i]); maxX = std::max(maxX, s.x[i]);
+            minY = std::min(minY, s.y[i]); maxY = std::max(maxY, s.y[i]);
+            minZ = std::min(minZ, s.z[i]); maxZ = std::max(maxZ, s.z[i]);
+            builtX[i] = s.x[i];
+            builtY[i] = s.y[i];
+            builtZ[i] = s.z[i];
+        }
+        double half = std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ))/2;
+        if (half <= 0) half = 1;
+        // Grow the cube a little so bodies on the edge fall clearly inside it
+        half *= 1.0001;
+
+        nodes.clear();
+        nodes.push_back(Node());
+        InitNode(nodes[0], (minX + maxX)/2, (minY + maxY)/2, (minZ + maxZ)/2, half, 0, int(order.size()));
+        Split(s, 0, 0);
+        rootSize = 2*half;
+
+        Refit(s);
+        valid = true;
+    }
+
+    void InitNode (Node &node, double x, double y, double z, double half, int start, int end)
+    {
+        node = Node();
+        node.cellX = x;
+        node.cellY = y;
+        node.cellZ = z;
+        node.half = half;
+        node.start = start;
+        node.end = end;
+        node.firstChild = 0;
+        node.childCount = 0;
+    }
+
+    // Split node n into up to eight children, then split those
+    void Split (const BodyStore &s, int n, int depth)
+    {
+        int start = nodes[n].start;
+        int end = nodes[n].end;
+        if (end - start <= leafSize || depth >= MAX_DEPTH) return;
+
+        double cx = nodes[n].cellX, cy = nodes[n].cellY, cz = nodes[n].cellZ;
+        double half = nodes[n].half/2;
+
+        // Counting sort of the node's bodies by octant
+        int counts[8] = {0};
+        for (int k = start; k < end; k++) counts[Octant(s, order[k], cx, cy, cz)]++;
+        int offsets[8];
+        int running = start;
+        for (int o = 0; o < 8; o++)
+        {
+            offsets[o] = running;
+            running += counts[o];
+        }
+        int next[8];
+        std::copy(offsets, offsets + 8, next);
+        for (int k = start; k < end; k++)
+        {
+            int i = order[k];
+            scratch[next[Octant(s, i, cx, cy, cz)]++] = i;
+        }
+        std::copy(scratch.begin() + start, scratch.begin() + end, order.begin() + start);
+
+        // Children that have bodies in them are stored together
+        int firstChild = int(nodes.size());
+        int childCount = 0;
+        for (int o = 0; o < 8; o++)
+        {
+            if (counts[o] == 0) continue;
+            nodes.push_back(Node());
+            InitNode(nodes.back(), cx + ((o & 1) ? half : -half), cy + ((o & 2) ? half : -half), cz + ((o & 4) ? half : -half),
+                     half, offsets[o], offsets[o] + counts[o]);
+            childCount++;
+        }
+        nodes[n].firstChild = firstChild;
+        nodes[n].childCount = childCount;
+
+        for (int c = 0; c < childCount; c++) Split(s, firstChild + c, depth + 1);
+    }
+
+    static int Octant (const BodyStore &s, int i, double cx, double cy, double cz)
+    {
+        return (s.x[i] >= cx ? 1 : 0) | (s.y[i] >= cy ? 2 : 0) | (s.z[i] >= cz ? 4 : 0);
+    }
+
+    // Work out the mass, centre, bounds and quadrupole of every node, children first
+    // Children always come after their parent in nodes, so walking backwards does that.
+    void Refit (const BodyStore &s)
+    {
+        for (int n = int(nodes.size()) - 1; n >= 0; n--)
+        {
+            Node &node = nodes[n];
+            double m = 0, mx = 0, my = 0, mz = 0;
+            node.minX = node.minY = node.minZ = INFINITY;
+            node.maxX = node.maxY = node.maxZ = -INFINITY;
+
+            if (node.childCount == 0)
+            {
+                for (int k = node.start; k < node.end; k++)
+                {
+                    int i = order[k];
+                    m += s.mass[i];
+                    mx += s.mass[i]*s.x[i];
+                    my += s.mass[i]*s.y[i];
+                    mz += s.mass[i]*s.z[i];
+                    Grow(node, s.x[i], s.y[i], s.z[i], s.x[i], s.y[i], s.z[i]);
+                }
+            }
+            else
+            {
+                for (int c = node.firstChild; c < node.firstChild + node.childCount; c++)
+                {
+                    const Node &child = nodes[c];
+                    m += child.mass;
+                    mx += child.mass*child.cx;
+                    my += child.mass*child.cy;
+                    mz += child.mass*child.cz;
+                    Grow(node, child.minX, child.minY, child.minZ, child.maxX, child.maxY, child.maxZ);
+                }
+            }
+
+            node.mass = m;
+            if (m > 0)
+            {
+                node.cx = mx/m;
+                node.cy = my/m;
+                node.cz = mz/m;
+            }
+            else
+            {
+                node.cx = node.cellX;
+                node.cy = node.cellY;
+                node.cz = node.cellZ;
+            }
+            node.size = std::max(node.maxX - node.minX, std::max(node.maxY - node.minY, node.maxZ - node.minZ));
+
+            if (quadrupole) FitQuadrupole(s, node);
+        }
+    }
+
+    static void Grow (Node &node, double x0, double y0, double z0, double x1, double y1, double z1)
+    {
+        node.minX = std::min(node.minX, x0); node.maxX = std::max(node.maxX, x1);
+        node.minY = std::min(node.minY, y0); node.maxY = std::max(node.maxY, y1);
+        node.minZ = std::min(node.minZ, z0); node.maxZ = std::max(node.maxZ, z1);
+    }
+
+    // Quadrupole about the node's centre of mass, from its children's quadrupoles (parallel axis) or its bodies
+    void FitQuadrupole (const BodyStore &s, Node &node)
+    {
+        double qxx = 0, qyy = 0, qzz = 0, qxy = 0, qxz = 0, qyz = 0;
+        auto add = [&](double m, double x, double y, double z)
+        {
+            double dx = x - node.cx, dy = y - node.cy, dz = z - node.cz;
+            double d2 = dx*dx + dy*dy + dz*dz;
+            qxx += m*(3*dx*dx - d2);
+            qyy += m*(3*dy*dy - d2);
+            qzz += m*(3*dz*dz - d2);
+            qxy += m*3*dx*dy;
+            qxz += m*3*dx*dz;
+            qyz += m*3*dy*dz;
+        };
+
+        if (node.childCount == 0)
+        {
+            for (int k = node.start; k < node.end; k++)
+            {
+                int i = order[k];
+                add(s.mass[i], s.x[i], s.y[i], s.z[i]);
+            }
+        }
+        else
+        {
+            for (int c = node.firstChild; c < node.firstChild + node.childCount; c++)
+            {
+                const Node &child = nodes[c];
+                add(child.mass, child.cx, child.cy, child.cz);
+                qxx += child.qxx; qyy += child.qyy; qzz += child.qzz;
+                qxy += child.qxy; qxz += child.qxz; qyz += child.qyz;
+            }
+        }
+        node.qxx = qxx; node.qyy = qyy; node.qzz = qzz;
+        node.qxy = qxy; node.qxz = qxz; node.qyz = qyz;
+    }
+};
+
+#endif // BARNESHUT_H_INCLUDED
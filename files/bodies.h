@@ -0,0 +1,230 @@
+#ifndef BODIES_H_INCLUDED
+#define BODIES_H_INCLUDED
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include "vec3.h"
+
+// Flags stored for every body
+#define BODY_HIDDEN 1// The body is not simulated or drawn
+#define BODY_SPHERE 2// The body is a sphere (otherwise it is the domain)
+#define BODY_COLLISION 4// The body collides with other bodies
+
+// Bits recording which fields of a body have been edited since the engine last looked
+#define CHANGED_LOCATION 1
+#define CHANGED_VELOCITY 2
+#define CHANGED_MASS 4// massNum or massExp
+#define CHANGED_RADIUS 8
+#define CHANGED_ELASTICITY 16
+#define CHANGED_FLAGS 32
+
+class BodyHandle;
+
+// The physical state of one body
+// This is only used to move bodies in and out of the store, the engine itself works on the BodyStore columns
+struct Body
+{
+    Vec3 location;// Location
+    Vec3 velocity;// Velocity in metres per second
+
+    double radius = 1;// Radius of a sphere, or the half width of the domain
+    double massNum = 0;// First digit of the mass
+    double massExp = 0;// Exponent of the mass in scientific notation
+    double mass = 0;// Mass
+    double elasticity = 0;// Elasticity
+
+    bool hidden = false;// Whether the object should be simulated and drawn
+    bool isSphere = false;// Whether the object is a sphere
+    bool collision = false;// Whether the object should collide
+};
+
+// Structure of arrays holding every body
+// Each physical quantity gets its own contiguous array so the physics loops only pull the
+// numbers they actually use into the cache. Index i of every array belongs to body i.
+class BodyStore
+{
+public:
+    // Location
+    std::vector<double> x, y, z;
+    // Velocity
+    std::vector<double> vx, vy, vz;
+    // Velocity at the start of the step
+    std::vector<double> oldVx, oldVy, oldVz;
+    // Mass and the scientific notation it is entered in
+    std::vector<double> mass, massNum, massExp;
+    std::vector<double> radius;
+    std::vector<double> elasticity;
+    // BODY_ flags
+    std::vector<unsigned char> flags;
+    // CHANGED_ bits for every body, cleared by the engine once it has dealt with them
+    std::vector<unsigned char> changed;
+    // Whether any body has a CHANGED_ bit set
+    bool anyChanged = false;
+    // Whether any body has had CHANGED_FLAGS set, so lists of bodies by kind are out of date
+    bool flagsChanged = false;
+
+    int Size () const
+    {
+        return int(x.size());
+    }
+
+    void Reserve (int n)
+    {
+        for (std::vector<double> *column : Columns()) column->reserve(n);
+        flags.reserve(n);
+        changed.reserve(n);
+    }
+
+    void Clear ()
+    {
+        for (std::vector<double> *column : Columns()) column->clear();
+        flags.clear();
+        changed.clear();
+        anyChanged = false;
+    }
+
+    // Make room for exactly n bodies, so they can be filled in directly (by several threads at once)
+    // New bodies are all zero and marked as entirely changed.
+    void Resize (int n)
+    {
+        int old = Size();
+        for (std::vector<double> *column : Columns()) column->resize(n);
+        flags.resize(n);
+        changed.resize(n);
+        for (int i = old; i < n; i++) MarkChanged(i, CHANGED_LOCATION | CHANGED_VELOCITY | CHANGED_MASS | CHANGED_RADIUS | CHANGED_ELASTICITY | CHANGED_FLAGS);
+    }
+
+    // Add a body to the end of the store and return its index
+    int Add (const Body &body)
+    {
+        for (std::vector<double> *column : Columns()) column->push_back(0);
+        flags.push_back(0);
+        changed.push_back(0);
+        int i = Size() - 1;
+        Set(i, body);
+        oldVx[i] = vx[i];
+        oldVy[i] = vy[i];
+        oldVz[i] = vz[i];
+        return i;
+    }
+
+    // Copy body i out of the store
+    Body Get (int i) const
+    {
+        Body body;
+        body.location = Vec3(x[i], y[i], z[i]);
+        body.velocity = Vec3(vx[i], vy[i], vz[i]);
+        body.radius = radius[i];
+        body.massNum = massNum[i];
+        body.massExp = massExp[i];
+        body.mass = mass[i];
+        body.elasticity = elasticity[i];
+        body.hidden = (flags[i] & BODY_HIDDEN) != 0;
+        body.isSphere = (flags[i] & BODY_SPHERE) != 0;
+        body.collision = (flags[i] & BODY_COLLISION) != 0;
+        return body;
+    }
+
+    // Overwrite body i
+    void Set (int i, const Body &body)
+    {
+        MarkChanged(i, CHANGED_LOCATION | CHANGED_VELOCITY | CHANGED_MASS | CHANGED_RADIUS | CHANGED_ELASTICITY | CHANGED_FLAGS);
+        x[i] = body.location.x;
+        y[i] = body.location.y;
+        z[i] = body.location.z;
+        vx[i] = body.velocity.x;
+        vy[i] = body.velocity.y;
+        vz[i] = body.velocity.z;
+        radius[i] = body.radius;
+        massNum[i] = body.massNum;
+        massExp[i] = body.massExp;
+        mass[i] = body.mass;
+        elasticity[i] = body.elasticity;
+        flags[i] = (body.hidden ? BODY_HIDDEN : 0) | (body.isSphere ? BODY_SPHERE : 0) | (body.collision ? BODY_COLLISION : 0);
+    }
+
+    Vec3 Location (int i) const { return Vec3(x[i], y[i], z[i]); }
+    Vec3 Velocity (int i) const { return Vec3(vx[i], vy[i], vz[i]); }
+
+    bool Hidden (int i) const { return (flags[i] & BODY_HIDDEN) != 0; }
+    bool IsSphere (int i) const { return (flags[i] & BODY_SPHERE) != 0; }
+    bool Collides (int i) const { return (flags[i] & BODY_COLLISION) != 0; }
+
+    void MarkChanged (int i, unsigned char what)
+    {
+        changed[i] |= what;
+        anyChanged = true;
+        if (what & CHANGED_FLAGS) flagsChanged = true;
+    }
+
+    void ClearChanges ()
+    {
+        if (!anyChanged) return;
+        std::fill(changed.begin(), changed.end(), 0);
+        anyChanged = false;
+        flagsChanged = false;
+    }
+
+    // Get a handle for editing body i in place
+    inline BodyHandle Handle (int i);
+
+private:
+    // Every double column, so they can all be grown together
+    std::array<std::vector<double> *, 14> Columns ()
+    {
+        return {&x, &y, &z, &vx, &vy, &vz, &oldVx, &oldVy, &oldVz, &mass, &massNum, &massExp, &radius, &elasticity};
+    }
+};
+
+// Edits one body in the store in place
+// Every setter records which field it touched, so nothing has to be copied in or out
+// of the store and the engine can tell what the user changed.
+class BodyHandle
+{
+public:
+    BodyHandle (BodyStore &store, int index): store(&store), index(index) {}
+
+    int Index () const { return index; }
+
+    double X () const { return store->x[index]; }
+    double Y () const { return store->y[index]; }
+    double Z () const { return store->z[index]; }
+    double Vx () const { return store->vx[index]; }
+    double Vy () const { return store->vy[index]; }
+    double Vz () const { return store->vz[index]; }
+    double MassNum () const { return store->massNum[index]; }
+    double MassExp () const { return store->massExp[index]; }
+    double Radius () const { return store->radius[index]; }
+    double Elasticity () const { return store->elasticity[index]; }
+    bool Hidden () const { return store->Hidden(index); }
+
+    void SetX (double value) { store->x[index] = value; store->MarkChanged(index, CHANGED_LOCATION); }
+    void SetY (double value) { store->y[index] = value; store->MarkChanged(index, CHANGED_LOCATION); }
+    void SetZ (double value) { store->z[index] = value; store->MarkChanged(index, CHANGED_LOCATION); }
+    void SetVx (double value) { store->vx[index] = value; store->MarkChanged(index, CHANGED_VELOCITY); }
+    void SetVy (double value) { store->vy[index] = value; store->MarkChanged(index, CHANGED_VELOCITY); }
+    void SetVz (double value) { store->vz[index] = value; store->MarkChanged(index, CHANGED_VELOCITY); }
+    void SetMassNum (double value) { store->massNum[index] = value; store->MarkChanged(index, CHANGED_MASS); }
+    void SetMassExp (double value) { store->massExp[index] = value; store->MarkChanged(index, CHANGED_MASS); }
+    void SetRadius (double value) { store->radius[index] = value; store->MarkChanged(index, CHANGED_RADIUS); }
+    void SetElasticity (double value) { store->elasticity[index] = value; store->MarkChanged(index, CHANGED_ELASTICITY); }
+
+    void SetHidden (bool hidden)
+    {
+        if (hidden) store->flags[index] |= BODY_HIDDEN;
+        else store->flags[index] &= ~BODY_HIDDEN;
+        store->MarkChanged(index, CHANGED_FLAGS);
+    }
+
+private:
+    BodyStore *store;
+    int index;
+};
+
+inline BodyHandle BodyStore::Handle (int i)
+{
+    return BodyHandle(*this, i);
+}
+
+#endif // BODIES_H_INCLUDED
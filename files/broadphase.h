@@ -0,0 +1,332 @@
+#ifndef BROADPHASE_H_INCLUDED
+#define BROADPHASE_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "bodies.h"
+#include "parallel.h"
+
+// Finding which spheres might be touching
+// Checking every sphere against every other sphere is O(N^2). A broad phase cheaply
+// throws away pairs that can't be touching so the exact test (the narrow phase, in
+// CollideSpheres) only runs on the few that might be.
+
+#define TOUCH_SLACK 1e-9// Relative extra reach a broad phase allows, so rounding never loses a touching pair
+#define SAP_MAX_SHIFTS 8// Average places a sphere may move in the sweep order before it's quicker to sort from scratch
+
+// Two spheres that might be touching, a < b
+struct SpherePair
+{
+    int a, b;
+};
+
+// Whether the spheres a and b overlap
+// A hair more generous than CollideSpheres so rounding never loses a pair it would accept.
+inline bool MightTouch (const BodyStore &s, int a, int b)
+{
+    double dx = s.x[b] - s.x[a];
+    double dy = s.y[b] - s.y[a];
+    double dz = s.z[b] - s.z[a];
+    double reach = (s.radius[a] + s.radius[b])*(1 + TOUCH_SLACK);
+    return dx*dx + dy*dy + dz*dz <= reach*reach;
+}
+
+class BroadPhase
+{
+public:
+    // Threads to split the work over, set by the engine that owns the broad phase (NULL runs on the caller)
+    ThreadPool *pool = NULL;
+
+    virtual ~BroadPhase () {}
+
+    // Every pair of spheres that might be touching, in any order
+    virtual void FindPairs (const BodyStore &s, const std::vector<int> &spheres, std::vector<SpherePair> &pairs) = 0;
+
+    // Name used in reports
+    virtual const char *Name () const = 0;
+
+protected:
+    std::vector<std::vector<SpherePair>> found;// Pairs found by each thread
+
+    // Room for about one contact per sphere up front, so a step doesn't allocate the
+    // first time spheres touch
+    void StartFinding (int spheres)
+    {
+        found.resize(pool == NULL ? 1 : pool->Size());
+        for (std::vector<SpherePair> &list : found)
+        {
+            list.clear();
+            if (list.capacity() < size_t(spheres)) list.reserve(spheres);
+        }
+    }
+
+    void Found (int a, int b)
+    {
+        found[CurrentWorker(pool)].push_back(a < b ? SpherePair{a, b} : SpherePair{b, a});
+    }
+
+    void GatherFound (std::vector<SpherePair> &pairs)
+    {
+        pairs.clear();
+        size_t total = 0;
+        for (const std::vector<SpherePair> &list : found) total += list.size();
+        pairs.reserve(total);
+        for (const std::vector<SpherePair> &list : found) pairs.insert(pairs.end(), list.begin(), list.end());
+    }
+};
+
+// Every sphere against every later sphere, what the simulator always did
+class AllPairsBroadPhase : public BroadPhase
+{
+public:
+    void FindPairs (const BodyStore &s, const std::vector<int> &spheres, std::vector<SpherePair> &pairs)
+    {
+        int n = int(spheres.size());
+        StartFinding(n);
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                for (int l = k + 1; l < n; l++)
+                {
+                    if (MightTouch(s, spheres[k], spheres[l])) Found(spheres[k], spheres[l]);
+                }
+            }
+        }, 16);
+        GatherFound(pairs);
+    }
+
+    const char *Name () const { return "allpairs"; }
+};
+
+// Uniform grid, stored as a hash table of cells
+// Cells are as wide as the largest sphere, so two spheres can only touch if they are in the
+// same cell or next door. Each sphere only has to be checked against the spheres in the 27
+// cells around it. Only cells with spheres in take up room, so the grid doesn't need bounds.
+class SpatialHashBroadPhase : public BroadPhase
+{
+public:
+    void FindPairs (const BodyStore &s, const std::vector<int> &spheres, std::vector<SpherePair> &pairs)
+    {
+        int n = int(spheres.size());
+        StartFinding(n);
+        pairs.clear();
+        if (n < 2) return;
+
+        double largest = 0;
+        for (int i : spheres) largest = std::max(largest, s.radius[i]);
+        cellSize = largest > 0 ? 2*largest : 1;
+
+        // Table with at least twice as many buckets as spheres
+        int buckets = 1;
+        while (buckets < 2*n) buckets <<= 1;
+        if (buckets != bucketCount)
+        {
+            bucketCount = buckets;
+            counts.reset(new std::atomic<int>[buckets]);
+            starts.resize(buckets + 1);
+        }
+        cellX.resize(n);
+        cellY.resize(n);
+        cellZ.resize(n);
+        bucketOf.resize(n);
+        sorted.resize(n);
+
+        // Which cell and bucket every sphere is in, and how full each bucket is
+        ParallelFor(pool, buckets, [&](int begin, int end)
+        {
+            for (int b = begin; b < end; b++) counts[b].store(0, std::memory_order_relaxed);
+        }, 4096);
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = spheres[k];
+                cellX[k] = Cell(s.x[i]);
+                cellY[k] = Cell(s.y[i]);
+                cellZ[k] = Cell(s.z[i]);
+                bucketOf[k] = Hash(cellX[k], cellY[k], cellZ[k]);
+                counts[bucketOf[k]].fetch_add(1, std::memory_order_relaxed);
+            }
+        }, 1024);
+
+        // Where each bucket starts in sorted, then drop every sphere into its bucket
+        starts[0] = 0;
+        for (int b = 0; b < buckets; b++)
+        {
+            starts[b + 1] = starts[b] + counts[b].load(std::memory_order_relaxed);
+            counts[b].store(starts[b], std::memory_order_relaxed);
+        }
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++) sorted[counts[bucketOf[k]].fetch_add(1, std::memory_order_relaxed)] = k;
+        }, 1024);
+
+        // Check each sphere against the later spheres in the cells around it
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                for (int dz = -1; dz <= 1; dz++)
+                for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    long long cx = cellX[k] + dx, cy = cellY[k] + dy, cz = cellZ[k] + dz;
+                    int b = Hash(cx, cy, cz);
+                    for (int e = starts[b]; e < starts[b + 1]; e++)
+                    {
+                        int l = sorted[e];
+                        // Each pair once, and only spheres really in that cell (other cells can share the bucket)
+                        if (l <= k || cellX[l] != cx || cellY[l] != cy || cellZ[l] != cz) continue;
+                        if (MightTouch(s, spheres[k], spheres[l])) Found(spheres[k], spheres[l]);
+                    }
+                }
+            }
+        }, 256);
+        GatherFound(pairs);
+    }
+
+    const char *Name () const { return "hash"; }
+
+private:
+    double cellSize = 1;
+    int bucketCount = 0;
+    std::unique_ptr<std::atomic<int>[]> counts;// Spheres in each bucket, then where the next one goes
+    std::vector<int> starts;// First entry of each bucket in sorted
+    std::vector<long long> cellX, cellY, cellZ;// Cell of each sphere, indexed like the sphere list
+    std::vector<int> bucketOf;// Bucket of each sphere
+    std::vector<int> sorted;// Sphere list positions, grouped by bucket
+
+    long long Cell (double v) const
+    {
+        return (long long)floor(v/cellSize);
+    }
+
+    int Hash (long long x, long long y, long long z) const
+    {
+        unsigned long long h = (unsigned long long)x*73856093ULL ^ (unsigned long long)y*19349663ULL ^ (unsigned long long)z*83492791ULL;
+        return int(h & (unsigned long long)(bucketCount - 1));
+    }
+};
+
+// Sweep and prune along one axis, kept sorted from one step to the next
+// Every sphere covers an interval along the axis; two spheres can only touch if their
+// intervals overlap, so with the intervals sorted by where they start, each sphere only
+// has to be checked against the ones starting before it ends. Bodies hardly move in one
+// step, so last step's order is nearly sorted already and an insertion sort puts it right
+// in close to linear time. Unlike a grid, a few huge spheres don't make every check
+// coarse, which suits scenes where the sizes vary by orders of magnitude.
+class SweepAndPruneBroadPhase : public BroadPhase
+{
+public:
+    void FindPairs (const BodyStore &s, const std::vector<int> &spheres, std::vector<SpherePair> &pairs)
+    {
+        int n = int(spheres.size());
+        StartFinding(n);
+        pairs.clear();
+
+        // Start again from scratch only when spheres have been added, removed or hidden
+        bool rebuilt = spheres != known;
+        if (rebuilt)
+        {
+            known = spheres;
+            ChooseAxis(s, spheres);
+            sweep.resize(n);
+            for (int k = 0; k < n; k++) sweep[k].body = spheres[k];
+        }
+        if (n < 2) return;
+
+        // Where every interval is now, in last step's order
+        const std::vector<double> &centre = axis == 0 ? s.x : axis == 1 ? s.y : s.z;
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = sweep[k].body;
+                double reach = s.radius[i]*(1 + TOUCH_SLACK);
+                sweep[k].low = centre[i] - reach;
+                sweep[k].high = centre[i] + reach;
+            }
+        }, 1024);
+
+        if (rebuilt || !InsertionSort()) std::sort(sweep.begin(), sweep.end(), [](const Interval &a, const Interval &b) { return a.low < b.low; });
+
+        // Check each sphere against the later ones whose intervals start before it ends
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                double high = sweep[k].high;
+                for (int l = k + 1; l < n && sweep[l].low <= high; l++)
+                {
+                    if (MightTouch(s, sweep[k].body, sweep[l].body)) Found(sweep[k].body, sweep[l].body);
+                }
+            }
+        }, 256);
+        GatherFound(pairs);
+    }
+
+    const char *Name () const { return "sap"; }
+
+private:
+    // Where a sphere starts and ends along the axis
+    struct Interval
+    {
+        double low, high;
+        int body;
+    };
+
+    int axis = 0;// 0, 1 or 2 for x, y or z
+    std::vector<int> known;// The spheres the order was built for
+    std::vector<Interval> sweep;// Every sphere's interval, sorted by low
+
+    // Sweep along the axis the spheres are most spread out on, so the fewest intervals overlap
+    void ChooseAxis (const BodyStore &s, const std::vector<int> &spheres)
+    {
+        const std::vector<double> *centres[3] = {&s.x, &s.y, &s.z};
+        double widest = -1;
+        for (int a = 0; a < 3; a++)
+        {
+            double sum = 0, squares = 0;
+            for (int i : spheres)
+            {
+                double v = (*centres[a])[i];
+                sum += v;
+                squares += v*v;
+            }
+            double n = std::max<size_t>(spheres.size(), 1);
+            double variance = squares/n - (sum/n)*(sum/n);
+            if (variance > widest)
+            {
+                widest = variance;
+                axis = a;
+            }
+        }
+    }
+
+    // Put the nearly sorted intervals back in order, giving up if they have moved so much
+    // that sorting from scratch would be quicker
+    bool InsertionSort ()
+    {
+        long long shifts = 0, limit = (long long)SAP_MAX_SHIFTS*sweep.size();
+        for (size_t k = 1; k < sweep.size(); k++)
+        {
+            Interval moving = sweep[k];
+            size_t l = k;
+            while (l > 0 && sweep[l - 1].low > moving.low)
+            {
+                sweep[l] = sweep[l - 1];
+                l--;
+            }
+            sweep[l] = moving;
+            shifts += k - l;
+            if (shifts > limit) return false;
+        }
+        return true;
+    }
+};
+
+#endif // BROADPHASE_H_INCLUDED
@@ -0,0 +1,545 @@
+#ifndef CHECKPOINT_H_INCLUDED
+#define CHECKPOINT_H_INCLUDED
+
+#include <vector>
+#include <array>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "bodies.h"
+#include "units.h"
+#include "engine.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define CHECKPOINT_MMAP 1
+#endif
+
+// Checkpoints: the whole state of a simulation saved to one binary file and loaded back
+//
+// The file is laid out so that loading it is little more than mapping it into memory:
+//   the header, which holds the scene block (time, steps, units and how contacts are
+//   solved) and where every column is and its checksum
+//   one column per BodyStore array, each starting on a CHECKPOINT_ALIGN boundary
+// Numbers are written as the machine holds them. The byte order is recorded and a file from
+// a machine that holds them the other way round is refused rather than swapped.
+//
+// Checkpoints are written to a file beside the real one and renamed over it once complete,
+// so a crash while saving leaves the last checkpoint as it was.
+
+#define CHECKPOINT_MAGIC "GRAVCKPT"// First eight bytes of every checkpoint
+#define CHECKPOINT_VERSION 1// Bumped whenever the layout changes
+#define CHECKPOINT_BYTE_ORDER 0x01020304u// Reads differently on a machine of the other endianness
+#define CHECKPOINT_ALIGN 64// Every column starts on a multiple of this many bytes
+#define CHECKPOINT_DOUBLES 11// Columns of doubles saved
+#define CHECKPOINT_COLUMNS 12// Those and the flags
+
+struct CheckpointHeader
+{
+    char magic[8];// CHECKPOINT_MAGIC
+    uint32_t version;// CHECKPOINT_VERSION
+    uint32_t byteOrder;// CHECKPOINT_BYTE_ORDER
+    uint64_t headerSize;// sizeof(CheckpointHeader)
+    uint64_t fileSize;// Bytes in the whole file
+    uint64_t bodies;// Bodies in every column
+
+    // The scene block
+    uint64_t steps;// Steps the engine had taken
+    double time;// Simulated seconds
+    double unitLength, unitMass, unitTime;// The engine's UnitSystem
+    uint32_t useUnits;// Whether the gravity solver was using them
+    int32_t contactScheme;// CONTACTS_ISLANDS or CONTACTS_PAIRWISE
+    uint32_t continuous;// Whether drifts were swept
+    uint32_t reserved;// Zero
+
+    uint64_t offset[CHECKPOINT_COLUMNS];// Where each column starts, from the start of the file
+    uint64_t sum[CHECKPOINT_COLUMNS];// Checksum of each column
+    uint64_t headerSum;// Checksum of everything above
+};
+
+// Everything about a simulation that isn't in the BodyStore but has to be put back for it to
+// carry on where it stopped
+// Which solver, integrator and broad phase are used is left to whoever restores it.
+struct CheckpointScene
+{
+    unsigned long long steps = 0;
+    double time = 0;
+    UnitSystem units;
+    bool useUnits = false;
+    int contactScheme = CONTACTS_ISLANDS;
+    bool continuous = false;
+
+    static CheckpointScene Of (const Engine &engine)
+    {
+        CheckpointScene scene;
+        scene.steps = engine.steps;
+        scene.time = engine.time;
+        scene.units = engine.units;
+        scene.useUnits = engine.useUnits;
+        scene.contactScheme = engine.contactScheme;
+        scene.continuous = engine.continuous;
+        return scene;
+    }
+
+    void ApplyTo (Engine &engine) const
+    {
+        engine.steps = steps;
+        engine.time = time;
+        if (useUnits) engine.SetUnits(units);
+        else engine.useUnits = false;
+        engine.contactScheme = contactScheme;
+        engine.continuous = continuous;
+    }
+};
+
+// The double columns saved, in the order they are in the file
+// The start of step velocities aren't, Step sets them before it uses them.
+inline std::array<const std::vector<double> *, CHECKPOINT_DOUBLES> CheckpointColumns (const BodyStore &s)
+{
+    return {&s.x, &s.y, &s.z, &s.vx, &s.vy, &s.vz, &s.mass, &s.massNum, &s.massExp, &s.radius, &s.elasticity};
+}
+
+inline std::array<std::vector<double> *, CHECKPOINT_DOUBLES> CheckpointColumns (BodyStore &s)
+{
+    return {&s.x, &s.y, &s.z, &s.vx, &s.vy, &s.vz, &s.mass, &s.massNum, &s.massExp, &s.radius, &s.elasticity};
+}
+
+// 64 bit FNV-1a, taking eight bytes at a time so checking a column keeps up with reading it
+inline uint64_t CheckpointSum (const void *data, size_t bytes)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t hash = 14695981039346656037ull;
+    size_t words = bytes/8;
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t word;
+        memcpy(&word, p + 8*w, 8);
+        hash = (hash ^ word)*1099511628211ull;
+    }
+    for (size_t b = 8*words; b < bytes; b++) hash = (hash ^ p[b])*1099511628211ull;
+    return hash;
+}
+
+inline uint64_t CheckpointAlign (uint64_t bytes)
+{
+    return (bytes + CHECKPOINT_ALIGN - 1)/CHECKPOINT_ALIGN*CHECKPOINT_ALIGN;
+}
+
+// Writes blocks to a file one after another, each padded with zeros out to where the next one starts
+// A failed write is remembered in ok, so every block can be put and the result checked once.
+struct PaddedWriter
+{
+    FILE *file;
+    uint64_t at = 0;// Bytes written so far
+    bool ok = true;
+
+    explicit PaddedWriter (FILE *file): file(file) {}
+
+    void Put (const void *data, uint64_t bytes, uint64_t next)
+    {
+        static const char zeros[CHECKPOINT_ALIGN] = {};
+        ok = ok && fwrite(data, 1, bytes, file) == bytes;
+        at += bytes;
+        // Blocks start at multiples of CHECKPOINT_ALIGN, so the gap is never more than zeros
+        if (next > at) ok = ok && fwrite(zeros, 1, next - at, file) == next - at;
+        at = next;
+    }
+};
+
+// Fill in the header for a checkpoint of these bodies, working out where each column goes
+inline CheckpointHeader MakeCheckpointHeader (const BodyStore &s, const CheckpointScene &scene)
+{
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.version = CHECKPOINT_VERSION;
+    header.byteOrder = CHECKPOINT_BYTE_ORDER;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.bodies = s.Size();
+
+    header.steps = scene.steps;
+    header.time = scene.time;
+    header.unitLength = scene.units.length;
+    header.unitMass = scene.units.mass;
+    header.unitTime = scene.units.time;
+    header.useUnits = scene.useUnits;
+    header.contactScheme = scene.contactScheme;
+    header.continuous = scene.continuous;
+
+    std::array<const std::vector<double> *, CHECKPOINT_DOUBLES> columns = CheckpointColumns(s);
+    uint64_t at = CheckpointAlign(sizeof(CheckpointHeader));
+    for (int c = 0; c < CHECKPOINT_DOUBLES; c++)
+    {
+        header.offset[c] = at;
+        header.sum[c] = CheckpointSum(columns[c]->data(), columns[c]->size()*sizeof(double));
+        at = CheckpointAlign(at + columns[c]->size()*sizeof(double));
+    }
+    header.offset[CHECKPOINT_DOUBLES] = at;
+    header.sum[CHECKPOINT_DOUBLES] = CheckpointSum(s.flags.data(), s.flags.size());
+    header.fileSize = at + s.flags.size();
+
+    header.headerSum = CheckpointSum(&header, offsetof(CheckpointHeader, headerSum));
+    return header;
+}
+
+// Write a checkpoint of these bodies to path, or return false with the reason in error
+inline bool WriteCheckpoint (const std::string &path, const BodyStore &s, const CheckpointScene &scene, std::string &error)
+{
+    CheckpointHeader header = MakeCheckpointHeader(s, scene);
+    std::string partial = path + ".partial";
+    FILE *file = fopen(partial.c_str(), "wb");
+    if (file == NULL)
+    {
+        error = "can't write " + partial;
+        return false;
+    }
+
+    PaddedWriter writer(file);
+    std::array<const std::vector<double> *, CHECKPOINT_DOUBLES> columns = CheckpointColumns(s);
+    writer.Put(&header, sizeof(header), header.offset[0]);
+    for (int c = 0; c < CHECKPOINT_DOUBLES; c++)
+    {
+        writer.Put(columns[c]->data(), columns[c]->size()*sizeof(double), header.offset[c + 1]);
+    }
+    writer.Put(s.flags.data(), s.flags.size(), header.fileSize);
+    bool written = fclose(file) == 0 && writer.ok;
+
+    if (!written)
+    {
+        error = "couldn't finish writing " + partial;
+        remove(partial.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // Windows won't rename over a file that's there
+    remove(path.c_str());
+#endif
+    if (rename(partial.c_str(), path.c_str()) != 0)
+    {
+        error = "can't replace " + path;
+        return false;
+    }
+    return true;
+}
+
+// A whole file, mapped into memory where the system allows and read in otherwise
+class MappedFile
+{
+public:
+    MappedFile () {}
+    MappedFile (const MappedFile &) = delete;
+    MappedFile &operator= (const MappedFile &) = delete;
+
+    ~MappedFile ()
+    {
+        Close();
+    }
+
+    bool Open (const std::string &path)
+    {
+        Close();
+#ifdef CHECKPOINT_MMAP
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) return false;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size <= 0)
+        {
+            close(descriptor);
+            return false;
+        }
+        void *view = mmap(NULL, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        close(descriptor);
+        if (view == MAP_FAILED) return false;
+        // The columns are read front to back, once
+        madvise(view, size_t(status.st_size), MADV_SEQUENTIAL);
+        data = (const unsigned char *)view;
+        size = size_t(status.st_size);
+        return true;
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == NULL) return false;
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (length <= 0)
+        {
+            fclose(file);
+            return false;
+        }
+        copy.resize(size_t(length));
+        bool read = fread(copy.data(), 1, copy.size(), file) == copy.size();
+        fclose(file);
+        if (!read) return false;
+        data = copy.data();
+        size = copy.size();
+        return true;
+#endif
+    }
+
+    void Close ()
+    {
+#ifdef CHECKPOINT_MMAP
+        if (data != NULL) munmap((void *)data, size);
+#else
+        copy.clear();
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const unsigned char *Data () const { return data; }
+    size_t Size () const { return size; }
+
+private:
+    const unsigned char *data = NULL;
+    size_t size = 0;
+#ifndef CHECKPOINT_MMAP
+    std::vector<unsigned char> copy;// The file read in whole
+#endif
+};
+
+// Load the checkpoint in path into s and scene, or return false with the reason in error
+// and leave them as they were. Every body comes back marked as changed, so the engine works
+// out everything it keeps about them again before its next step.
+inline bool ReadCheckpoint (const std::string &path, BodyStore &s, CheckpointScene &scene, std::string &error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "can't read " + path;
+        return false;
+    }
+    const unsigned char *data = file.Data();
+
+    CheckpointHeader header;
+    if (file.Size() < sizeof(header))
+    {
+        error = path + " is too short to be a checkpoint";
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, 8) != 0)
+    {
+        error = path + " isn't a checkpoint";
+        return false;
+    }
+    if (header.byteOrder != CHECKPOINT_BYTE_ORDER)
+    {
+        error = path + " was written on a machine of the other byte order";
+        return false;
+    }
+    if (header.version != CHECKPOINT_VERSION || header.headerSize != sizeof(header))
+    {
+        error = path + " is a checkpoint of a different version";
+        return false;
+    }
+    if (header.headerSum != CheckpointSum(&header, offsetof(CheckpointHeader, headerSum)))
+    {
+        error = path + " has a damaged header";
+        return false;
+    }
+    if (header.fileSize != file.Size())
+    {
+        error = path + " has been cut short";
+        return false;
+    }
+
+    // Check every column fits and is intact before touching the store
+    // The body count is bounded first, so the sizes worked out from it can't wrap around.
+    uint64_t n = header.bodies;
+    if (n > uint64_t(INT32_MAX))
+    {
+        error = path + " has too many bodies";
+        return false;
+    }
+    for (int c = 0; c < CHECKPOINT_COLUMNS; c++)
+    {
+        uint64_t bytes = c < CHECKPOINT_DOUBLES ? n*sizeof(double) : n;
+        if (header.offset[c] % sizeof(double) != 0 || header.offset[c] > file.Size() || bytes > file.Size() - header.offset[c])
+        {
+            error = path + " has a column out of place";
+            return false;
+        }
+        if (CheckpointSum(data + header.offset[c], bytes) != header.sum[c])
+        {
+            error = path + " has a damaged column";
+            return false;
+        }
+    }
+
+    std::array<std::vector<double> *, CHECKPOINT_DOUBLES> columns = CheckpointColumns(s);
+    for (int c = 0; c < CHECKPOINT_DOUBLES; c++)
+    {
+        const double *column = (const double *)(data + header.offset[c]);
+        columns[c]->assign(column, column + n);
+    }
+    const unsigned char *flags = data + header.offset[CHECKPOINT_DOUBLES];
+    s.flags.assign(flags, flags + n);
+    s.oldVx = s.vx;
+    s.oldVy = s.vy;
+    s.oldVz = s.vz;
+    s.changed.assign(n, CHANGED_LOCATION | CHANGED_VELOCITY | CHANGED_MASS | CHANGED_RADIUS | CHANGED_ELASTICITY | CHANGED_FLAGS);
+    s.anyChanged = n > 0;
+    s.flagsChanged = n > 0;
+
+    scene.steps = header.steps;
+    scene.time = header.time;
+    scene.units.length = header.unitLength;
+    scene.units.mass = header.unitMass;
+    scene.units.time = header.unitTime;
+    scene.useUnits = header.useUnits != 0;
+    scene.contactScheme = header.contactScheme;
+    scene.continuous = header.continuous != 0;
+    return true;
+}
+
+// Save the engine to path
+inline bool SaveCheckpoint (const Engine &engine, const std::string &path, std::string &error)
+{
+    return WriteCheckpoint(path, engine.bodies, CheckpointScene::Of(engine), error);
+}
+
+// Put the engine back as it was when the checkpoint in path was saved
+inline bool LoadCheckpoint (Engine &engine, const std::string &path, std::string &error)
+{
+    CheckpointScene scene;
+    if (!ReadCheckpoint(path, engine.bodies, scene, error)) return false;
+    scene.ApplyTo(engine);
+    return true;
+}
+
+// Writes checkpoints on a thread of its own
+// Save copies the columns (which is about as quick as copying memory gets) and returns;
+// the file is written while the simulation carries on. If the last checkpoint is still
+// being written the new one is skipped rather than waited for, so a slow disk can never
+// hold the simulation up.
+class CheckpointWriter
+{
+public:
+    // Write to path, starting a checkpoint from Tick every interval steps (never if 0)
+    CheckpointWriter (const std::string &path, unsigned long long interval = 0): path(path), interval(interval)
+    {
+        thread = std::thread(&CheckpointWriter::Run, this);
+    }
+
+    CheckpointWriter (const CheckpointWriter &) = delete;
+    CheckpointWriter &operator= (const CheckpointWriter &) = delete;
+
+    // Finishes the checkpoint being written first
+    ~CheckpointWriter ()
+    {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    // Start writing a checkpoint of these bodies, or return false if the last is still being written
+    bool Save (const BodyStore &s, const CheckpointScene &scene)
+    {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            if (pending)
+            {
+                skipped++;
+                return false;
+            }
+            std::array<const std::vector<double> *, CHECKPOINT_DOUBLES> from = CheckpointColumns(s);
+            std::array<std::vector<double> *, CHECKPOINT_DOUBLES> to = CheckpointColumns(staged);
+            for (int c = 0; c < CHECKPOINT_DOUBLES; c++) *to[c] = *from[c];
+            staged.flags = s.flags;
+            stagedScene = scene;
+            lastSteps = scene.steps;
+            pending = true;
+        }
+        wake.notify_all();
+        return true;
+    }
+
+    bool Save (const Engine &engine)
+    {
+        return Save(engine.bodies, CheckpointScene::Of(engine));
+    }
+
+    // Call after every step: starts a checkpoint once interval steps have passed since the last
+    bool Tick (const Engine &engine)
+    {
+        if (interval == 0 || engine.steps < lastSteps + interval) return false;
+        return Save(engine);
+    }
+
+    // Wait for the checkpoint being written, if there is one
+    void Wait ()
+    {
+        std::unique_lock<std::mutex> hold(lock);
+        done.wait(hold, [&]{ return !pending; });
+    }
+
+    // Checkpoints written, and saves skipped because one was still being written
+    int Written ()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        return written;
+    }
+
+    int Skipped ()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        return skipped;
+    }
+
+    // Why the last checkpoint that failed did, empty if none has
+    std::string Error ()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        return error;
+    }
+
+private:
+    std::string path;
+    unsigned long long interval;
+    unsigned long long lastSteps = 0;// Steps taken when the last checkpoint was started
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    bool pending = false;// staged holds a checkpoint still to be written
+    bool stopping = false;
+    BodyStore staged;// Only the columns checkpoints hold are used
+    CheckpointScene stagedScene;
+    int written = 0, skipped = 0;
+    std::string error;
+
+    void Run ()
+    {
+        std::unique_lock<std::mutex> hold(lock);
+        while (true)
+        {
+            wake.wait(hold, [&]{ return pending || stopping; });
+            if (!pending) return;
+
+            // Nothing touches staged while pending is set, so it can be written unlocked
+            hold.unlock();
+            std::string failure;
+            bool ok = WriteCheckpoint(path, staged, stagedScene, failure);
+            hold.lock();
+
+            if (ok) written++;
+            else error = failure;
+            pending = false;
+            done.notify_all();
+        }
+    }
+};
+
+#endif // CHECKPOINT_H_INCLUDED
@@ -0,0 +1,223 @@
+#ifndef CONTACTS_H_INCLUDED
+#define CONTACTS_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "bodies.h"
+#include "parallel.h"
+#include "broadphase.h"
+
+// Bouncing touching spheres off each other, all at once
+// Resolving contacts one after another means the answer depends on the order they are
+// taken in. Instead the contacts are gathered first, then split into islands: groups of
+// spheres touching each other, directly or through others. No two islands share a sphere,
+// so they can be solved on different threads at the same time, and inside an island the
+// contacts are always taken in the same order, so the result never depends on threads.
+//
+// Each island is solved with sequential impulses. A contact between spheres moving
+// together wants them to separate at elasticity times the speed they met at. Every pass
+// over the island pushes each contact towards that, never pulling the spheres together,
+// until the pushes stop changing. A pair touching nothing else is solved exactly in one
+// pass and comes out the same as the original two-body formula.
+
+#define CONTACT_ITERATIONS 8// Passes over every island, more settles stacks and clusters better
+
+// How bouncy the colliding spheres are, known before the collision code is picked
+#define BOUNCE_MIXED 0// Elasticities differ, each pair uses the average of its two
+#define BOUNCE_ELASTIC 1// Every sphere has elasticity 1
+#define BOUNCE_INELASTIC 2// Every sphere has elasticity 0
+
+// Elasticity of a collision between a and b
+// When every sphere is the same it's a constant, and the average drops out of the code.
+template <int Elasticity>
+inline double PairElasticity (const BodyStore &s, int a, int b)
+{
+    if (Elasticity == BOUNCE_ELASTIC) return 1;
+    if (Elasticity == BOUNCE_INELASTIC) return 0;
+    return (s.elasticity[a] + s.elasticity[b])/2;
+}
+
+// Two spheres found touching, and what solving them needs
+struct Contact
+{
+    int a, b;// Spheres, a < b
+    double nx, ny, nz;// Unit vector from a to b
+    double target;// Speed along n the spheres should separate at
+    double share;// Reduced mass, 1/(1/ma + 1/mb)
+    double impulse;// Total push so far
+};
+
+class ContactSolver
+{
+public:
+    // Threads to split the islands over, set by the engine that owns the solver (NULL runs on the caller)
+    ThreadPool *pool = NULL;
+
+    // Make room for bodies bodies and about one contact per sphere, before any are found
+    // Call every step before Solve, so spheres meeting for the first time don't allocate.
+    void Reserve (int bodies, int spheres)
+    {
+        parent.resize(bodies);
+        islandStart.resize(bodies + 1);
+        islandFill.resize(bodies);
+        if (touching.capacity() < size_t(spheres)) touching.reserve(spheres);
+        if (contacts.capacity() < size_t(spheres)) contacts.reserve(spheres);
+        if (islands.capacity() < size_t(spheres)) islands.reserve(spheres);
+    }
+
+    // Bounce every pair in pairs that really is touching and moving together
+    // Elasticity is BOUNCE_MIXED, or BOUNCE_ELASTIC or BOUNCE_INELASTIC if every sphere is.
+    // Returns the number of contacts found.
+    template <int Elasticity = BOUNCE_MIXED>
+    int Solve (BodyStore &s, const std::vector<SpherePair> &pairs)
+    {
+        int n = s.Size();
+        Gather(s, pairs);
+        if (contacts.empty()) return 0;
+        FindIslands(n);
+
+        ParallelFor(pool, int(islands.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++) SolveIsland<Elasticity>(s, islands[k]);
+        }, 16);
+        return int(contacts.size());
+    }
+
+    // Islands found by the last Solve, for reports
+    int Islands () const
+    {
+        return int(islands.size());
+    }
+
+private:
+    std::vector<SpherePair> touching;// Pairs really touching, sorted
+    std::vector<Contact> contacts;// The touching pairs, grouped by island
+    std::vector<int> parent;// Union-find forest over the bodies
+    std::vector<int> islandStart;// Where each root's contacts start in contacts, indexed like the BodyStore
+    std::vector<int> islandFill;// Next free place in each root's run
+    std::vector<int> islands;// Root of every island
+
+    // Keep the pairs that overlap, in a fixed order
+    void Gather (const BodyStore &s, const std::vector<SpherePair> &pairs)
+    {
+        touching.clear();
+        if (touching.capacity() < pairs.size()) touching.reserve(pairs.size());
+        for (const SpherePair &pair : pairs)
+        {
+            double dx = s.x[pair.b] - s.x[pair.a];
+            double dy = s.y[pair.b] - s.y[pair.a];
+            double dz = s.z[pair.b] - s.z[pair.a];
+            double d = sqrt(dx*dx + dy*dy + dz*dz);
+            // Spheres in exactly the same place have no direction to bounce in
+            if (d > s.radius[pair.a] + s.radius[pair.b] || d == 0) continue;
+            touching.push_back(pair);
+        }
+        std::sort(touching.begin(), touching.end(), [](const SpherePair &p, const SpherePair &q) { return p.a < q.a || (p.a == q.a && p.b < q.b); });
+        contacts.resize(touching.size());
+    }
+
+    int Root (int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // Join spheres touching into islands and lay the contacts out island by island
+    // Each island is named after its lowest body and keeps its contacts in sorted order.
+    void FindIslands (int n)
+    {
+        parent.resize(n);
+        islandStart.assign(n + 1, 0);
+        islandFill.resize(n);
+        for (const SpherePair &pair : touching)
+        {
+            parent[pair.a] = pair.a;
+            parent[pair.b] = pair.b;
+        }
+        for (const SpherePair &pair : touching)
+        {
+            int ra = Root(pair.a), rb = Root(pair.b);
+            if (ra < rb) parent[rb] = ra;
+            else if (rb < ra) parent[ra] = rb;
+        }
+
+        islands.clear();
+        for (const SpherePair &pair : touching) islandStart[Root(pair.a) + 1]++;
+        for (int i = 0; i < n; i++)
+        {
+            if (islandStart[i + 1] > 0) islands.push_back(i);
+            islandStart[i + 1] += islandStart[i];
+        }
+        std::copy(islandStart.begin(), islandStart.end() - 1, islandFill.begin());
+        for (const SpherePair &pair : touching)
+        {
+            Contact &contact = contacts[islandFill[Root(pair.a)]++];
+            contact.a = pair.a;
+            contact.b = pair.b;
+        }
+    }
+
+    // Solve the contacts of one island
+    template <int Elasticity>
+    void SolveIsland (BodyStore &s, int root)
+    {
+        int begin = islandStart[root], end = islandStart[root + 1];
+
+        // What every contact is aiming for, from the velocities the spheres met at
+        for (int c = begin; c < end; c++)
+        {
+            Contact &contact = contacts[c];
+            int a = contact.a, b = contact.b;
+            double dx = s.x[b] - s.x[a], dy = s.y[b] - s.y[a], dz = s.z[b] - s.z[a];
+            double d = sqrt(dx*dx + dy*dy + dz*dz);
+            contact.nx = dx/d;
+            contact.ny = dy/d;
+            contact.nz = dz/d;
+            double closing = Closing(s, contact);
+            contact.target = closing < 0 ? -PairElasticity<Elasticity>(s, a, b)*closing : 0;
+            contact.share = 1/(1/s.mass[a] + 1/s.mass[b]);
+            contact.impulse = 0;
+        }
+
+        for (int pass = 0; pass < CONTACT_ITERATIONS; pass++)
+        {
+            bool changed = false;
+            for (int c = begin; c < end; c++)
+            {
+                Contact &contact = contacts[c];
+                // Push towards the target, but the total push can never pull the spheres together
+                double push = std::max(contact.impulse + (contact.target - Closing(s, contact))*contact.share, 0.0) - contact.impulse;
+                if (push == 0) continue;
+                contact.impulse += push;
+                Apply(s, contact, push);
+                changed = true;
+            }
+            if (!changed) break;
+        }
+    }
+
+    // Speed b moves away from a along the contact normal (negative when they are moving together)
+    static double Closing (const BodyStore &s, const Contact &contact)
+    {
+        return (s.vx[contact.b] - s.vx[contact.a])*contact.nx + (s.vy[contact.b] - s.vy[contact.a])*contact.ny
+             + (s.vz[contact.b] - s.vz[contact.a])*contact.nz;
+    }
+
+    static void Apply (BodyStore &s, const Contact &contact, double push)
+    {
+        double pa = push/s.mass[contact.a], pb = push/s.mass[contact.b];
+        s.vx[contact.a] -= contact.nx*pa;
+        s.vy[contact.a] -= contact.ny*pa;
+        s.vz[contact.a] -= contact.nz*pa;
+        s.vx[contact.b] += contact.nx*pb;
+        s.vy[contact.b] += contact.ny*pb;
+        s.vz[contact.b] += contact.nz*pb;
+    }
+};
+
+#endif // CONTACTS_H_INCLUDED
@@ -0,0 +1,815 @@
+#ifndef ENGINE_H_INCLUDED
+#define ENGINE_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include "vec3.h"
+#include "bodies.h"
+#include "gravity.h"
+#include "simd.h"
+#include "parallel.h"
+#include "integrator.h"
+#include "broadphase.h"
+#include "contacts.h"
+#include "units.h"
+
+// The physics engine
+// Everything in here has to compile without SDL, OpenGL, Assimp or FreeType so the
+// simulation can run on machines that can't open a window (see headless.cpp).
+
+#define GRAVITATIONAL_CONSTANT 6.67e-11
+
+#define ENGINE_GRAIN 1024// Fewest bodies worth handing to another thread in the cheap passes
+
+#define CONTACTS_PAIRWISE 0// Every sphere bounces off its contacts in turn, against the velocity the other had at the start of the step
+#define CONTACTS_ISLANDS 1// Contacts are gathered, split into islands and solved together (see contacts.h)
+
+// What a scene needs from the collision pass, which is compiled once for every combination
+// so the pass a scene runs has no tests for anything it doesn't need (see Engine::Collide)
+#define FEATURE_WALLS 1// A visible domain keeps the spheres in
+#define FEATURE_SWEPT 2// Drifts are swept, so only spheres still heading into something bounce
+#define FEATURE_ISLANDS 4// Contacts are solved by islands rather than pairwise
+#define FEATURE_ELASTIC 8// Every colliding sphere has elasticity 1
+#define FEATURE_INELASTIC 16// Every colliding sphere has elasticity 0
+#define FEATURE_SETS 32// Number of combinations
+
+#define CCD_MAX_ROUNDS 64// Most impacts a swept drift stops at before leaving the rest to Collide
+#define CCD_TOGETHER 1e-9// Impacts this fraction of the drift after the earliest are resolved along with it
+
+// Velocity of a sphere of mass ma after hitting one of mass mb, colDir pointing from it to the other
+// Elasticity is one of the BOUNCE_ constants; only BOUNCE_MIXED needs el.
+template <int Elasticity = BOUNCE_MIXED>
+inline Vec3 Bounce (const Vec3 &velocity, const Vec3 &other, const Vec3 &colDir, double ma, double mb, double el)
+{
+    // The component of each velocity along the axis is the only part used in the collision
+    Vec3 via = colDir*Dot(velocity, colDir);
+    Vec3 viNA = velocity - via;
+    Vec3 vib = colDir*Dot(other, colDir);
+
+    // Blend of the elastic and perfectly inelastic results
+    Vec3 vfa;
+    if (Elasticity == BOUNCE_ELASTIC) vfa = via*((ma - mb)/(ma + mb)) + vib*((2*mb)/(ma + mb));
+    else if (Elasticity == BOUNCE_INELASTIC) vfa = (via*ma + vib*mb)/(ma + mb);
+    else vfa = (via*((ma - mb)/(ma + mb)) + vib*((2*mb)/(ma + mb)))*el + ((via*ma + vib*mb)/(ma + mb))*(1 - el);
+
+    // Add back the component of the velocity that was not involved in the collision
+    vfa += Reflect(viNA, colDir);
+    return vfa;
+}
+
+// Change the velocity of sphere a if it is touching sphere b
+template <int Elasticity = BOUNCE_MIXED>
+inline void CollideSpheres (BodyStore &s, int a, int b)
+{
+    Vec3 locA = s.Location(a);
+    Vec3 locB = s.Location(b);
+
+    // If the distance between the objects is smaller than the sum of their radii
+    if (Distance(locA, locB) > (s.radius[a] + s.radius[b])) return;
+
+    // Axis of normal alignment
+    Vec3 colDir = Normalize(locB - locA);
+
+    // b is read from the velocity it had at the start of the step
+    double el = PairElasticity<Elasticity>(s, a, b);
+    Vec3 vfa = Bounce<Elasticity>(s.Velocity(a), Vec3(s.oldVx[b], s.oldVy[b], s.oldVz[b]), colDir, s.mass[a], s.mass[b], el);
+    s.vx[a] = vfa.x;
+    s.vy[a] = vfa.y;
+    s.vz[a] = vfa.z;
+}
+
+// Bounce spheres a and b off each other, both at once, if they are moving together
+// Used where a sweep has found they have just met. Returns whether they bounced.
+inline bool ImpactSpheres (BodyStore &s, int a, int b)
+{
+    Vec3 colDir = Normalize(s.Location(b) - s.Location(a));
+    Vec3 va = s.Velocity(a);
+    Vec3 vb = s.Velocity(b);
+    if (Dot(vb - va, colDir) >= 0) return false;
+
+    double el = (s.elasticity[a] + s.elasticity[b])/2;
+    Vec3 vfa = Bounce(va, vb, colDir, s.mass[a], s.mass[b], el);
+    Vec3 vfb = Bounce(vb, va, -colDir, s.mass[b], s.mass[a], el);
+    s.vx[a] = vfa.x;
+    s.vy[a] = vfa.y;
+    s.vz[a] = vfa.z;
+    s.vx[b] = vfb.x;
+    s.vy[b] = vfb.y;
+    s.vz[b] = vfb.z;
+    return true;
+}
+
+// When spheres a and b, carrying on in straight lines, will first touch
+// Negative if they never will. Spheres already overlapping and moving together touch straight away.
+inline double TimeOfImpact (const BodyStore &s, int a, int b)
+{
+    double px = s.x[b] - s.x[a], py = s.y[b] - s.y[a], pz = s.z[b] - s.z[a];
+    double vx = s.vx[b] - s.vx[a], vy = s.vy[b] - s.vy[a], vz = s.vz[b] - s.vz[a];
+    double reach = s.radius[a] + s.radius[b];
+    double apart = px*px + py*py + pz*pz;
+    double speed = vx*vx + vy*vy + vz*vz;
+    double closing = px*vx + py*vy + pz*vz;
+
+    // Moving apart, or so nearly side by side that rounding could say either
+    if (closing >= -TOUCH_SLACK*sqrt(apart*speed)) return -1;
+    double gap = apart - reach*reach;
+    if (gap <= 0) return 0;
+
+    // |p + v*t| = reach, the earlier root, written so it doesn't lose precision
+    double disc = closing*closing - speed*gap;
+    if (disc < 0) return -1;
+    return gap/(-closing + sqrt(disc));
+}
+
+// When sphere a, carrying on in a straight line, will first touch a wall of the domain d
+// Negative if it never will. A sphere already through a wall and still heading out touches straight away.
+inline double TimeToWall (const BodyStore &s, int a, int d)
+{
+    double reach = s.radius[d] - s.radius[a];
+    double p[3] = {s.x[a], s.y[a], s.z[a]};
+    double v[3] = {s.vx[a], s.vy[a], s.vz[a]};
+    double first = -1;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (v[axis] == 0) continue;
+        double t = std::max(0.0, ((v[axis] > 0 ? reach : -reach) - p[axis])/v[axis]);
+        if (first < 0 || t < first) first = t;
+    }
+    return first;
+}
+
+// Keep sphere a inside the domain d (a cube with half width radius[d])
+// Returns whether a touched a wall (and so was moved back inside). With OutwardOnly a
+// wall only counts if the sphere is heading through it, and a touch within rounding
+// counts, which is what a sweep that has just stopped at the wall needs.
+template <bool OutwardOnly = false>
+inline bool CollideWalls (BodyStore &s, int a, int d)
+{
+    const bool outwardOnly = OutwardOnly;
+    double r = s.radius[a];
+    double reach = outwardOnly ? r*(1 + TOUCH_SLACK) : r;
+    double wall = s.radius[d];
+    bool collision = false;
+    Vec3 colDir;
+
+    // +x and -x sides of the domain
+    if ((s.x[a] + reach) >= wall && (!outwardOnly || s.vx[a] > 0)) { colDir.x += 1; s.x[a] = wall - r; collision = true; }
+    if ((s.x[a] - reach) <= -wall && (!outwardOnly || s.vx[a] < 0)) { colDir.x -= 1; s.x[a] = -wall + r; collision = true; }
+    // +y and -y sides of the domain
+    if ((s.y[a] + reach) >= wall && (!outwardOnly || s.vy[a] > 0)) { colDir.y += 1; s.y[a] = wall - r; collision = true; }
+    if ((s.y[a] - reach) <= -wall && (!outwardOnly || s.vy[a] < 0)) { colDir.y -= 1; s.y[a] = -wall + r; collision = true; }
+    // +z and -z sides of the domain
+    if ((s.z[a] + reach) >= wall && (!outwardOnly || s.vz[a] > 0)) { colDir.z += 1; s.z[a] = wall - r; collision = true; }
+    if ((s.z[a] - reach) <= -wall && (!outwardOnly || s.vz[a] < 0)) { colDir.z -= 1; s.z[a] = -wall + r; collision = true; }
+
+    if (!collision) return false;
+
+    colDir = Normalize(colDir);
+
+    // Only the momentum-relevant component is effected by elasticity
+    Vec3 velocity = s.Velocity(a);
+    Vec3 via = colDir*Dot(velocity, colDir);
+    Vec3 viNA = velocity - via;
+    Vec3 vfa = -via*s.elasticity[a] + Reflect(viNA, colDir);
+    s.vx[a] = vfa.x;
+    s.vy[a] = vfa.y;
+    s.vz[a] = vfa.z;
+    return true;
+}
+
+// Holds every body and advances them through time
+class Engine : public Integrable
+{
+public:
+    BodyStore bodies;
+    // Threads every pass is split over, declared before the solver so it outlives it
+    ThreadPool pool;
+    // How gravity is worked out (vectorized direct summation unless something else is chosen)
+    std::unique_ptr<GravitySolver> gravity;
+    // How bodies are moved through each step (kick-drift-kick leapfrog unless something else is chosen)
+    std::unique_ptr<Integrator> integrator;
+    // How spheres that might be touching are found (a spatial hash unless something else is chosen)
+    std::unique_ptr<BroadPhase> broadPhase;
+
+    unsigned long long steps = 0;// Number of steps taken
+    unsigned long long forceEvaluations = 0;// Number of times gravity has been worked out for every body
+    unsigned long long bodyForceEvaluations = 0;// Number of accelerations worked out, body by body
+    double time = 0;// Simulated seconds
+    // Sweep spheres along their paths while drifting, so fast ones can't pass through each other or the walls
+    bool continuous = false;
+    // How touching spheres are bounced off each other, CONTACTS_ISLANDS or CONTACTS_PAIRWISE
+    int contactScheme = CONTACTS_ISLANDS;
+    // Solves the contacts when contactScheme is CONTACTS_ISLANDS
+    ContactSolver contactSolver;
+    // Units the gravity solver works in, when useUnits is set (see units.h)
+    // The bodies themselves always stay in metres, kilograms and seconds.
+    UnitSystem units;
+    bool useUnits = false;
+    unsigned long long impacts = 0;// Impacts the sweeps have stopped at
+
+    // Which bodies each pass works on, so no pass has to skip over the others
+    // Only built again when a body is added or has its flags changed (see UpdateLists).
+    std::vector<int> visible;// Every body that isn't hidden
+    std::vector<int> gravitating;// Visible spheres, the bodies that attract each other
+    std::vector<int> colliders;// Visible spheres that collide
+    std::vector<int> walls;// Visible domains that collide
+    // Gravitational acceleration of every body from the last step
+    Accelerations acc;
+
+    Engine (int threads = DefaultThreadCount(), bool pin = false): pool(threads, pin)
+    {
+        SetGravitySolver(new SimdDirectGravity());
+        SetIntegrator(new LeapfrogIntegrator());
+        SetBroadPhase(new SpatialHashBroadPhase());
+        contactSolver.pool = &pool;
+    }
+
+    // Switch to a different gravity solver, the engine owns it from now on
+    void SetGravitySolver (GravitySolver *solver)
+    {
+        gravity.reset(solver);
+        gravity->pool = &pool;
+        forcesCurrent = false;
+    }
+
+    // Have the gravity solver work in these units, with G = 1
+    void SetUnits (const UnitSystem &newUnits)
+    {
+        units = newUnits;
+        useUnits = true;
+        gravity->Invalidate();
+        forcesCurrent = false;
+    }
+
+    // Pick units from how the visible spheres are spread out now and have the gravity solver use them
+    void SetSceneUnits ()
+    {
+        UpdateLists();
+        SetUnits(UnitSystem::ForScene(bodies, gravitating, GRAVITATIONAL_CONSTANT));
+    }
+
+    // Switch to a different broad phase, the engine owns it from now on
+    void SetBroadPhase (BroadPhase *newBroadPhase)
+    {
+        broadPhase.reset(newBroadPhase);
+        broadPhase->pool = &pool;
+    }
+
+    // Switch to a different integrator, the engine owns it from now on
+    void SetIntegrator (Integrator *newIntegrator)
+    {
+        integrator.reset(newIntegrator);
+    }
+
+    // Use this many threads (including the one calling Step), each pinned to its own core if pin is set
+    void SetThreads (int threads, bool pin = false)
+    {
+        pool.Resize(threads, pin);
+    }
+
+    // Add a body and return its index
+    int AddBody (const Body &body)
+    {
+        return bodies.Add(body);
+    }
+
+    // Sort the bodies into visible, gravitating, colliders and walls if any flags have changed
+    // Step does this itself; anything using the lists between steps should call it first.
+    void UpdateLists ()
+    {
+        BodyStore &s = bodies;
+        if (listsCurrent && !s.flagsChanged && listed == s.Size()) return;
+        visible.clear();
+        gravitating.clear();
+        colliders.clear();
+        walls.clear();
+        for (int i = 0; i < s.Size(); i++)
+        {
+            if (s.Hidden(i)) continue;
+            visible.push_back(i);
+            if (s.IsSphere(i)) gravitating.push_back(i);
+            if (!s.Collides(i)) continue;
+            if (s.IsSphere(i)) colliders.push_back(i);
+            else walls.push_back(i);
+        }
+        listed = s.Size();
+        listings++;
+        listsCurrent = true;
+        featuresCurrent = false;
+    }
+
+    // Advance the simulation by dTime seconds
+    void Step (double dTime)
+    {
+        BodyStore &s = bodies;
+        int n = s.Size();
+
+        // Masses only need to be worked out again for bodies that have been edited
+        if (s.anyChanged)
+        {
+            gravity->Invalidate();
+            forcesCurrent = false;
+            if (s.flagsChanged) listsCurrent = false;
+            featuresCurrent = false;
+            ParallelFor(&pool, n, [&](int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    if (s.changed[i] & CHANGED_MASS) s.mass[i] = s.massNum[i] * pow(10, s.massExp[i]);
+                }
+            }, ENGINE_GRAIN);
+            s.ClearChanges();
+        }
+        UpdateLists();
+
+        // Remember velocities
+        ParallelFor(&pool, int(visible.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = visible[k];
+                s.oldVx[i] = s.vx[i];
+                s.oldVy[i] = s.vy[i];
+                s.oldVz[i] = s.vz[i];
+            }
+        }, ENGINE_GRAIN);
+
+        integrator->Step(*this, dTime);
+
+        steps++;
+        time += dTime;
+    }
+
+    // Do gravity between every pair of spheres
+    void ComputeForces ()
+    {
+        UpdateLists();
+        acc.Resize(bodies.Size());
+        if (useUnits)
+        {
+            Scale();
+            gravity->SetLengthUnit(units.length);
+            gravity->ComputeAccelerations(scaled, gravitating, 1, acc);
+            Unscale(gravitating);
+        }
+        else
+        {
+            gravity->SetLengthUnit(1);
+            gravity->ComputeAccelerations(bodies, gravitating, GRAVITATIONAL_CONSTANT, acc);
+        }
+        forceEvaluations++;
+        bodyForceEvaluations += gravitating.size();
+        forcesCurrent = true;
+    }
+
+    // Gravity on only the targets, from every sphere
+    void ComputeForcesOn (const std::vector<int> &targets)
+    {
+        if (targets.empty()) return;
+        if (useUnits)
+        {
+            Scale();
+            gravity->SetLengthUnit(units.length);
+            gravity->ComputeAccelerationsOn(scaled, gravitating, targets, 1, acc);
+            Unscale(targets);
+        }
+        else
+        {
+            gravity->SetLengthUnit(1);
+            gravity->ComputeAccelerationsOn(bodies, gravitating, targets, GRAVITATIONAL_CONSTANT, acc);
+        }
+        bodyForceEvaluations += targets.size();
+        forcesCurrent = targets.size() == gravitating.size();
+    }
+
+    bool ForcesCurrent () const
+    {
+        return forcesCurrent;
+    }
+
+    BodyStore &Bodies ()
+    {
+        return bodies;
+    }
+
+    Accelerations &Forces ()
+    {
+        return acc;
+    }
+
+    const std::vector<int> &Gravitating () const
+    {
+        return gravitating;
+    }
+
+    void Kick (double dt)
+    {
+        BodyStore &s = bodies;
+        ParallelFor(&pool, int(gravitating.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = gravitating[k];
+                s.vx[i] += acc.x[i]*dt;
+                s.vy[i] += acc.y[i]*dt;
+                s.vz[i] += acc.z[i]*dt;
+            }
+        }, ENGINE_GRAIN);
+    }
+
+    // Move everything
+    void Drift (double dt)
+    {
+        // Drifting backwards (Yoshida's middle stage) isn't swept, it only undoes part of a forward drift
+        if (continuous && dt > 0) SweptDrift(dt);
+        else Move(dt);
+        forcesCurrent = false;
+    }
+
+    // Move everything without sweeping, for moves that are undone straight after
+    void DriftUnswept (double dt)
+    {
+        Move(dt);
+        forcesCurrent = false;
+    }
+
+    // Move everything in a straight line, without looking for anything in the way
+    void Move (double dt)
+    {
+        BodyStore &s = bodies;
+        ParallelFor(&pool, int(visible.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = visible[k];
+                s.x[i] += s.vx[i]*dt;
+                s.y[i] += s.vy[i]*dt;
+                s.z[i] += s.vz[i]*dt;
+            }
+        }, ENGINE_GRAIN);
+    }
+
+    // Move everything, stopping at every impact on the way
+    // Spheres move in straight lines during a drift, so when two of them (or a sphere and a
+    // wall) will meet can be solved for exactly. Everything moves up to the earliest impact,
+    // the bodies there bounce, and the drift carries on from that moment, so a step can be
+    // far longer than a sphere's width divided by its speed without anything passing through.
+    //
+    // The broad phase finds the pairs that could meet by treating each sphere as big enough
+    // to cover everywhere it could reach before the drift ends. That stays true after a
+    // bounce unless the bounce sped a sphere up, which is the only time it's asked again.
+    void SweptDrift (double dt)
+    {
+        BodyStore &s = bodies;
+        int n = s.Size();
+        swept.x.resize(n);
+        swept.y.resize(n);
+        swept.z.resize(n);
+        swept.radius.resize(n);
+        sweptSpeed.resize(n);
+
+        double left = dt;
+        bool stale = true;
+        for (int round = 0; round < CCD_MAX_ROUNDS && left > 0; round++)
+        {
+            if (stale) FindPaths(left);
+            stale = false;
+
+            // When every pair that could meet will, and when every sphere near a wall reaches it
+            ParallelFor(&pool, int(pathPairs.size()), [&](int begin, int end)
+            {
+                for (int p = begin; p < end; p++) pairTime[p] = TimeOfImpact(s, pathPairs[p].a, pathPairs[p].b);
+            }, ENGINE_GRAIN);
+            ParallelFor(&pool, int(nearWalls.size()), [&](int begin, int end)
+            {
+                for (int k = begin; k < end; k++)
+                {
+                    wallTime[k] = -1;
+                    for (int d : walls)
+                    {
+                        double t = TimeToWall(s, nearWalls[k], d);
+                        if (t >= 0 && (wallTime[k] < 0 || t < wallTime[k])) wallTime[k] = t;
+                    }
+                }
+            }, ENGINE_GRAIN);
+
+            double first = left + 1;
+            for (double t : pairTime) if (t >= 0 && t < first) first = t;
+            for (double t : wallTime) if (t >= 0 && t < first) first = t;
+            if (first > left) break;
+
+            Move(first);
+            left -= first;
+
+            // Bounce everything meeting now, pairs in order so the result doesn't depend on threads
+            double now = first + CCD_TOGETHER*dt;
+            for (size_t p = 0; p < pathPairs.size(); p++)
+            {
+                if (pairTime[p] < 0 || pairTime[p] > now) continue;
+                int a = pathPairs[p].a, b = pathPairs[p].b;
+                if (!ImpactSpheres(s, a, b)) continue;
+                impacts++;
+                stale = stale || SpedUp(a) || SpedUp(b);
+            }
+            for (size_t k = 0; k < nearWalls.size(); k++)
+            {
+                if (wallTime[k] < 0 || wallTime[k] > now) continue;
+                int a = nearWalls[k];
+                for (int d : walls)
+                {
+                    if (CollideWalls<true>(s, a, d)) impacts++;
+                }
+                stale = stale || SpedUp(a);
+            }
+        }
+
+        // Whatever is left has nothing in the way (or the rounds ran out, and Collide tidies up)
+        if (left > 0) Move(left);
+    }
+
+    // Move everything, bending the path of the gravitating bodies by their acceleration
+    void DriftAccelerated (double dt)
+    {
+        Drift(dt);
+        BodyStore &s = bodies;
+        double half = dt*dt/2;
+        ParallelFor(&pool, int(gravitating.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = gravitating[k];
+                s.x[i] += acc.x[i]*half;
+                s.y[i] += acc.y[i]*half;
+                s.z[i] += acc.z[i]*half;
+            }
+        }, ENGINE_GRAIN);
+    }
+
+    // Check collisions
+    // The walls go first, each sphere on its own, because they move spheres back inside the
+    // domain; after that no position changes. The broad phase then finds the pairs that
+    // might touch, and the contact solver bounces the ones that do, island by island.
+    //
+    // With CONTACTS_PAIRWISE each sphere instead runs through its own pairs in order of the
+    // other body's index, as the simulator always did. Every sphere only changes itself, so
+    // the spheres can still be split across threads.
+    //
+    // With continuous on the sweeps have already bounced everything that met while
+    // drifting, so only spheres still heading into each other or a wall bounce here.
+    //
+    // The pass is compiled for every set of FEATURE_ bits and the one matching the scene is
+    // picked here, so the loops never test for walls, sweeping or elasticity themselves.
+    void Collide ()
+    {
+        if (colliders.empty()) return;
+        static const std::array<CollidePass, FEATURE_SETS> passes = CollidePasses(std::make_index_sequence<FEATURE_SETS>());
+        (this->*passes[Features()])();
+    }
+
+    // The FEATURE_ bits the collision pass is running with, 0 when nothing collides and there's no pass
+    int Features ()
+    {
+        if (colliders.empty()) return 0;
+        if (!featuresCurrent) FindFeatures();
+        return sceneFeatures | (continuous ? FEATURE_SWEPT : 0) | (contactScheme == CONTACTS_ISLANDS ? FEATURE_ISLANDS : 0);
+    }
+
+    // The collision pass for one set of FEATURE_ bits
+    template <int Features>
+    void CollideAs ()
+    {
+        const bool swept = (Features & FEATURE_SWEPT) != 0;
+        const int elasticity = (Features & FEATURE_ELASTIC) ? BOUNCE_ELASTIC : (Features & FEATURE_INELASTIC) ? BOUNCE_INELASTIC : BOUNCE_MIXED;
+        BodyStore &s = bodies;
+        int n = s.Size();
+
+        std::atomic<bool> moved(false);
+        if (Features & FEATURE_WALLS)
+        {
+            ParallelFor(&pool, int(colliders.size()), [&](int begin, int end)
+            {
+                for (int k = begin; k < end; k++)
+                {
+                    for (int d : walls)
+                    {
+                        if (CollideWalls<swept>(s, colliders[k], d)) moved.store(true, std::memory_order_relaxed);
+                    }
+                }
+            }, ENGINE_GRAIN);
+        }
+        // A sphere pushed back off a wall isn't where its acceleration was worked out for
+        if (moved) forcesCurrent = false;
+
+        // Room for about one contact per sphere before any are found, so the first collision doesn't allocate
+        if (pairs.capacity() < colliders.size()) pairs.reserve(colliders.size());
+        if (contactOther.capacity() < 2*colliders.size()) contactOther.reserve(2*colliders.size());
+        contactStart.assign(n + 1, 0);
+        contactFill.resize(n);
+        if (Features & FEATURE_ISLANDS) contactSolver.Reserve(n, int(colliders.size()));
+
+        broadPhase->FindPairs(s, colliders, pairs);
+        if (pairs.empty()) return;
+        if (Features & FEATURE_ISLANDS)
+        {
+            contactSolver.Solve<elasticity>(s, pairs);
+            return;
+        }
+
+        // Turn the pairs into a sorted list of the others for every body
+        for (const SpherePair &pair : pairs)
+        {
+            contactStart[pair.a + 1]++;
+            contactStart[pair.b + 1]++;
+        }
+        for (int i = 0; i < n; i++) contactStart[i + 1] += contactStart[i];
+        contactOther.resize(contactStart[n]);
+        std::copy(contactStart.begin(), contactStart.end() - 1, contactFill.begin());
+        for (const SpherePair &pair : pairs)
+        {
+            contactOther[contactFill[pair.a]++] = pair.b;
+            contactOther[contactFill[pair.b]++] = pair.a;
+        }
+
+        // Velocities have changed since the start of the step, so judge who is heading where from now
+        if (swept)
+        {
+            ParallelFor(&pool, int(colliders.size()), [&](int begin, int end)
+            {
+                for (int k = begin; k < end; k++)
+                {
+                    int i = colliders[k];
+                    s.oldVx[i] = s.vx[i];
+                    s.oldVy[i] = s.vy[i];
+                    s.oldVz[i] = s.vz[i];
+                }
+            }, ENGINE_GRAIN);
+        }
+
+        ParallelFor(&pool, n, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                if (contactStart[i] == contactStart[i + 1]) continue;
+                std::sort(contactOther.begin() + contactStart[i], contactOther.begin() + contactStart[i + 1]);
+                for (int c = contactStart[i]; c < contactStart[i + 1]; c++)
+                {
+                    int other = contactOther[c];
+                    if (swept && !Closing(i, other)) continue;
+                    CollideSpheres<elasticity>(s, i, other);
+                }
+            }
+        }, ENGINE_GRAIN);
+    }
+
+    // Kinetic plus gravitational potential energy of the visible spheres
+    double Energy ()
+    {
+        UpdateLists();
+        return TotalEnergy(bodies, gravitating, GRAVITATIONAL_CONSTANT);
+    }
+
+private:
+    bool forcesCurrent = false;// acc matches the current positions
+    bool featuresCurrent = false;// sceneFeatures matches the bodies
+    int sceneFeatures = 0;// FEATURE_WALLS, FEATURE_ELASTIC and FEATURE_INELASTIC bits for the bodies as they are
+
+    // Copy what the gravity solvers read into scaled, in the engine's units
+    // Only the visible bodies are brought up to date; the flags of every body are copied so
+    // a solver looking for the domain sees the same bodies as in the real store.
+    void Scale ()
+    {
+        const BodyStore &s = bodies;
+        int n = s.Size();
+        if (scaled.Size() != n || scaledLists != listings)
+        {
+            scaled.x.resize(n);
+            scaled.y.resize(n);
+            scaled.z.resize(n);
+            scaled.mass.resize(n);
+            scaled.radius.resize(n);
+            scaled.flags = s.flags;
+            scaledLists = listings;
+        }
+        double perLength = 1/units.length, perMass = 1/units.mass;
+        ParallelFor(&pool, int(visible.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = visible[k];
+                scaled.x[i] = s.x[i]*perLength;
+                scaled.y[i] = s.y[i]*perLength;
+                scaled.z[i] = s.z[i]*perLength;
+                scaled.mass[i] = s.mass[i]*perMass;
+                scaled.radius[i] = s.radius[i]*perLength;
+            }
+        }, ENGINE_GRAIN);
+    }
+
+    // Turn the accelerations of the bodies just worked out back into metres per second squared
+    void Unscale (const std::vector<int> &which)
+    {
+        double factor = units.Acceleration();
+        ParallelFor(&pool, int(which.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = which[k];
+                acc.x[i] *= factor;
+                acc.y[i] *= factor;
+                acc.z[i] *= factor;
+            }
+        }, ENGINE_GRAIN);
+    }
+
+    typedef void (Engine::*CollidePass)();
+
+    // Every instantiation of CollideAs, indexed by its FEATURE_ bits
+    template <size_t... Features>
+    static std::array<CollidePass, sizeof...(Features)> CollidePasses (std::index_sequence<Features...>)
+    {
+        return {{&Engine::CollideAs<int(Features)>...}};
+    }
+
+    // Work out which of the scene's FEATURE_ bits hold
+    void FindFeatures ()
+    {
+        const BodyStore &s = bodies;
+        bool elastic = true, inelastic = true;
+        for (int i : colliders)
+        {
+            elastic = elastic && s.elasticity[i] == 1;
+            inelastic = inelastic && s.elasticity[i] == 0;
+        }
+        sceneFeatures = (walls.empty() ? 0 : FEATURE_WALLS) | (elastic ? FEATURE_ELASTIC : inelastic ? FEATURE_INELASTIC : 0);
+        featuresCurrent = true;
+    }
+
+    // Find the pairs of spheres that could meet, and the spheres that could reach a wall, in the next dt
+    void FindPaths (double dt)
+    {
+        BodyStore &s = bodies;
+        double wall = 0;
+        for (int d : walls) wall = std::max(wall, s.radius[d]);
+        // Room for a couple of crossings per sphere, so sweeping doesn't allocate once it's running
+        size_t room = 2*colliders.size();
+        if (pathPairs.capacity() < room) pathPairs.reserve(room);
+        if (pairTime.capacity() < room) pairTime.reserve(room);
+        if (nearWalls.capacity() < colliders.size()) nearWalls.reserve(colliders.size());
+        if (wallTime.capacity() < colliders.size()) wallTime.reserve(colliders.size());
+        nearWalls.clear();
+        for (int i : colliders)
+        {
+            double speed = Length(s.Velocity(i));
+            double reach = s.radius[i] + speed*dt;
+            swept.x[i] = s.x[i];
+            swept.y[i] = s.y[i];
+            swept.z[i] = s.z[i];
+            swept.radius[i] = reach;
+            sweptSpeed[i] = speed;
+            if (!walls.empty() && std::max(fabs(s.x[i]), std::max(fabs(s.y[i]), fabs(s.z[i]))) + reach >= wall*(1 - TOUCH_SLACK)) nearWalls.push_back(i);
+        }
+        broadPhase->FindPairs(swept, colliders, pathPairs);
+        std::sort(pathPairs.begin(), pathPairs.end(), [](const SpherePair &p, const SpherePair &q) { return p.a < q.a || (p.a == q.a && p.b < q.b); });
+        pairTime.resize(pathPairs.size());
+        wallTime.resize(nearWalls.size());
+    }
+
+    // Whether sphere i is now faster than its path was allowed for
+    bool SpedUp (int i) const
+    {
+        return Length(bodies.Velocity(i)) > sweptSpeed[i]*(1 + TOUCH_SLACK);
+    }
+
+    // Whether spheres a and b are heading into each other, judged by their velocities at the start of the pass
+    bool Closing (int a, int b) const
+    {
+        const BodyStore &s = bodies;
+        double px = s.x[b] - s.x[a], py = s.y[b] - s.y[a], pz = s.z[b] - s.z[a];
+        return px*(s.oldVx[b] - s.oldVx[a]) + py*(s.oldVy[b] - s.oldVy[a]) + pz*(s.oldVz[b] - s.oldVz[a]) < 0;
+    }
+
+    bool listsCurrent = false;// visible, gravitating, colliders and walls match the flags
+    int listed = 0;// Bodies there were when the lists were made
+    unsigned long long listings = 0;// Times the lists have been made
+    std::vector<SpherePair> pairs;// Spheres the broad phase thinks might be touching
+    std::vector<int> contactStart;// Where each body's list starts in contactOther, indexed like the BodyStore
+    std::vector<int> contactOther;// The other body of every pair, seen from both sides
+    std::vector<int> contactFill;// Next free place in each body's list
+
+    BodyStore scaled;// Only x, y, z, mass, radius and flags used: the bodies in the engine's units
+    unsigned long long scaledLists = 0;// Value of listings when the flags in scaled were copied
+
+    BodyStore swept;// Only x, y, z and radius used: a sphere around everywhere each sphere could get to
+    std::vector<double> sweptSpeed;// Speed each sphere's path in swept was sized for
+    std::vector<SpherePair> pathPairs;// Spheres whose paths might cross, sorted
+    std::vector<double> pairTime;// When each of pathPairs meet, negative if never
+    std::vector<int> nearWalls;// Spheres whose paths might reach a wall
+    std::vector<double> wallTime;// When each of nearWalls reaches a wall, negative if never
+};
+
+#endif // ENGINE_H_INCLUDED
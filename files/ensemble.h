@@ -0,0 +1,424 @@
+#ifndef ENSEMBLE_H_INCLUDED
+#define ENSEMBLE_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "vec3.h"
+#include "bodies.h"
+#include "parallel.h"
+#include "simd.h"
+#include "engine.h"
+
+// Many small scenes stepped side by side
+// Monte Carlo runs simulate the same handful of bodies over and over from slightly different
+// starts. Six bodies can't be split over threads or SIMD lanes to any effect, but a thousand
+// copies of them can. An Ensemble holds every scenario in one structure of arrays, body by
+// body with the scenarios next to each other: x[b*scenarios + s] is body b of scenario s.
+// The sum over the bodies pulling on b then runs over 8 scenarios at once in an AVX-512
+// register (4 with AVX2), and blocks of scenarios are shared out over the threads.
+//
+// Every scenario has the same bodies with the same flags, so they all take the same path
+// through the step. Each one comes out exactly as an Engine with DirectGravity, the leapfrog
+// integrator and CONTACTS_PAIRWISE would step it on its own, to the last bit: the vector
+// kernels do the same multiplies, divides and square roots in the same order, just several
+// scenarios at a time.
+
+#define ENSEMBLE_BLOCK 64// Scenarios each thread steps through the whole step at a time, small enough to stay in cache
+
+// The columns the gravity kernels read and write
+struct EnsembleColumns
+{
+    const double *x, *y, *z, *mass;
+    double *ax, *ay, *az;
+    int stride;// Number of scenarios, the distance from one body to the next in a column
+};
+
+// Acceleration of every active body in scenarios [begin, end), one scenario at a time
+// Used for the tails the vector loops leave over, and for everything on the scalar path.
+inline void EnsembleGravityScalar (const EnsembleColumns &c, const std::vector<int> &active, double G, int begin, int end)
+{
+    for (int i : active)
+    {
+        const int oi = i*c.stride;
+        for (int s = begin; s < end; s++)
+        {
+            double xi = c.x[oi + s], yi = c.y[oi + s], zi = c.z[oi + s];
+            double ax = 0, ay = 0, az = 0;
+            for (int q : active)
+            {
+                if (q == i) continue;
+                const int oq = q*c.stride + s;
+                double dx = c.x[oq] - xi;
+                double dy = c.y[oq] - yi;
+                double dz = c.z[oq] - zi;
+                double r2 = dx*dx + dy*dy + dz*dz;
+                double k = G*c.mass[oq]/(r2*sqrt(r2));
+                ax += dx*k;
+                ay += dy*k;
+                az += dz*k;
+            }
+            c.ax[oi + s] = ax;
+            c.ay[oi + s] = ay;
+            c.az[oi + s] = az;
+        }
+    }
+}
+
+#if SIMD_X86
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// Four scenarios at a time
+// Deliberately without fused multiply add, which would round differently from the scalar loop.
+__attribute__((target("avx2"))) inline void EnsembleGravityAvx2 (const EnsembleColumns &c, const std::vector<int> &active, double G,
+                                                                  int begin, int end)
+{
+    __m256d g = _mm256_set1_pd(G);
+    int s = begin;
+    for (; s + 4 <= end; s += 4)
+    {
+        for (int i : active)
+        {
+            const int oi = i*c.stride + s;
+            __m256d xi = _mm256_loadu_pd(c.x + oi), yi = _mm256_loadu_pd(c.y + oi), zi = _mm256_loadu_pd(c.z + oi);
+            __m256d ax = _mm256_setzero_pd(), ay = _mm256_setzero_pd(), az = _mm256_setzero_pd();
+            for (int q : active)
+            {
+                if (q == i) continue;
+                const int oq = q*c.stride + s;
+                __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(c.x + oq), xi);
+                __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(c.y + oq), yi);
+                __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(c.z + oq), zi);
+                __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+                __m256d k = _mm256_div_pd(_mm256_mul_pd(g, _mm256_loadu_pd(c.mass + oq)), _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+                ax = _mm256_add_pd(ax, _mm256_mul_pd(dx, k));
+                ay = _mm256_add_pd(ay, _mm256_mul_pd(dy, k));
+                az = _mm256_add_pd(az, _mm256_mul_pd(dz, k));
+            }
+            _mm256_storeu_pd(c.ax + oi, ax);
+            _mm256_storeu_pd(c.ay + oi, ay);
+            _mm256_storeu_pd(c.az + oi, az);
+        }
+    }
+    EnsembleGravityScalar(c, active, G, s, end);
+}
+
+// Eight scenarios at a time
+// AVX-512 always has fused multiply add, and GCC will fuse a multiply into the add after it
+// if it's allowed to, so this is compiled with contraction off.
+__attribute__((target("avx512f"), optimize("fp-contract=off"))) inline void EnsembleGravityAvx512 (const EnsembleColumns &c, const std::vector<int> &active,
+                                                                                                   double G, int begin, int end)
+{
+    __m512d g = _mm512_set1_pd(G);
+    int s = begin;
+    for (; s + 8 <= end; s += 8)
+    {
+        for (int i : active)
+        {
+            const int oi = i*c.stride + s;
+            __m512d xi = _mm512_loadu_pd(c.x + oi), yi = _mm512_loadu_pd(c.y + oi), zi = _mm512_loadu_pd(c.z + oi);
+            __m512d ax = _mm512_setzero_pd(), ay = _mm512_setzero_pd(), az = _mm512_setzero_pd();
+            for (int q : active)
+            {
+                if (q == i) continue;
+                const int oq = q*c.stride + s;
+                __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(c.x + oq), xi);
+                __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(c.y + oq), yi);
+                __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(c.z + oq), zi);
+                __m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+                __m512d k = _mm512_div_pd(_mm512_mul_pd(g, _mm512_loadu_pd(c.mass + oq)), _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+                ax = _mm512_add_pd(ax, _mm512_mul_pd(dx, k));
+                ay = _mm512_add_pd(ay, _mm512_mul_pd(dy, k));
+                az = _mm512_add_pd(az, _mm512_mul_pd(dz, k));
+            }
+            _mm512_storeu_pd(c.ax + oi, ax);
+            _mm512_storeu_pd(c.ay + oi, ay);
+            _mm512_storeu_pd(c.az + oi, az);
+        }
+    }
+    EnsembleGravityScalar(c, active, G, s, end);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // SIMD_X86
+
+class Ensemble
+{
+public:
+    int scenarios = 0;// Copies of the scene
+    int bodies = 0;// Bodies in each copy
+    // Every quantity of body b in scenario s is at [b*scenarios + s] (see Index)
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> oldVx, oldVy, oldVz;
+    std::vector<double> mass, radius, elasticity;
+    // BODY_ flags of each body, the same in every scenario
+    std::vector<unsigned char> flags;
+
+    // Bodies each pass works on, as in the Engine
+    std::vector<int> visible, gravitating, colliders, walls;
+
+    unsigned long long steps = 0;// Number of steps taken
+    double time = 0;// Simulated seconds
+    int simd = DetectSimd();// SIMD_SCALAR, SIMD_AVX2 or SIMD_AVX512, lower it to force a slower path
+
+    // Threads the blocks of scenarios are shared over
+    ThreadPool pool;
+
+    Ensemble (int threads = DefaultThreadCount(), bool pin = false): pool(threads, pin) {}
+
+    int Index (int body, int scenario) const
+    {
+        return body*scenarios + scenario;
+    }
+
+    // Fill every one of count scenarios with the bodies in scene
+    // Masses are worked out from massNum and massExp where they've been edited, as the Engine's first step would.
+    void Load (const BodyStore &scene, int count)
+    {
+        scenarios = count;
+        bodies = scene.Size();
+        int n = bodies*scenarios;
+        for (std::vector<double> *column : Columns()) column->assign(n, 0);
+        accX.assign(n, 0);
+        accY.assign(n, 0);
+        accZ.assign(n, 0);
+        forcesCurrent.assign(scenarios, 0);
+        flags = scene.flags;
+
+        for (int b = 0; b < bodies; b++)
+        {
+            double m = scene.changed[b] & CHANGED_MASS ? scene.massNum[b]*pow(10, scene.massExp[b]) : scene.mass[b];
+            for (int s = 0; s < scenarios; s++)
+            {
+                int i = Index(b, s);
+                x[i] = scene.x[b];
+                y[i] = scene.y[b];
+                z[i] = scene.z[b];
+                vx[i] = scene.vx[b];
+                vy[i] = scene.vy[b];
+                vz[i] = scene.vz[b];
+                mass[i] = m;
+                radius[i] = scene.radius[b];
+                elasticity[i] = scene.elasticity[b];
+            }
+        }
+
+        visible.clear();
+        gravitating.clear();
+        colliders.clear();
+        walls.clear();
+        for (int b = 0; b < bodies; b++)
+        {
+            if (flags[b] & BODY_HIDDEN) continue;
+            visible.push_back(b);
+            if (flags[b] & BODY_SPHERE) gravitating.push_back(b);
+            if (!(flags[b] & BODY_COLLISION)) continue;
+            if (flags[b] & BODY_SPHERE) colliders.push_back(b);
+            else walls.push_back(b);
+        }
+        steps = 0;
+        time = 0;
+    }
+
+    // Tell the ensemble a scenario's bodies have been moved by hand, so its forces are out of date
+    void Changed (int scenario)
+    {
+        forcesCurrent[scenario] = 0;
+    }
+
+    // Copy body b of scenario s out
+    Body Get (int s, int b) const
+    {
+        int i = Index(b, s);
+        Body body;
+        body.location = Vec3(x[i], y[i], z[i]);
+        body.velocity = Vec3(vx[i], vy[i], vz[i]);
+        body.radius = radius[i];
+        body.mass = mass[i];
+        body.elasticity = elasticity[i];
+        body.hidden = (flags[b] & BODY_HIDDEN) != 0;
+        body.isSphere = (flags[b] & BODY_SPHERE) != 0;
+        body.collision = (flags[b] & BODY_COLLISION) != 0;
+        return body;
+    }
+
+    // Advance every scenario by dt seconds
+    void Step (double dt)
+    {
+        ParallelFor(&pool, scenarios, [&](int begin, int end)
+        {
+            for (int s = begin; s < end; s += ENSEMBLE_BLOCK) StepBlock(s, std::min(s + ENSEMBLE_BLOCK, end), dt);
+        }, ENSEMBLE_BLOCK);
+        steps++;
+        time += dt;
+    }
+
+    // Name used in reports
+    const char *Name () const
+    {
+        if (simd == SIMD_AVX512) return "ensemble-avx512";
+        if (simd == SIMD_AVX2) return "ensemble-avx2";
+        return "ensemble-scalar";
+    }
+
+private:
+    std::vector<double> accX, accY, accZ;// Gravitational acceleration, indexed like the other columns
+    std::vector<unsigned char> forcesCurrent;// Whether each scenario's acceleration matches its positions
+
+    std::array<std::vector<double> *, 12> Columns ()
+    {
+        return {&x, &y, &z, &vx, &vy, &vz, &oldVx, &oldVy, &oldVz, &mass, &radius, &elasticity};
+    }
+
+    // One leapfrog step of scenarios [begin, end), the same passes as Engine::Step
+    void StepBlock (int begin, int end, double dt)
+    {
+        // Remember velocities
+        for (int b : visible)
+        {
+            for (int i = Index(b, begin); i < Index(b, end); i++)
+            {
+                oldVx[i] = vx[i];
+                oldVy[i] = vy[i];
+                oldVz[i] = vz[i];
+            }
+        }
+
+        // Working out a scenario's forces again when they're current gives the same numbers,
+        // so the whole block is done if any scenario needs it
+        bool current = true;
+        for (int s = begin; s < end; s++) current = current && forcesCurrent[s];
+        if (!current) ComputeForces(begin, end);
+        Kick(begin, end, dt/2);
+        Drift(begin, end, dt);
+        ComputeForces(begin, end);
+        Kick(begin, end, dt/2);
+        Collide(begin, end);
+    }
+
+    void ComputeForces (int begin, int end)
+    {
+        EnsembleColumns c = {x.data(), y.data(), z.data(), mass.data(), accX.data(), accY.data(), accZ.data(), scenarios};
+#if SIMD_X86
+        if (simd == SIMD_AVX512) EnsembleGravityAvx512(c, gravitating, GRAVITATIONAL_CONSTANT, begin, end);
+        else if (simd == SIMD_AVX2) EnsembleGravityAvx2(c, gravitating, GRAVITATIONAL_CONSTANT, begin, end);
+        else
+#endif
+        EnsembleGravityScalar(c, gravitating, GRAVITATIONAL_CONSTANT, begin, end);
+        for (int s = begin; s < end; s++) forcesCurrent[s] = 1;
+    }
+
+    void Kick (int begin, int end, double dt)
+    {
+        for (int b : gravitating)
+        {
+            for (int i = Index(b, begin); i < Index(b, end); i++)
+            {
+                vx[i] += accX[i]*dt;
+                vy[i] += accY[i]*dt;
+                vz[i] += accZ[i]*dt;
+            }
+        }
+    }
+
+    void Drift (int begin, int end, double dt)
+    {
+        for (int b : visible)
+        {
+            for (int i = Index(b, begin); i < Index(b, end); i++)
+            {
+                x[i] += vx[i]*dt;
+                y[i] += vy[i]*dt;
+                z[i] += vz[i]*dt;
+            }
+        }
+    }
+
+    // Walls first, then every sphere off the others in order, as Engine::CollideAs does with CONTACTS_PAIRWISE
+    // Each pair is checked across the whole block before the next, which keeps every
+    // scenario's own order while reading the columns straight through.
+    void Collide (int begin, int end)
+    {
+        for (int a : colliders)
+        {
+            for (int d : walls)
+            {
+                for (int s = begin; s < end; s++)
+                {
+                    // A sphere pushed back off a wall isn't where its acceleration was worked out for
+                    if (CollideWall(s, a, d)) forcesCurrent[s] = 0;
+                }
+            }
+        }
+
+        for (int a : colliders)
+        {
+            for (int b : colliders)
+            {
+                if (b == a) continue;
+                const double *xa = &x[Index(a, 0)], *ya = &y[Index(a, 0)], *za = &z[Index(a, 0)], *ra = &radius[Index(a, 0)];
+                const double *xb = &x[Index(b, 0)], *yb = &y[Index(b, 0)], *zb = &z[Index(b, 0)], *rb = &radius[Index(b, 0)];
+                for (int s = begin; s < end; s++)
+                {
+                    // Most pairs are nowhere near, which squared distances can say without a square root
+                    double dx = xb[s] - xa[s], dy = yb[s] - ya[s], dz = zb[s] - za[s], reach = ra[s] + rb[s];
+                    if (dx*dx + dy*dy + dz*dz > 2*reach*reach) continue;
+                    CollideSphere(s, a, b);
+                }
+            }
+        }
+    }
+
+    // CollideWalls for body a of scenario s against domain d
+    bool CollideWall (int s, int a, int d)
+    {
+        int i = Index(a, s);
+        double r = radius[i];
+        double wall = radius[Index(d, s)];
+        bool collision = false;
+        Vec3 colDir;
+
+        // +x and -x, +y and -y, +z and -z sides of the domain
+        if ((x[i] + r) >= wall) { colDir.x += 1; x[i] = wall - r; collision = true; }
+        if ((x[i] - r) <= -wall) { colDir.x -= 1; x[i] = -wall + r; collision = true; }
+        if ((y[i] + r) >= wall) { colDir.y += 1; y[i] = wall - r; collision = true; }
+        if ((y[i] - r) <= -wall) { colDir.y -= 1; y[i] = -wall + r; collision = true; }
+        if ((z[i] + r) >= wall) { colDir.z += 1; z[i] = wall - r; collision = true; }
+        if ((z[i] - r) <= -wall) { colDir.z -= 1; z[i] = -wall + r; collision = true; }
+
+        if (!collision) return false;
+
+        colDir = Normalize(colDir);
+        Vec3 velocity(vx[i], vy[i], vz[i]);
+        Vec3 via = colDir*Dot(velocity, colDir);
+        Vec3 viNA = velocity - via;
+        Vec3 vfa = -via*elasticity[i] + Reflect(viNA, colDir);
+        vx[i] = vfa.x;
+        vy[i] = vfa.y;
+        vz[i] = vfa.z;
+        return true;
+    }
+
+    // CollideSpheres for sphere a of scenario s against sphere b
+    void CollideSphere (int s, int a, int b)
+    {
+        int i = Index(a, s), j = Index(b, s);
+        Vec3 locA(x[i], y[i], z[i]);
+        Vec3 locB(x[j], y[j], z[j]);
+        if (Distance(locA, locB) > (radius[i] + radius[j])) return;
+
+        Vec3 colDir = Normalize(locB - locA);
+        double el = (elasticity[i] + elasticity[j])/2;
+        Vec3 vfa = Bounce(Vec3(vx[i], vy[i], vz[i]), Vec3(oldVx[j], oldVy[j], oldVz[j]), colDir, mass[i], mass[j], el);
+        vx[i] = vfa.x;
+        vy[i] = vfa.y;
+        vz[i] = vfa.z;
+    }
+};
+
+#endif // ENSEMBLE_H_INCLUDED
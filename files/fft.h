@@ -0,0 +1,85 @@
+#ifndef FFT_H_INCLUDED
+#define FFT_H_INCLUDED
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include "parallel.h"
+
+// A small radix-2 fast Fourier transform, so the particle-mesh solver doesn't need an
+// outside library. Sizes must be powers of two.
+
+#define FFT_PI 3.14159265358979323846
+
+typedef std::complex<double> FFTComplex;
+
+inline bool IsPowerOfTwo (int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+// In place transform of n contiguous values. inverse does not divide by n.
+inline void FFT (FFTComplex *data, int n, bool inverse)
+{
+    // Bit reversal permutation
+    for (int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(data[i], data[j]);
+    }
+
+    // Butterflies
+    for (int len = 2; len <= n; len <<= 1)
+    {
+        double angle = 2*FFT_PI/len*(inverse ? 1 : -1);
+        FFTComplex step(cos(angle), sin(angle));
+        for (int i = 0; i < n; i += len)
+        {
+            FFTComplex w(1, 0);
+            for (int k = 0; k < len/2; k++)
+            {
+                FFTComplex u = data[i + k];
+                FFTComplex v = data[i + k + len/2]*w;
+                data[i + k] = u + v;
+                data[i + k + len/2] = u - v;
+                w *= step;
+            }
+        }
+    }
+}
+
+// In place transform of an n*n*n grid stored x fastest: index = (z*n + y)*n + x
+// Each line along an axis is copied out, transformed and copied back, split across threads.
+// lines is where every worker keeps the line it is working on. It is grown the first time
+// and kept by the caller, so transforms after that don't allocate.
+inline void FFT3D (std::vector<FFTComplex> &grid, int n, bool inverse, ThreadPool *pool, std::vector<FFTComplex> &lines)
+{
+    size_t workers = pool == NULL ? 1 : pool->Size();
+    if (lines.size() < workers*n) lines.resize(workers*n);
+    int count = n*n;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int stride = axis == 0 ? 1 : (axis == 1 ? n : n*n);
+        ParallelFor(pool, count, [&](int begin, int end)
+        {
+            FFTComplex *line = &lines[size_t(CurrentWorker(pool))*n];
+            for (int l = begin; l < end; l++)
+            {
+                // First element of line l along this axis
+                int a = l % n, b = l / n;
+                int first;
+                if (axis == 0) first = (b*n + a)*n;
+                else if (axis == 1) first = b*n*n + a;
+                else first = b*n + a;
+
+                for (int k = 0; k < n; k++) line[k] = grid[first + k*stride];
+                FFT(line, n, inverse);
+                for (int k = 0; k < n; k++) grid[first + k*stride] = line[k];
+            }
+        });
+    }
+}
+
+#endif // FFT_H_INCLUDED
@@ -0,0 +1,564 @@
+#ifndef FMM_H_INCLUDED
+#define FMM_H_INCLUDED
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+#include "gravity.h"
+#include "parallel.h"
+
+// Fast multipole method gravity
+// Like Barnes-Hut the bodies are put in an octree, but every cell gets a multipole
+// expansion of the bodies inside it AND a local expansion of the field from far away
+// cells. Well separated pairs of cells interact once, cell to cell (M2L), instead of
+// every body in one interacting with the other cell. That makes the whole thing O(N).
+//
+// The expansions are in solid spherical harmonics. order is the number of terms kept
+// (degrees 0 to order - 1): raising it makes the answer more accurate and every cell
+// interaction more expensive (roughly order^4). theta decides when two cells are far
+// enough apart to interact through their expansions.
+//
+// The harmonics and translation operators follow the ones used by exafmm (Yokota et al.).
+
+#define FMM_MAX_ORDER 20
+
+class FastMultipoleGravity : public GravitySolver
+{
+public:
+    int order = 6;// Number of expansion terms, 1 to FMM_MAX_ORDER
+    double theta = 0.5;// Cells interact through expansions when (Ri + Rj) < theta*distance
+    int leafSize = 32;// Most bodies in a leaf before it is split
+
+    FastMultipoleGravity (int order = 6, double theta = 0.5): order(std::max(1, std::min(order, FMM_MAX_ORDER))), theta(theta) {}
+
+    const char *Name () const { return "fmm"; }
+
+    void ComputeAccelerations (const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc)
+    {
+        if (active.empty()) return;
+        terms = order*(order + 1)/2;
+
+        Build(s, active);
+        Upward(s);
+        FindInteractions();
+        Downward();
+        Evaluate(s, G, acc);
+    }
+
+private:
+    typedef std::complex<double> Complex;
+
+    struct Cell
+    {
+        double x, y, z;// Expansion centre (the middle of the cell)
+        double half;// Half width of the cell
+        double radius;// Distance from the centre to the furthest body in the cell
+        int start, end;// Range of order[] holding the cell's bodies
+        int firstChild, childCount;
+    };
+
+    int terms = 0;// Number of coefficients stored per expansion
+    std::vector<Cell> cells;
+    std::vector<std::vector<int>> levels;// Cells at each depth of the tree
+    std::vector<int> bodyOrder;// Body indices sorted so every cell owns a contiguous range
+    std::vector<int> scratch;
+    std::vector<Complex> multipole;// terms coefficients per cell
+    std::vector<Complex> local;// terms coefficients per cell
+    std::vector<double> gx, gy, gz;// Gradient of sum(m/r) at each body, in bodyOrder
+
+    // Interaction lists, sorted by target cell so each target can be handled by one thread
+    std::vector<std::pair<int, int>> m2l, p2p;
+    std::vector<int> m2lStart, p2pStart;
+
+    static const int MAX_DEPTH = 40;
+
+    //==========================================================================================
+    // Tree
+    //==========================================================================================
+    void Build (const BodyStore &s, const std::vector<int> &active)
+    {
+        bodyOrder.assign(active.begin(), active.end());
+        scratch.resize(bodyOrder.size());
+
+        double minX = s.x[active[0]], maxX = minX, minY = s.y[active[0]], maxY = minY, minZ = s.z[active[0]], maxZ = minZ;
+        for (int i : active)
+        {
+            minX = std::min(minX, s.x[i]); maxX = std::max(maxX, s.x[i]);
+            minY = std::min(minY, s.y[i]); maxY = std::max(maxY, s.y[i]);
+            minZ = std::min(minZ, s.z[i]); maxZ = std::max(maxZ, s.z[i]);
+        }
+        double half = std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ))/2*1.0001;
+        if (half <= 0) half = 1;
+
+        cells.clear();
+        for (std::vector<int> &level : levels) level.clear();
+        cells.push_back(Cell{(minX + maxX)/2, (minY + maxY)/2, (minZ + maxZ)/2, half, 0, 0, int(bodyOrder.size()), 0, 0});
+        Split(s, 0, 0);
+
+        // Radius of every cell, children first (children are always stored after their parent)
+        for (int c = int(cells.size()) - 1; c >= 0; c--)
+        {
+            Cell &cell = cells[c];
+            double r2 = 0;
+            for (int k = cell.start; k < cell.end; k++)
+            {
+                int i = bodyOrder[k];
+                double dx = s.x[i] - cell.x, dy = s.y[i] - cell.y, dz = s.z[i] - cell.z;
+                r2 = std::max(r2, dx*dx + dy*dy + dz*dz);
+            }
+            cell.radius = sqrt(r2);
+        }
+
+        multipole.assign(cells.size()*terms, Complex(0, 0));
+        local.assign(cells.size()*terms, Complex(0, 0));
+    }
+
+    void Split (const BodyStore &s, int c, int depth)
+    {
+        if (int(levels.size()) <= depth) levels.resize(depth + 1);
+        levels[depth].push_back(c);
+
+        int start = cells[c].start, end = cells[c].end;
+        if (end - start <= leafSize || depth >= MAX_DEPTH) return;
+
+        double cx = cells[c].x, cy = cells[c].y, cz = cells[c].z;
+        double half = cells[c].half/2;
+        auto octant = [&](int i) { return (s.x[i] >= cx ? 1 : 0) | (s.y[i] >= cy ? 2 : 0) | (s.z[i] >= cz ? 4 : 0); };
+
+        int counts[8] = {0};
+        for (int k = start; k < end; k++) counts[octant(bodyOrder[k])]++;
+        int offsets[8], next[8];
+        for (int o = 0, running = start; o < 8; o++)
+        {
+            offsets[o] = next[o] = running;
+            running += counts[o];
+        }
+        for (int k = start; k < end; k++) scratch[next[octant(bodyOrder[k])]++] = bodyOrder[k];
+        std::copy(scratch.begin() + start, scratch.begin() + end, bodyOrder.begin() + start);
+
+        int firstChild = int(cells.size());
+        int childCount = 0;
+        for (int o = 0; o < 8; o++)
+        {
+            if (counts[o] == 0) continue;
+            cells.push_back(Cell{cx + ((o & 1) ? half : -half), cy + ((o & 2) ? half : -half), cz + ((o & 4) ? half : -half),
+                                 half, 0, offsets[o], offsets[o] + counts[o], 0, 0});
+            childCount++;
+        }
+        cells[c].firstChild = firstChild;
+        cells[c].childCount = childCount;
+        for (int k = 0; k < childCount; k++) Split(s, firstChild + k, depth + 1);
+    }
+
+    //==========================================================================================
+    // Passes
+    //==========================================================================================
+
+    // Multipoles of the leaves from their bodies, then of every other cell from its children
+    void Upward (const BodyStore &s)
+    {
+        for (int d = int(levels.size()) - 1; d >= 0; d--)
+        {
+            const std::vector<int> &level = levels[d];
+            ParallelFor(pool, int(level.size()), [&](int begin, int end)
+            {
+                for (int k = begin; k < end; k++)
+                {
+                    int c = level[k];
+                    if (cells[c].childCount == 0) P2M(s, c);
+                    else M2M(c);
+                }
+            });
+        }
+    }
+
+    // Walk pairs of cells and sort them into cell-cell (M2L) and body-body (P2P) interactions
+    void FindInteractions ()
+    {
+        m2l.clear();
+        p2p.clear();
+        Interact(0, 0);
+        std::sort(m2l.begin(), m2l.end());
+        std::sort(p2p.begin(), p2p.end());
+        Offsets(m2l, m2lStart);
+        Offsets(p2p, p2pStart);
+    }
+
+    void Interact (int i, int j)
+    {
+        const Cell &ci = cells[i];
+        const Cell &cj = cells[j];
+        double dx = ci.x - cj.x, dy = ci.y - cj.y, dz = ci.z - cj.z;
+        double r = sqrt(dx*dx + dy*dy + dz*dz);
+
+        if (i != j && ci.radius + cj.radius < theta*r)
+        {
+            m2l.push_back(std::make_pair(i, j));
+        }
+        else if (ci.childCount == 0 && cj.childCount == 0)
+        {
+            p2p.push_back(std::make_pair(i, j));
+        }
+        else if (cj.childCount == 0 || (ci.childCount != 0 && ci.radius >= cj.radius))
+        {
+            for (int c = ci.firstChild; c < ci.firstChild + ci.childCount; c++) Interact(c, j);
+        }
+        else
+        {
+            for (int c = cj.firstChild; c < cj.firstChild + cj.childCount; c++) Interact(i, c);
+        }
+    }
+
+    // start[c] to start[c + 1] is the range of list with target cell c
+    void Offsets (const std::vector<std::pair<int, int>> &list, std::vector<int> &start)
+    {
+        start.assign(cells.size() + 1, 0);
+        for (const std::pair<int, int> &p : list) start[p.first + 1]++;
+        for (size_t c = 0; c < cells.size(); c++) start[c + 1] += start[c];
+    }
+
+    // Far field into every cell's local expansion, then pushed down to the leaves
+    void Downward ()
+    {
+        ParallelFor(pool, int(cells.size()), [&](int begin, int end)
+        {
+            for (int c = begin; c < end; c++)
+            {
+                for (int k = m2lStart[c]; k < m2lStart[c + 1]; k++) M2L(c, m2l[k].second);
+            }
+        });
+
+        for (size_t d = 0; d < levels.size(); d++)
+        {
+            const std::vector<int> &level = levels[d];
+            ParallelFor(pool, int(level.size()), [&](int begin, int end)
+            {
+                for (int k = begin; k < end; k++) L2L(level[k]);
+            });
+        }
+    }
+
+    // Local expansions and nearby bodies into accelerations
+    void Evaluate (const BodyStore &s, double G, Accelerations &acc)
+    {
+        gx.assign(bodyOrder.size(), 0);
+        gy.assign(bodyOrder.size(), 0);
+        gz.assign(bodyOrder.size(), 0);
+
+        ParallelFor(pool, int(cells.size()), [&](int begin, int end)
+        {
+            for (int c = begin; c < end; c++)
+            {
+                if (cells[c].childCount != 0) continue;
+                L2P(s, c);
+                for (int k = p2pStart[c]; k < p2pStart[c + 1]; k++) P2P(s, c, p2p[k].second);
+            }
+        });
+
+        for (size_t k = 0; k < bodyOrder.size(); k++)
+        {
+            int i = bodyOrder[k];
+            acc.x[i] = G*gx[k];
+            acc.y[i] = G*gy[k];
+            acc.z[i] = G*gz[k];
+        }
+    }
+
+    //==========================================================================================
+    // Kernels
+    //==========================================================================================
+    static int OddOrEven (int n) { return (n & 1) ? -1 : 1; }
+    static int Ipow2n (int n) { return n >= 0 ? 1 : OddOrEven(n); }
+
+    static void ToSpherical (double dx, double dy, double dz, double &r, double &theta, double &phi)
+    {
+        r = sqrt(dx*dx + dy*dy + dz*dz);
+        theta = r == 0 ? 0 : acos(std::max(-1.0, std::min(1.0, dz/r)));
+        phi = atan2(dy, dx);
+    }
+
+    // Regular solid harmonics r^n Y_n^m (and their theta derivatives)
+    void EvalMultipole (double rho, double alpha, double beta, Complex *ynm, Complex *ynmTheta) const
+    {
+        int p = order;
+        double x = cos(alpha);
+        double y = sin(alpha);
+        double invY = y == 0 ? 0 : 1/y;
+        double fact = 1;
+        double pn = 1;
+        double rhom = 1;
+        Complex ei = std::exp(Complex(0, beta));
+        Complex eim = 1.0;
+        for (int m = 0; m < p; m++)
+        {
+            double pm = pn;
+            int npn = m*m + 2*m;
+            int nmn = m*m;
+            ynm[npn] = rhom*pm*eim;
+            ynm[nmn] = std::conj(ynm[npn]);
+            double p1 = pm;
+            pm = x*(2*m + 1)*p1;
+            ynmTheta[npn] = rhom*(pm - (m + 1)*x*p1)*invY*eim;
+            rhom *= rho;
+            double rhon = rhom;
+            for (int n = m + 1; n < p; n++)
+            {
+                int npm = n*n + n + m;
+                int nmm = n*n + n - m;
+                rhon /= -(n + m);
+                ynm[npm] = rhon*pm*eim;
+                ynm[nmm] = std::conj(ynm[npm]);
+                double p2 = p1;
+                p1 = pm;
+                pm = (x*(2*n + 1)*p1 - (n + m)*p2)/(n - m + 1);
+                ynmTheta[npm] = rhon*((n - m + 1)*pm - (n + 1)*x*p1)*invY*eim;
+                rhon *= rho;
+            }
+            rhom /= -(2*m + 2)*(2*m + 1);
+            pn = -pn*fact*y;
+            fact += 2;
+            eim *= ei;
+        }
+    }
+
+    // Irregular solid harmonics r^(-n-1) Y_n^m
+    void EvalLocal (double rho, double alpha, double beta, Complex *ynm) const
+    {
+        int p = order;
+        double x = cos(alpha);
+        double y = sin(alpha);
+        double fact = 1;
+        double pn = 1;
+        double invR = -1.0/rho;
+        double rhom = -invR;
+        Complex ei = std::exp(Complex(0, beta));
+        Complex eim = 1.0;
+        for (int m = 0; m < p; m++)
+        {
+            double pm = pn;
+            int npn = m*m + 2*m;
+            int nmn = m*m;
+            ynm[npn] = rhom*pm*eim;
+            ynm[nmn] = std::conj(ynm[npn]);
+            double p1 = pm;
+            pm = x*(2*m + 1)*p1;
+            rhom *= invR;
+            double rhon = rhom;
+            for (int n = m + 1; n < p; n++)
+            {
+                int npm = n*n + n + m;
+                int nmm = n*n + n - m;
+                ynm[npm] = rhon*pm*eim;
+                ynm[nmm] = std::conj(ynm[npm]);
+                double p2 = p1;
+                p1 = pm;
+                pm = (x*(2*n + 1)*p1 - (n + m)*p2)/(n - m + 1);
+                rhon *= invR*(n - m + 1);
+            }
+            pn = -pn*fact*y;
+            fact += 2;
+            eim *= ei;
+        }
+    }
+
+    void P2M (const BodyStore &s, int c)
+    {
+        Complex ynm[FMM_MAX_ORDER*FMM_MAX_ORDER], ynmTheta[FMM_MAX_ORDER*FMM_MAX_ORDER];
+        const Cell &cell = cells[c];
+        Complex *m = &multipole[c*terms];
+        for (int k = cell.start; k < cell.end; k++)
+        {
+            int i = bodyOrder[k];
+            double rho, alpha, beta;
+            ToSpherical(s.x[i] - cell.x, s.y[i] - cell.y, s.z[i] - cell.z, rho, alpha, beta);
+            EvalMultipole(rho, alpha, beta, ynm, ynmTheta);
+            for (int n = 0; n < order; n++)
+            {
+                for (int mm = 0; mm <= n; mm++)
+                {
+                    m[n*(n + 1)/2 + mm] += s.mass[i]*ynm[n*n + n - mm];
+                }
+            }
+        }
+    }
+
+    void M2M (int c)
+    {
+        Complex ynm[FMM_MAX_ORDER*FMM_MAX_ORDER], ynmTheta[FMM_MAX_ORDER*FMM_MAX_ORDER];
+        const Cell &parent = cells[c];
+        Complex *mi = &multipole[c*terms];
+        for (int child = parent.firstChild; child < parent.firstChild + parent.childCount; child++)
+        {
+            const Cell &cj = cells[child];
+            const Complex *mj = &multipole[child*terms];
+            double rho, alpha, beta;
+            ToSpherical(parent.x - cj.x, parent.y - cj.y, parent.z - cj.z, rho, alpha, beta);
+            EvalMultipole(rho, alpha, beta, ynm, ynmTheta);
+            for (int j = 0; j < order; j++)
+            {
+                for (int k = 0; k <= j; k++)
+                {
+                    Complex sum = 0;
+                    for (int n = 0; n <= j; n++)
+                    {
+                        for (int m = std::max(-n, -j + k + n); m <= std::min(k - 1, n); m++)
+                        {
+                            int jnkms = (j - n)*(j - n + 1)/2 + k - m;
+                            sum += mj[jnkms]*ynm[n*n + n - m]*double(Ipow2n(m)*OddOrEven(n));
+                        }
+                        for (int m = k; m <= std::min(n, j + k - n); m++)
+                        {
+                            int jnkms = (j - n)*(j - n + 1)/2 - k + m;
+                            sum += std::conj(mj[jnkms])*ynm[n*n + n - m]*double(OddOrEven(k + n + m));
+                        }
+                    }
+                    mi[j*(j + 1)/2 + k] += sum;
+                }
+            }
+        }
+    }
+
+    void M2L (int i, int j)
+    {
+        Complex ynm[FMM_MAX_ORDER*FMM_MAX_ORDER];
+        const Cell &ci = cells[i];
+        const Cell &cj = cells[j];
+        Complex *li = &local[i*terms];
+        const Complex *mj = &multipole[j*terms];
+        double rho, alpha, beta;
+        ToSpherical(ci.x - cj.x, ci.y - cj.y, ci.z - cj.z, rho, alpha, beta);
+        EvalLocal(rho, alpha, beta, ynm);
+        for (int jj = 0; jj < order; jj++)
+        {
+            double cnm = OddOrEven(jj);
+            for (int k = 0; k <= jj; k++)
+            {
+                Complex sum = 0;
+                for (int n = 0; n < order - jj; n++)
+                {
+                    for (int m = -n; m < 0; m++)
+                    {
+                        int jnkm = (jj + n)*(jj + n) + jj + n + m - k;
+                        sum += std::conj(mj[n*(n + 1)/2 - m])*cnm*ynm[jnkm];
+                    }
+                    for (int m = 0; m <= n; m++)
+                    {
+                        int jnkm = (jj + n)*(jj + n) + jj + n + m - k;
+                        double cnm2 = cnm*OddOrEven((k - m)*(k < m) + m);
+                        sum += mj[n*(n + 1)/2 + m]*cnm2*ynm[jnkm];
+                    }
+                }
+                li[jj*(jj + 1)/2 + k] += sum;
+            }
+        }
+    }
+
+    void L2L (int c)
+    {
+        Complex ynm[FMM_MAX_ORDER*FMM_MAX_ORDER], ynmTheta[FMM_MAX_ORDER*FMM_MAX_ORDER];
+        const Cell &parent = cells[c];
+        const Complex *lj = &local[c*terms];
+        for (int child = parent.firstChild; child < parent.firstChild + parent.childCount; child++)
+        {
+            const Cell &ci = cells[child];
+            Complex *li = &local[child*terms];
+            double rho, alpha, beta;
+            ToSpherical(ci.x - parent.x, ci.y - parent.y, ci.z - parent.z, rho, alpha, beta);
+            EvalMultipole(rho, alpha, beta, ynm, ynmTheta);
+            for (int j = 0; j < order; j++)
+            {
+                for (int k = 0; k <= j; k++)
+                {
+                    Complex sum = 0;
+                    for (int n = j; n < order; n++)
+                    {
+                        for (int m = j + k - n; m < 0; m++)
+                        {
+                            int jnkm = (n - j)*(n - j) + n - j + m - k;
+                            sum += std::conj(lj[n*(n + 1)/2 - m])*ynm[jnkm]*double(OddOrEven(k));
+                        }
+                        for (int m = 0; m <= n; m++)
+                        {
+                            if (n - j >= abs(m - k))
+                            {
+                                int jnkm = (n - j)*(n - j) + n - j + m - k;
+                                sum += lj[n*(n + 1)/2 + m]*ynm[jnkm]*double(OddOrEven((m - k)*(m < k)));
+                            }
+                        }
+                    }
+                    li[j*(j + 1)/2 + k] += sum;
+                }
+            }
+        }
+    }
+
+    void L2P (const BodyStore &s, int c)
+    {
+        Complex ynm[FMM_MAX_ORDER*FMM_MAX_ORDER], ynmTheta[FMM_MAX_ORDER*FMM_MAX_ORDER];
+        const Cell &cell = cells[c];
+        const Complex *l = &local[c*terms];
+        const Complex I(0, 1);
+        for (int k = cell.start; k < cell.end; k++)
+        {
+            int i = bodyOrder[k];
+            double dx = s.x[i] - cell.x, dy = s.y[i] - cell.y, dz = s.z[i] - cell.z;
+            // The spherical gradient can't be evaluated on the z axis, so nudge bodies off it.
+            // The field is smooth there, so the error is as small as the nudge.
+            double d2 = dx*dx + dy*dy + dz*dz;
+            if (dx*dx + dy*dy <= 1e-18*d2 || d2 == 0) dx += 1e-9*std::max(sqrt(d2), cell.half);
+            double r, theta, phi;
+            ToSpherical(dx, dy, dz, r, theta, phi);
+            EvalMultipole(r, theta, phi, ynm, ynmTheta);
+            double sr = 0, st = 0, sp = 0;
+            for (int n = 0; n < order; n++)
+            {
+                int nm = n*n + n;
+                int nms = n*(n + 1)/2;
+                sr += std::real(l[nms]*ynm[nm])/r*n;
+                st += std::real(l[nms]*ynmTheta[nm]);
+                for (int m = 1; m <= n; m++)
+                {
+                    nm = n*n + n + m;
+                    nms = n*(n + 1)/2 + m;
+                    sr += 2*std::real(l[nms]*ynm[nm])/r*n;
+                    st += 2*std::real(l[nms]*ynmTheta[nm]);
+                    sp += 2*std::real(l[nms]*ynm[nm]*I)*m;
+                }
+            }
+            // Spherical gradient to cartesian
+            double sinT = sin(theta), cosT = cos(theta), sinP = sin(phi), cosP = cos(phi);
+            gx[k] += sinT*cosP*sr + cosT*cosP/r*st - sinP/r/sinT*sp;
+            gy[k] += sinT*sinP*sr + cosT*sinP/r*st + cosP/r/sinT*sp;
+            gz[k] += cosT*sr - sinT/r*st;
+        }
+    }
+
+    void P2P (const BodyStore &s, int i, int j)
+    {
+        const Cell &ci = cells[i];
+        const Cell &cj = cells[j];
+        for (int a = ci.start; a < ci.end; a++)
+        {
+            int bi = bodyOrder[a];
+            double px = s.x[bi], py = s.y[bi], pz = s.z[bi];
+            double ax = 0, ay = 0, az = 0;
+            for (int b = cj.start; b < cj.end; b++)
+            {
+                int bj = bodyOrder[b];
+                if (bj == bi) continue;
+                double dx = s.x[bj] - px, dy = s.y[bj] - py, dz = s.z[bj] - pz;
+                double r2 = dx*dx + dy*dy + dz*dz;
+                double k = s.mass[bj]/(r2*sqrt(r2));
+                ax += dx*k;
+                ay += dy*k;
+                az += dz*k;
+            }
+            gx[a] += ax;
+            gy[a] += ay;
+            gz[a] += az;
+        }
+    }
+};
+
+#endif // FMM_H_INCLUDED
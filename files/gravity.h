@@ -0,0 +1,161 @@
+#ifndef GRAVITY_H_INCLUDED
+#define GRAVITY_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include "bodies.h"
+#include "parallel.h"
+
+// Acceleration of every body, indexed the same way as the BodyStore
+struct Accelerations
+{
+    std::vector<double> x, y, z;
+
+    void Resize (int n)
+    {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+};
+
+// Something that can work out the gravitational acceleration on every body
+// active holds the indices of the bodies that attract each other (visible spheres).
+// Only acc[active[i]] has to be written.
+class GravitySolver
+{
+public:
+    // Threads to split the work over, set by the engine that owns the solver (NULL runs on the caller)
+    ThreadPool *pool = NULL;
+
+    virtual ~GravitySolver () {}
+
+    virtual void ComputeAccelerations (const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc) = 0;
+
+    // Acceleration on only the targets, pulled by every one of the active bodies
+    // Used when only some bodies are due a new force. Solvers that can't do less than
+    // everything work out every active body, which is still correct.
+    virtual void ComputeAccelerationsOn (const BodyStore &s, const std::vector<int> &active, const std::vector<int> &targets,
+                                         double G, Accelerations &acc)
+    {
+        (void)targets;
+        ComputeAccelerations(s, active, G, acc);
+    }
+
+    // Called when bodies have been edited, added or removed so any cached structure can't be trusted
+    virtual void Invalidate () {}
+
+    // Called before every evaluation with how many metres the positions it is given count as one of
+    // Solvers set up with a length in metres divide it by this, so it means the same in any units.
+    virtual void SetLengthUnit (double metres) { (void)metres; }
+
+    // Name used in reports
+    virtual const char *Name () const = 0;
+};
+
+// Exact acceleration on body i from every active body
+inline Vec3 DirectAcceleration (const BodyStore &s, const std::vector<int> &active, double G, int i)
+{
+    double ax = 0, ay = 0, az = 0;
+    double xi = s.x[i], yi = s.y[i], zi = s.z[i];
+    for (int q : active)
+    {
+        if (q == i) continue;
+        double dx = s.x[q] - xi;
+        double dy = s.y[q] - yi;
+        double dz = s.z[q] - zi;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        double k = G*s.mass[q]/(r2*sqrt(r2));
+        ax += dx*k;
+        ay += dy*k;
+        az += dz*k;
+    }
+    return Vec3(ax, ay, az);
+}
+
+// The original O(N^2) loop: every body pulls on every other body
+class DirectGravity : public GravitySolver
+{
+public:
+    void ComputeAccelerations (const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc)
+    {
+        for (int i : active)
+        {
+            Vec3 a = DirectAcceleration(s, active, G, i);
+            acc.x[i] = a.x;
+            acc.y[i] = a.y;
+            acc.z[i] = a.z;
+        }
+    }
+
+    void ComputeAccelerationsOn (const BodyStore &s, const std::vector<int> &active, const std::vector<int> &targets,
+                                 double G, Accelerations &acc)
+    {
+        ParallelFor(pool, int(targets.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = targets[k];
+                Vec3 a = DirectAcceleration(s, active, G, i);
+                acc.x[i] = a.x;
+                acc.y[i] = a.y;
+                acc.z[i] = a.z;
+            }
+        }, 16);
+    }
+
+    const char *Name () const { return "direct"; }
+};
+
+// Kinetic plus gravitational potential energy of the active bodies
+// A well behaved integrator keeps this nearly constant when nothing collides.
+inline double TotalEnergy (const BodyStore &s, const std::vector<int> &active, double G)
+{
+    double kinetic = 0, potential = 0;
+    for (size_t a = 0; a < active.size(); a++)
+    {
+        int i = active[a];
+        kinetic += 0.5*s.mass[i]*(s.vx[i]*s.vx[i] + s.vy[i]*s.vy[i] + s.vz[i]*s.vz[i]);
+        for (size_t b = a + 1; b < active.size(); b++)
+        {
+            int q = active[b];
+            double dx = s.x[q] - s.x[i], dy = s.y[q] - s.y[i], dz = s.z[q] - s.z[i];
+            potential -= G*s.mass[i]*s.mass[q]/sqrt(dx*dx + dy*dy + dz*dz);
+        }
+    }
+    return kinetic + potential;
+}
+
+// How far a solver is from the exact answer
+struct GravityError
+{
+    double rms = 0;// Root mean square of the relative error
+    double max = 0;// Largest relative error
+    int samples = 0;// Number of bodies checked
+};
+
+// Compare acc against direct summation for up to maxSamples of the active bodies
+// Picking a spread of bodies keeps this affordable when there are millions of them.
+inline GravityError CompareWithDirect (const BodyStore &s, const std::vector<int> &active, double G, const Accelerations &acc, int maxSamples)
+{
+    GravityError error;
+    int n = int(active.size());
+    if (n == 0) return error;
+    int stride = n > maxSamples ? n/maxSamples : 1;
+    double sum = 0;
+    for (int k = 0; k < n; k += stride)
+    {
+        int i = active[k];
+        Vec3 exact = DirectAcceleration(s, active, G, i);
+        double size = Length(exact);
+        if (size == 0) continue;
+        double e = Length(Vec3(acc.x[i], acc.y[i], acc.z[i]) - exact)/size;
+        sum += e*e;
+        if (e > error.max) error.max = e;
+        error.samples++;
+    }
+    if (error.samples > 0) error.rms = sqrt(sum/error.samples);
+    return error;
+}
+
+#endif // GRAVITY_H_INCLUDED
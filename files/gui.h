@@ -3,12 +3,17 @@
 
 #include <iostream>
 #include <string>
-#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
 
 #define BOX_START_X 197
 #define BOX_START_Y 434
 #define BOX_WIDTH 133.3
 #define BOX_HEIGHT 33
+#define GUI_COLUMNS 6// Number of spheres that fit in the table
+#define GUI_ROWS 11// Hidden, x, y and z location, x, y and z velocity, mass coefficient, mass exponent, radius and elasticity
+#define FIRST_SPHERE 2// Index of the body shown in the first column of the table
 
 using namespace std;
 
@@ -38,11 +43,11 @@ map <GLchar, Character> Characters;
 // Check the location of the click for the domains of the boxes
 class GUI_C
 {
-    // Write each relevant character to the input file
-    ifstream fin;                               // Create input file
-    ofstream fout;                              // Output to file
-
 public:
+// The text in every cell of the table, filled from the snapshot each frame and drawn straight from here
+    string table[GUI_ROWS][GUI_COLUMNS];
+// Number of columns with a sphere in them
+    int tableColumns = 0;
 // Text vertex array object and vertex buffer object
     GLuint VAO, VBO;
 // Variable to keep track of if user has navigated to a new box
@@ -81,7 +86,7 @@ public:
             clickDown = true;
 
             // Loop through the columns to find which ball was specified
-            for (int column = 0; column < 6; column++)
+            for (int column = 0; column < GUI_COLUMNS; column++)
             {
                 // Check x boundaries
                 if ( (mouseX > (column * BOX_WIDTH + BOX_START_X) ) && (mouseX < (column * BOX_WIDTH + BOX_START_X + BOX_WIDTH) ) )
@@ -99,8 +104,8 @@ public:
                             hit = true;
                             // Update active rows and columns
                             activeRow = row;
-                            // Column + 2 because the index of spheres starts at [2] in the object array
-                            activeColumn = column + 2;
+                            // The index of spheres starts at [FIRST_SPHERE] in the body store
+                            activeColumn = column + FIRST_SPHERE;
                         }
                     }
                 }
@@ -114,7 +119,9 @@ public:
         }
     }
 
-    Object inputValue (Object sphere, SDL_Event event)
+    // Send the simulation thread an edit to the sphere, it is made between steps
+    // shown is the snapshot on screen, which the hidden button toggles from.
+    void inputValue (int sphere, const BodyStore &shown, SimThread &sim, const SDL_Event &event)
     {
         // Stop the users input from carrying over across text boxes
         if (newHit)
@@ -136,7 +143,7 @@ public:
             {
                 newKey = false;
                 inputReady = true;
-                input = writeToFile(inString);
+                input = parseInput(inString);
                 inString = "";
             }
 
@@ -156,8 +163,7 @@ public:
             if ((activeRow == 0)&&(!clickDown))
             {
                 // Swith the sphere's hidden value
-                if (sphere.hidden) sphere.hidden = false;
-                else sphere.hidden = true;
+                sim.Send(Command{sphere, COMMAND_HIDDEN, shown.Hidden(sphere) ? 0.0 : 1.0});
                 // Reset hit to zero
                 hit = false;
             }
@@ -174,7 +180,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.location.x = input;
+                    sim.Send(Command{sphere, COMMAND_X, input});
                     hit = false;
                 }
             }
@@ -191,7 +197,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.location.y = input;
+                    sim.Send(Command{sphere, COMMAND_Y, input});
                     hit = false;
                 }
             }
@@ -208,7 +214,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.location.z = input;
+                    sim.Send(Command{sphere, COMMAND_Z, input});
                     hit = false;
                 }
             }
@@ -225,7 +231,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.velocity.x = input;
+                    sim.Send(Command{sphere, COMMAND_VX, input});
                     hit = false;
                 }
             }
@@ -242,7 +248,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.velocity.y = input;
+                    sim.Send(Command{sphere, COMMAND_VY, input});
                     hit = false;
                 }
             }
@@ -259,7 +265,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.velocity.z = input;
+                    sim.Send(Command{sphere, COMMAND_VZ, input});
                     hit = false;
                 }
             }
@@ -276,7 +282,7 @@ public:
                 if (inputReady && input > 0)
                 {
                     inputReady = false;
-                    sphere.massNum = input;
+                    sim.Send(Command{sphere, COMMAND_MASS_NUM, input});
                     hit = false;
                 }
             }
@@ -293,7 +299,7 @@ public:
                 if (inputReady)
                 {
                     inputReady = false;
-                    sphere.massExp = input;
+                    sim.Send(Command{sphere, COMMAND_MASS_EXP, input});
                     hit = false;
                 }
             }
@@ -310,9 +316,7 @@ public:
                 if (inputReady && input > 0)
                 {
                     inputReady = false;
-                    sphere.scale.x = input;
-                    sphere.scale.y = input;
-                    sphere.scale.z = input;
+                    sim.Send(Command{sphere, COMMAND_RADIUS, input});
                     hit = false;
                 }
             }
@@ -329,7 +333,7 @@ public:
                 if (inputReady && input >= 0 && input <= 100)
                 {
                     inputReady = false;
-                    sphere.elasticity = input/100.0;
+                    sim.Send(Command{sphere, COMMAND_ELASTICITY, input/100.0});
                     hit = false;
                 }
             }
@@ -342,79 +346,52 @@ public:
                 //cout << inString <<endl;
             }
         }
-        // Retrun the sphere
-        return sphere;
     }
 
-    double writeToFile (string input)
+    // Read the number typed in, or 0 (and no input) if it isn't one
+    double parseInput (const string &text)
     {
-
-        fout.open ("files/input.txt",ios_base::out|ios_base::trunc);   // Output file AND append to file
-        fout.clear();
-        double getValue = 0;
-        double value = 0;
-        // Write input to file
-        fout << input;
-        fout.close();
-
-        fin.open ("files/input.txt");                  // Open the file
-        fin.clear();
-        // Get read input back from file
-        fin >> getValue;
+        const char *start = text.c_str();
+        char *end;
+        double value = strtod(start, &end);
         // Catch invalid inputs
-        while (fin.fail())
+        if (end == start)
         {
-            getValue = 0;
-            fin.clear();
-            fin.ignore(1000,'\n');
             cout << "Okay" << endl;
             inputReady = false;
-
-
+            return 0;
         }
-        fin.ignore(1000,'\n');
-        fin.close();
-        value = getValue;
         return value;
     }
 
-    void updateInfoFile ()
+    // Write what the spheres in shown are doing into the table
+    void fillTable (const BodyStore &shown)
     {
-        if (hit && activeRow != 0)
+        // Only the spheres that fit in the GUI table are shown
+        tableColumns = max(0, min(shown.Size() - FIRST_SPHERE, GUI_COLUMNS));
+        for (int column = 0; column < tableColumns; column++)
         {
-            ifstream fin;
-            // Open file
-            fin.open("files/info.txt");
-            // Go through the text file line by line until the desired line is reached, then save that position
-            int lines = 0;
-            do
-            {
-                string q;
-                getline(fin, q);
-                lines++;
-            }
-            while (!fin.eof());
-            lines--;
-            // Create variable to hold the file's original contents
-            string fileText [lines];
-            // Go to the begining of the file
-            fin.close();
-            fin.open("files/info.txt");
-            // Copy the file's contents into the string
-            for (int i = 0; i < lines; i ++)
+            int i = column + FIRST_SPHERE;
+            double values[GUI_ROWS - 1] = {shown.x[i], shown.y[i], shown.z[i], shown.vx[i], shown.vy[i], shown.vz[i],
+                                           shown.massNum[i], shown.massExp[i], shown.radius[i], shown.elasticity[i]*100};
+            table[0][column] = shown.Hidden(i) ? "no" : "yes";
+            for (int row = 1; row < GUI_ROWS; row++)
             {
-                getline(fin, fileText[i]);
-                // cout << fileText[i];
+                char text[32];
+                snprintf(text, sizeof(text), "%.3f", values[row - 1]);
+                table[row][column] = text;
             }
-            fin.close();
-            // Edit the desired text in the string
-            fileText[activeRow*6 + activeColumn-2] = inString + "|";
-            // Open file and replace text
-            fout.open("files/info.txt", ios_base::out|ios_base::trunc);
-            for (int i = 0; i < lines; i ++)fout << fileText[i]<<endl;
-            fout.close();
         }
+    }
 
+    // Show what is being typed in the box being edited, in place of its value
+    void showInput ()
+    {
+        int column = activeColumn - FIRST_SPHERE;
+        if (hit && activeRow != 0 && column >= 0 && column < tableColumns)
+        {
+            table[activeRow][column] = inString + "|";
+        }
     }
 
     void initTextVerts (void)
@@ -430,7 +407,8 @@ public:
         glBindVertexArray(0);
     }
 
-    void RenderText(Shader &shader, string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 colour)
+    // Takes the text as characters, so drawing it never has to build a string
+    void RenderText(Shader &shader, const char *text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 colour)
     {
         // Activate corresponding render state
         shader.Use();
@@ -439,8 +417,7 @@ public:
         glBindVertexArray(VAO);
 
         // Iterate through all characters
-        string::const_iterator c;
-        for (c = text.begin(); c != text.end(); c++)
+        for (const char *c = text; *c != '\0'; c++)
         {
             Character ch = Characters[*c];
 
@@ -0,0 +1,310 @@
+#ifndef INTEGRATOR_H_INCLUDED
+#define INTEGRATOR_H_INCLUDED
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "bodies.h"
+#include "gravity.h"
+
+// How the engine moves bodies through one step
+// Every scheme here is built from the same three pieces: a kick changes velocities by the
+// gravitational acceleration, a drift moves bodies along their velocities, and a force
+// evaluation works the accelerations out again for where the bodies are now. Collisions
+// are applied once at the end of every step, after gravity has had its say.
+//
+// Euler is what the simulator always did: first order, so orbits slowly spiral out unless
+// the step is tiny. The others are symplectic, so the energy error stays bounded instead of
+// growing, and much larger steps give the same accuracy.
+
+// Something an integrator can advance
+class Integrable
+{
+public:
+    virtual ~Integrable () {}
+
+    // Work out the acceleration of every body at the current positions
+    virtual void ComputeForces () = 0;
+    // Whether the accelerations from the last force evaluation still match the positions
+    virtual bool ForcesCurrent () const = 0;
+    // velocity += acceleration*dt
+    virtual void Kick (double dt) = 0;
+    // location += velocity*dt
+    virtual void Drift (double dt) = 0;
+    // location += velocity*dt, even with continuous collisions on, so nothing bounces
+    virtual void DriftUnswept (double dt) = 0;
+    // location += velocity*dt + acceleration*dt^2/2
+    virtual void DriftAccelerated (double dt) = 0;
+    // Bounce bodies off each other and the walls
+    virtual void Collide () = 0;
+
+    // Work out the acceleration of only the targets, pulled by every gravitating body
+    virtual void ComputeForcesOn (const std::vector<int> &targets) = 0;
+    // The bodies, their accelerations from the last force evaluation, and which of them attract each other
+    virtual BodyStore &Bodies () = 0;
+    virtual Accelerations &Forces () = 0;
+    virtual const std::vector<int> &Gravitating () const = 0;
+};
+
+class Integrator
+{
+public:
+    virtual ~Integrator () {}
+
+    // Advance the system by dt seconds
+    virtual void Step (Integrable &system, double dt) = 0;
+
+    // Force evaluations a step takes once the integrator is running
+    virtual int ForceEvaluations () const = 0;
+
+    // Name used in reports
+    virtual const char *Name () const = 0;
+};
+
+// Semi-implicit Euler: kick with the acceleration at the start, collide, then drift
+// First order. Kept so the original behaviour can still be had.
+class EulerIntegrator : public Integrator
+{
+public:
+    void Step (Integrable &system, double dt)
+    {
+        system.ComputeForces();
+        system.Kick(dt);
+        system.Collide();
+        system.Drift(dt);
+    }
+
+    int ForceEvaluations () const { return 1; }
+
+    const char *Name () const { return "euler"; }
+};
+
+// Kick-drift-kick leapfrog
+// Second order and symplectic, for one force evaluation per step: the acceleration at the
+// end of a step is the one the next step starts with.
+class LeapfrogIntegrator : public Integrator
+{
+public:
+    void Step (Integrable &system, double dt)
+    {
+        if (!system.ForcesCurrent()) system.ComputeForces();
+        system.Kick(dt/2);
+        system.Drift(dt);
+        system.ComputeForces();
+        system.Kick(dt/2);
+        system.Collide();
+    }
+
+    int ForceEvaluations () const { return 1; }
+
+    const char *Name () const { return "leapfrog"; }
+};
+
+// Velocity Verlet
+// x += v*dt + a*dt^2/2, then v += (a + a')*dt/2. Mathematically the same trajectory as
+// kick-drift-kick leapfrog, arranged the way most textbooks write it.
+class VerletIntegrator : public Integrator
+{
+public:
+    void Step (Integrable &system, double dt)
+    {
+        if (!system.ForcesCurrent()) system.ComputeForces();
+        system.DriftAccelerated(dt);
+        // Half of the velocity change comes from the old acceleration, half from the new
+        system.Kick(dt/2);
+        system.ComputeForces();
+        system.Kick(dt/2);
+        system.Collide();
+    }
+
+    int ForceEvaluations () const { return 1; }
+
+    const char *Name () const { return "verlet"; }
+};
+
+// Yoshida's fourth order symplectic integrator
+// Three leapfrog-like stages with weights chosen so the second and third order errors
+// cancel. One stage steps backwards. Three force evaluations per step, but the error
+// falls with dt^4, so steps can be made much longer for the same accuracy.
+class YoshidaIntegrator : public Integrator
+{
+public:
+    void Step (Integrable &system, double dt)
+    {
+        double cubeRoot2 = cbrt(2.0);
+        double w1 = 1/(2 - cubeRoot2);
+        double w0 = -cubeRoot2/(2 - cubeRoot2);
+        double c1 = w1/2, c2 = (w0 + w1)/2;
+
+        system.Drift(c1*dt);
+        system.ComputeForces();
+        system.Kick(w1*dt);
+        system.Drift(c2*dt);
+        system.ComputeForces();
+        system.Kick(w0*dt);
+        system.Drift(c2*dt);
+        system.ComputeForces();
+        system.Kick(w1*dt);
+        system.Drift(c1*dt);
+        system.Collide();
+    }
+
+    int ForceEvaluations () const { return 3; }
+
+    const char *Name () const { return "yoshida4"; }
+};
+
+// Hierarchical block timesteps
+// Every body gets its own step, the engine step divided by a power of two: level 0 takes
+// the whole step, level L takes 2^L steps of dt/2^L. A body's level comes from how fast its
+// acceleration is changing (Aarseth's criterion, eta*|a|/|da/dt|, with da/dt taken from
+// the change in acceleration over its last step), so a tight pair can take hundreds of
+// tiny steps while everything far away takes one.
+//
+// Each body is moved by kick-drift-kick leapfrog on its own step. Everything drifts
+// together between the moments a step ends, so the bodies due a new force see the
+// others where they really are, but only the bodies due a force have one worked out.
+// A body can move to a shorter step whenever its step ends, and to a longer one only
+// when that would line up with the longer step's boundaries.
+class BlockTimestepIntegrator : public Integrator
+{
+public:
+    double eta = 0.02;// Accuracy, smaller gives every body shorter steps
+    int maxLevel = 10;// Shortest step allowed is dt/2^maxLevel
+
+    BlockTimestepIntegrator (double eta = 0.02, int maxLevel = 10): eta(eta), maxLevel(std::max(0, std::min(maxLevel, 30))) {}
+
+    void Step (Integrable &system, double dt)
+    {
+        BodyStore &s = system.Bodies();
+        Accelerations &acc = system.Forces();
+        long long ticks = 1LL << maxLevel;
+        double tick = dt/ticks;
+
+        if (int(level.size()) != s.Size()) Start(system, dt);
+        else if (!system.ForcesCurrent()) system.ComputeForces();
+        const std::vector<int> &bodies = system.Gravitating();
+
+        long long now = 0;
+        while (now < ticks)
+        {
+            // Open the step of every body starting one now, and find when the first one ends
+            long long next = ticks;
+            for (int i : bodies)
+            {
+                long long stride = ticks >> level[i];
+                if (now % stride == 0)
+                {
+                    double half = stride*tick/2;
+                    s.vx[i] += acc.x[i]*half;
+                    s.vy[i] += acc.y[i]*half;
+                    s.vz[i] += acc.z[i]*half;
+                    openX[i] = acc.x[i];
+                    openY[i] = acc.y[i];
+                    openZ[i] = acc.z[i];
+                }
+                next = std::min(next, now - now % stride + stride);
+            }
+
+            system.Drift((next - now)*tick);
+            now = next;
+
+            // Close the steps ending now with the new acceleration, and pick the next step
+            due.clear();
+            for (int i : bodies)
+            {
+                if (now % (ticks >> level[i]) == 0) due.push_back(i);
+            }
+            system.ComputeForcesOn(due);
+            for (int i : due)
+            {
+                long long stride = ticks >> level[i];
+                double half = stride*tick/2;
+                s.vx[i] += acc.x[i]*half;
+                s.vy[i] += acc.y[i]*half;
+                s.vz[i] += acc.z[i]*half;
+
+                double jx = (acc.x[i] - openX[i])/(stride*tick);
+                double jy = (acc.y[i] - openY[i])/(stride*tick);
+                double jz = (acc.z[i] - openZ[i])/(stride*tick);
+                int wanted = LevelFor(Size(acc, i), sqrt(jx*jx + jy*jy + jz*jz), dt);
+                // Steps only grow one level at a time, and have to start on one of their own boundaries
+                wanted = std::max(wanted, level[i] - 1);
+                while (wanted < level[i] && now % (ticks >> wanted) != 0) wanted++;
+                level[i] = wanted;
+            }
+        }
+        system.Collide();
+    }
+
+    int ForceEvaluations () const { return 1; }
+
+    const char *Name () const { return "block"; }
+
+    // Bodies on each level after the last step, for reports
+    std::vector<int> LevelCounts (const std::vector<int> &bodies) const
+    {
+        std::vector<int> counts(maxLevel + 1, 0);
+        for (int i : bodies) counts[level[i]]++;
+        return counts;
+    }
+
+private:
+    std::vector<int> level;// Level of every body, indexed like the BodyStore
+    std::vector<double> openX, openY, openZ;// Acceleration each body's current step opened with
+    std::vector<int> due;// Bodies whose step ends at the current moment
+
+    // Level whose step is the longest one no longer than eta*|a|/|da/dt|
+    int LevelFor (double a, double jerk, double dt) const
+    {
+        if (jerk <= 0 || a <= 0) return 0;
+        double wanted = eta*a/jerk;
+        if (wanted >= dt) return 0;
+        return std::min(maxLevel, int(ceil(log2(dt/wanted))));
+    }
+
+    static double Size (const Accelerations &acc, int i)
+    {
+        return sqrt(acc.x[i]*acc.x[i] + acc.y[i]*acc.y[i] + acc.z[i]*acc.z[i]);
+    }
+
+    // Work out the first levels: the rate the accelerations change comes from a second force
+    // evaluation a tiny step ahead
+    // The probe isn't swept, so it can't bounce anything, and the positions are put back
+    // exactly afterwards, so working the levels out leaves the bodies as they were.
+    void Start (Integrable &system, double dt)
+    {
+        BodyStore &s = system.Bodies();
+        Accelerations &acc = system.Forces();
+        int n = s.Size();
+        level.assign(n, 0);
+        openX.assign(n, 0);
+        openY.assign(n, 0);
+        openZ.assign(n, 0);
+
+        double probe = dt/(1LL << maxLevel);
+        system.ComputeForces();
+        for (int i : system.Gravitating())
+        {
+            openX[i] = acc.x[i];
+            openY[i] = acc.y[i];
+            openZ[i] = acc.z[i];
+        }
+        std::vector<double> x = s.x, y = s.y, z = s.z;
+        system.DriftUnswept(probe);
+        system.ComputeForces();
+        for (int i : system.Gravitating())
+        {
+            double jx = (acc.x[i] - openX[i])/probe;
+            double jy = (acc.y[i] - openY[i])/probe;
+            double jz = (acc.z[i] - openZ[i])/probe;
+            level[i] = LevelFor(Size(acc, i), sqrt(jx*jx + jy*jy + jz*jz), dt);
+        }
+        s.x = x;
+        s.y = y;
+        s.z = z;
+        system.ComputeForces();
+    }
+};
+
+#endif // INTEGRATOR_H_INCLUDED
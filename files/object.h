@@ -2,6 +2,7 @@
 #define OBJECT_H_INCLUDED
 
 #include "model.h"
+#include "engine.h"
 #include <string>
 #include <SDL_opengl.h>
 #include <glew.h>
@@ -16,181 +17,24 @@
 using namespace std;
 
 // Object Class
+// Only holds what is needed to draw an object. The physics of the object is
+// kept by the engine in the Body with the same index.
 class Object
 {
 public:
-    glm::vec3 location;// Location
-    glm::vec3 oldLocation;
     glm::vec3 rotation;// Rotation
-    glm::vec3 scale;// Scale
-    glm::vec3 oldVelocity;// Velocity in metres per second
-    glm::vec3 velocity;// Velocity in metres per second
-
-    double massNum; // First digit of the mass
-    double massExp; // Exponent of the mass in scientific notation
-    double mass;// Mass
-    double elasticity;// Elasticity
-
-    bool hidden;// Whether the object should be drawn
-    bool isSphere;// Whether the object is a sphere
-    bool collision;// Whether the object should collide
 
-    GLchar * meshDir;// Mesh directory for the model
+    string meshDir;// Mesh directory for the model
 
     Model model;// The object's model
-
-    void CalcLoc(float dTime)
-    {
-        location += velocity*dTime;
-    }
-
-    void Collide (Object obj)
-    {
-        // If the distance between the objects is smaller than the sum of their radii, and they are both spheres
-        if ((glm::distance(location, obj.location) <= (scale.x + obj.scale.x))&&(obj.isSphere)&&(isSphere))
-        {
-            // Create vectors from the axis of normal alignment in both directions
-            glm::vec3 colDir = glm::vec3(obj.location - location);
-            glm::vec3 invColDir = glm::vec3(location - obj.location);
-
-            // Calculate the angle of the objects velocity relative to the axis of normal alignment
-            double theta = glm::angle(glm::normalize(velocity), glm::normalize(colDir));
-            double epsilon = glm::angle(glm::normalize(obj.oldVelocity), glm::normalize(invColDir));
-
-            // Calculate the component of the velocity that should be used in the collision
-            glm::vec3 via = (glm::length (velocity) * float(cos(theta)))* glm::normalize(colDir);
-            // Calculate the component of the velocity that should NOT be used int the collision
-            glm::vec3 viNA = velocity - via;
-            glm::vec3 vib = (glm::length(obj.oldVelocity) * float(cos(epsilon)))*glm::normalize(invColDir);
-            // Set up variables for the physics calculation
-            double ma = mass;
-            double el = (elasticity + obj.elasticity)/2;
-            double mb = obj.mass;
-            glm::vec3 vfa = glm::vec3(0,0,0);
-
-            // Do the momentum calculations in all directions
-            vfa.x  = (via.x *((ma - mb)/(ma + mb)) + vib.x*((2*mb)/(ma + mb)))*el + ((ma*via.x+ mb*vib.x)/(ma+mb))*(1 - el);
-            vfa.y  = (via.y *((ma - mb)/(ma + mb)) + vib.y*((2*mb)/(ma + mb)))*el + ((ma*via.y+ mb*vib.y)/(ma+mb))*(1 - el);
-            vfa.z  = (via.z *((ma - mb)/(ma + mb)) + vib.z*((2*mb)/(ma + mb)))*el + ((ma*via.z+ mb*vib.z)/(ma+mb))*(1 - el);
-
-            // Add back the reflected component of the velocity that was not involved in the collision
-            vfa += glm::reflect (viNA,glm::normalize(colDir));
-
-            // Set the object's velocity
-            velocity = vfa;
-        }
-
-
-        // If a sphere is colliding with the boundaries
-        if (isSphere && !(obj.isSphere))
-        {
-
-            bool collision = false;
-            glm::vec3 colDir = glm::vec3(0,0,0);
-
-            // If the sphere collides with the +x side of the domain
-            if((location.x + scale.x) >= (obj.scale.x))
-            {
-                // Keep track of the direction of the collision
-                // (whether the sphere has collided with multiple walls)
-                colDir += glm::vec3(1,0,0);
-                location.x = obj.scale.x - scale.x;
-                collision = true;
-
-            }
-
-            // If the sphere collides with the -x side of the domain
-            if((location.x - scale.x) <= (-obj.scale.x))
-            {
-                colDir += glm::vec3(-1,0,0);
-                location.x = -obj.scale.x + scale.x;
-                collision = true;
-
-            }
-
-            // If the sphere collides with the +y side of the domain
-            if((location.y + scale.y) >= (obj.scale.y))
-            {
-                colDir += glm::vec3(0,1,0);
-                location.y = obj.scale.y - scale.y;
-                collision = true;
-
-            }
-
-            // If the sphere collides with the -y side of the domain
-            if((location.y - scale.y) <= (-obj.scale.y))
-            {
-                colDir += glm::vec3(0,-1,0);
-                location.y = -obj.scale.y + scale.y;
-                collision = true;
-
-            }
-
-            // If the sphere collides with the +z side of the domain
-            if((location.z + scale.z) >= (obj.scale.z))
-            {
-                colDir += glm::vec3(0,0,1);
-                location.z = obj.scale.z - scale.z;
-                collision = true;
-
-            }
-
-            // If the sphere collides with the -z side of the domain
-            if((location.z - scale.z) <= (-obj.scale.z))
-            {
-                colDir += glm::vec3(0,0,-1);
-                location.z = -obj.scale.z + scale.z;
-                collision = true;
-            }
-
-            colDir = glm::normalize(colDir);
-
-            // If a collision has occured
-            if (collision)
-            {
-                // Calculate angle that determines the component of the velocity to use in calculations
-                double theta = glm::angle(glm::normalize(velocity), colDir);
-
-                // Find the reflected component and non-reflected component
-                glm::vec3 via = (glm::length (velocity) * float(cos(theta)))* glm::normalize(colDir);
-                glm::vec3 viNA = velocity - via;
-
-                glm::vec3 vfa = glm::vec3(0,0,0);
-
-                // Only the momentum-relevant component is effected by elasticity
-                vfa.x  = -(via.x)*elasticity;
-                vfa.y  = -(via.y)*elasticity;
-                vfa.z  = -(via.z)*elasticity;
-
-                // Add back the non-relevant reflected velocity
-                vfa += glm::reflect (viNA,colDir);
-
-                // Set the velocity of the object
-                velocity = vfa;
-            }
-
-        }
-    }
-
-    void Gravity (Object obj, float dTime)
-    {
-        if ((obj.isSphere)&&(isSphere))
-        {
-            glm::vec3 colDir = glm::vec3(obj.location - location);
-            double fG;
-            double r = glm::distance(location, obj.location);
-            fG = (6.67)*pow(10,-11)*(mass*obj.mass)/(r*r);
-
-            glm::vec3 a;
-            a = glm::normalize(colDir)* float(fG/mass);
-
-            velocity += a*(dTime);
-        }
-    }
-
-//    void takeInput
 };
 
+// Convert the engine's vectors into something OpenGL can use
+inline glm::vec3 ToGlm (const Vec3 &v)
+{
+    return glm::vec3(float(v.x), float(v.y), float(v.z));
+}
+
 // Light
 class Light
 {
@@ -0,0 +1,307 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+// Threads for the physics passes
+// A ThreadPool keeps its worker threads alive between steps so a parallel loop only costs
+// a wake up rather than creating and joining threads. A loop is cut into chunks that are
+// dealt out to a queue per thread. Each thread works through its own queue from the back
+// and, once that runs dry, steals chunks from the front of the others, so a thread that
+// draws cheap chunks helps out with the expensive ones.
+//
+// The thread calling For counts as worker 0 and works too, so a pool of size 1 has no
+// extra threads at all. Only one thread may call For at a time; a For started from inside
+// a chunk of the same pool runs on the spot. Every thread remembers which pool it is working
+// for, so a worker of one pool calling For on another is just an outside caller there and
+// gets that pool's worker 0, which keeps buffers sized by Size() indexed in range.
+
+#define POOL_CHUNKS_PER_THREAD 8// Chunks a loop is cut into for each thread, more balances better
+
+// Number of threads to use when nothing else has been asked for
+inline int DefaultThreadCount ()
+{
+    int n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// Keep a thread on one core, so its caches stay warm and the scheduler can't move it
+inline void PinThread (std::thread &thread, int core)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % DefaultThreadCount(), &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % DefaultThreadCount()));
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+
+class ThreadPool
+{
+public:
+    ThreadPool (int threads = DefaultThreadCount(), bool pin = false)
+    {
+        Start(threads, pin);
+    }
+
+    ~ThreadPool ()
+    {
+        Stop();
+    }
+
+    ThreadPool (const ThreadPool &) = delete;
+    ThreadPool &operator= (const ThreadPool &) = delete;
+
+    // Threads working on each loop, including the caller
+    int Size () const
+    {
+        return int(queues.size());
+    }
+
+    bool Pinned () const
+    {
+        return pinned;
+    }
+
+    // Change the number of threads, pinning worker t to core t if pin is set
+    void Resize (int threads, bool pin = false)
+    {
+        Stop();
+        Start(threads, pin);
+    }
+
+    // Index of the thread running the current chunk, from 0 to Size() - 1
+    // Threads that aren't working for this pool count as worker 0, the caller.
+    int CurrentWorker () const
+    {
+        return Here().pool == this ? Here().worker : 0;
+    }
+
+    // Call work(begin, end) over [0, n) in chunks of at least grain, and wait for all of them
+    template <class Work>
+    void For (int n, int grain, Work &work)
+    {
+        if (n <= 0) return;
+        if (Running())
+        {
+            work(0, n);
+            return;
+        }
+
+        // This thread is worker 0 of this pool until the loop is done, whatever it was before
+        Place outer = Here();
+        Here() = Place{this, 0, true};
+        if (Size() <= 1 || n <= grain)
+        {
+            work(0, n);
+            Here() = outer;
+            return;
+        }
+
+        int chunks = std::min(Size()*POOL_CHUNKS_PER_THREAD, (n + grain - 1)/grain);
+        Job job;
+        job.run = &Call<Work>;
+        job.work = &work;
+        job.remaining = chunks;
+
+        // Deal the chunks out round the queues
+        for (int c = 0; c < chunks; c++)
+        {
+            Task task = {&job, int((long long)n*c/chunks), int((long long)n*(c + 1)/chunks)};
+            Queue &queue = queues[c % Size()];
+            std::lock_guard<std::mutex> hold(queue.lock);
+            queue.tasks.push_back(task);
+        }
+        {
+            std::lock_guard<std::mutex> hold(sleep);
+            generation++;
+        }
+        wake.notify_all();
+
+        // Help until every chunk is done, including ones other threads are still running
+        while (job.remaining.load(std::memory_order_acquire) > 0)
+        {
+            Task task;
+            if (Find(0, task)) RunTask(task);
+            else std::this_thread::yield();
+        }
+        Here() = outer;
+    }
+
+private:
+    struct Job
+    {
+        void (*run)(void *, int, int);
+        void *work;
+        std::atomic<int> remaining;
+    };
+
+    struct Task
+    {
+        Job *job;
+        int begin, end;
+    };
+
+    // Chunks waiting for a thread; the owner takes from the back and thieves from head
+    struct Queue
+    {
+        std::mutex lock;
+        std::vector<Task> tasks;
+        size_t head = 0;
+    };
+
+    std::vector<Queue> queues;// One per thread, queue 0 belongs to the caller
+    std::vector<std::thread> workers;
+    std::mutex sleep;
+    std::condition_variable wake;
+    unsigned long long generation = 0;// Counts loops started, so sleeping workers know to look
+    bool stopping = false;
+    bool pinned = false;
+
+    template <class Work>
+    static void Call (void *work, int begin, int end)
+    {
+        (*static_cast<Work *>(work))(begin, end);
+    }
+
+    // The pool a thread is working for, its index there and whether it is inside a chunk
+    struct Place
+    {
+        const ThreadPool *pool;
+        int worker;
+        bool running;
+    };
+
+    static Place &Here ()
+    {
+        static thread_local Place place = {NULL, 0, false};
+        return place;
+    }
+
+    // Whether this thread is already inside a chunk of this pool
+    bool Running () const
+    {
+        return Here().pool == this && Here().running;
+    }
+
+    void Start (int threads, bool pin)
+    {
+        threads = std::max(1, threads);
+        pinned = pin;
+        stopping = false;
+        queues = std::vector<Queue>(threads);
+        // Enough room that dealing out a loop never has to allocate
+        for (Queue &queue : queues) queue.tasks.reserve(2*POOL_CHUNKS_PER_THREAD*threads);
+        workers.reserve(threads - 1);
+        for (int t = 1; t < threads; t++)
+        {
+            workers.emplace_back(&ThreadPool::Loop, this, t);
+            if (pin) PinThread(workers.back(), t);
+        }
+    }
+
+    void Stop ()
+    {
+        {
+            std::lock_guard<std::mutex> hold(sleep);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers) worker.join();
+        workers.clear();
+    }
+
+    // Take a chunk from our own queue, or steal one from another
+    bool Find (int self, Task &task)
+    {
+        {
+            Queue &queue = queues[self];
+            std::lock_guard<std::mutex> hold(queue.lock);
+            if (queue.tasks.size() > queue.head)
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+                if (queue.tasks.size() == queue.head) { queue.tasks.clear(); queue.head = 0; }
+                return true;
+            }
+        }
+        for (int k = 1; k < Size(); k++)
+        {
+            Queue &queue = queues[(self + k) % Size()];
+            std::lock_guard<std::mutex> hold(queue.lock);
+            if (queue.tasks.size() > queue.head)
+            {
+                task = queue.tasks[queue.head++];
+                if (queue.tasks.size() == queue.head) { queue.tasks.clear(); queue.head = 0; }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void RunTask (const Task &task)
+    {
+        task.job->run(task.job->work, task.begin, task.end);
+        task.job->remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    // What every worker thread does until the pool is stopped
+    void Loop (int self)
+    {
+        Here() = Place{this, self, true};
+        unsigned long long seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> hold(sleep);
+                wake.wait(hold, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            Task task;
+            while (Find(self, task)) RunTask(task);
+        }
+    }
+};
+
+// Split [0, n) into chunks of at least grain and call work(begin, end) on each chunk
+// Runs on the calling thread alone when there is no pool or very little work.
+template <class Work>
+void ParallelFor (ThreadPool *pool, int n, Work work, int grain = 1)
+{
+    if (pool == NULL)
+    {
+        if (n > 0) work(0, n);
+        return;
+    }
+    pool->For(n, std::max(1, grain), work);
+}
+
+// Index of the calling thread in pool, for picking its own buffer inside a ParallelFor
+// 0 when there is no pool, the same as the caller of a pool's loop.
+inline int CurrentWorker (const ThreadPool *pool)
+{
+    return pool == NULL ? 0 : pool->CurrentWorker();
+}
+
+#endif // PARALLEL_H_INCLUDED
@@ -0,0 +1,294 @@
+#ifndef PM_H_INCLUDED
+#define PM_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "gravity.h"
+#include "fft.h"
+#include "parallel.h"
+
+// Particle-mesh gravity on the domain box
+// The mass of every body is spread onto a grid covering the domain, Poisson's equation
+// is solved for the potential with FFTs, and the gradient of the potential is read back
+// at every body with the same spreading weights. The cost is O(N + M log M) for M grid
+// cells, so for large, fairly even spreads of bodies it is far cheaper than summing
+// pairs. Forces closer than a couple of grid cells are smoothed out.
+//
+// periodic: the box repeats forever in every direction.
+// isolated: nothing exists outside the box. The grid is doubled and zero padded so the
+//           cyclic convolution of the FFT doesn't wrap around (Hockney and Eastwood).
+
+#define PM_CIC 1// Cloud in cell: each body is spread over the 8 nearest cells
+#define PM_TSC 2// Triangular shaped cloud: each body is spread over the 27 nearest cells
+
+class ParticleMeshGravity : public GravitySolver
+{
+public:
+    int gridSize = 64;// Cells along each side of the domain, must be a power of two
+    int assignment = PM_CIC;// PM_CIC or PM_TSC
+    bool periodic = false;
+
+    ParticleMeshGravity (int gridSize = 64, int assignment = PM_CIC, bool periodic = false):
+        gridSize(gridSize), assignment(assignment), periodic(periodic) {}
+
+    const char *Name () const { return periodic ? "pm-periodic" : "pm-isolated"; }
+
+    void ComputeAccelerations (const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc)
+    {
+        if (active.empty() || !IsPowerOfTwo(gridSize)) return;
+
+        FindBox(s, active);
+        n = periodic ? gridSize : 2*gridSize;
+
+        Deposit(s, active);
+        Solve(G);
+        Gradient();
+        Interpolate(s, active, acc);
+    }
+
+private:
+    int n = 0;// Cells along each side of the FFT grid
+    double origin[3];// Low corner of the domain
+    double h = 1;// Cell width
+
+    std::vector<FFTComplex> grid;// Density, then potential
+    std::vector<FFTComplex> green;// Transformed isolated Green's function
+    int greenSize = 0;// Grid the Green's function was made for
+    double greenH = 0;
+    std::vector<double> fx, fy, fz;// Acceleration at each cell
+    std::vector<FFTComplex> lines;// Room for every worker's line of the FFTs
+
+    int Index (int x, int y, int z) const
+    {
+        return (z*n + y)*n + x;
+    }
+
+    int Wrap (int i) const
+    {
+        return ((i % n) + n) % n;
+    }
+
+    // The domain is the first visible body that isn't a sphere; without one, use the box around the bodies
+    void FindBox (const BodyStore &s, const std::vector<int> &active)
+    {
+        for (int i = 0; i < s.Size(); i++)
+        {
+            if (!s.Hidden(i) && !s.IsSphere(i))
+            {
+                double half = s.radius[i];
+                origin[0] = s.x[i] - half;
+                origin[1] = s.y[i] - half;
+                origin[2] = s.z[i] - half;
+                h = 2*half/gridSize;
+                return;
+            }
+        }
+
+        double lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (int i : active)
+        {
+            double p[3] = {s.x[i], s.y[i], s.z[i]};
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::min(lo[a], p[a]);
+                hi[a] = std::max(hi[a], p[a]);
+            }
+        }
+        double half = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]))/2*1.01;
+        if (half <= 0) half = 1;
+        for (int a = 0; a < 3; a++) origin[a] = (lo[a] + hi[a])/2 - half;
+        h = 2*half/gridSize;
+    }
+
+    // The cells a body at grid coordinate u touches along one axis, and their weights
+    // Cell i is centred on origin + (i + 0.5)*h.
+    int Weights (double u, int &first, double *w) const
+    {
+        u -= 0.5;
+        if (assignment == PM_TSC)
+        {
+            int i = int(floor(u + 0.5));
+            double d = u - i;
+            first = i - 1;
+            w[0] = 0.5*(0.5 - d)*(0.5 - d);
+            w[1] = 0.75 - d*d;
+            w[2] = 0.5*(0.5 + d)*(0.5 + d);
+            return 3;
+        }
+        int i = int(floor(u));
+        double d = u - i;
+        first = i;
+        w[0] = 1 - d;
+        w[1] = d;
+        return 2;
+    }
+
+    // Every axis of a body's footprint: first cell and weights
+    struct Footprint
+    {
+        int count;
+        int first[3];
+        double w[3][3];
+    };
+
+    Footprint Spread (const BodyStore &s, int i) const
+    {
+        Footprint f;
+        double p[3] = {s.x[i], s.y[i], s.z[i]};
+        for (int a = 0; a < 3; a++) f.count = Weights((p[a] - origin[a])/h, f.first[a], f.w[a]);
+        return f;
+    }
+
+    // Spread the mass of every body onto the grid as a density
+    // Done on one thread: bodies from different threads would land in the same cells.
+    void Deposit (const BodyStore &s, const std::vector<int> &active)
+    {
+        grid.assign(size_t(n)*n*n, FFTComplex(0, 0));
+        double invVolume = 1/(h*h*h);
+        for (int i : active)
+        {
+            Footprint f = Spread(s, i);
+            double m = s.mass[i]*invVolume;
+            for (int c = 0; c < f.count; c++)
+            {
+                int z = Wrap(f.first[2] + c);
+                for (int b = 0; b < f.count; b++)
+                {
+                    int y = Wrap(f.first[1] + b);
+                    for (int a = 0; a < f.count; a++)
+                    {
+                        int x = Wrap(f.first[0] + a);
+                        grid[Index(x, y, z)] += m*f.w[0][a]*f.w[1][b]*f.w[2][c];
+                    }
+                }
+            }
+        }
+    }
+
+    // Turn the density in grid into the potential
+    void Solve (double G)
+    {
+        FFT3D(grid, n, false, pool, lines);
+        double scale = 1.0/(double(n)*n*n);
+
+        if (periodic)
+        {
+            // phi_k = -4 pi G rho_k / k^2, and the mean density doesn't pull on anything
+            double k0 = 2*FFT_PI/(n*h);
+            ParallelFor(pool, n, [&](int begin, int end)
+            {
+                for (int z = begin; z < end; z++)
+                {
+                    double kz = k0*(z <= n/2 ? z : z - n);
+                    for (int y = 0; y < n; y++)
+                    {
+                        double ky = k0*(y <= n/2 ? y : y - n);
+                        for (int x = 0; x < n; x++)
+                        {
+                            double kx = k0*(x <= n/2 ? x : x - n);
+                            double k2 = kx*kx + ky*ky + kz*kz;
+                            grid[Index(x, y, z)] *= k2 == 0 ? 0 : -4*FFT_PI*G/k2*scale;
+                        }
+                    }
+                }
+            });
+        }
+        else
+        {
+            MakeGreen();
+            for (size_t c = 0; c < grid.size(); c++) grid[c] *= green[c]*(G*scale);
+        }
+
+        FFT3D(grid, n, true, pool, lines);
+    }
+
+    // Transform of -1/r on the doubled grid, distances measured the short way round
+    // Each cell holds a density, so the sum over cells is weighted by the cell volume.
+    // Only remade when the grid or the cell width changes.
+    void MakeGreen ()
+    {
+        if (greenSize == n && greenH == h) return;
+
+        green.assign(size_t(n)*n*n, FFTComplex(0, 0));
+        for (int z = 0; z < n; z++)
+        {
+            double dz = std::min(z, n - z)*h;
+            for (int y = 0; y < n; y++)
+            {
+                double dy = std::min(y, n - y)*h;
+                for (int x = 0; x < n; x++)
+                {
+                    double dx = std::min(x, n - x)*h;
+                    double r = sqrt(dx*dx + dy*dy + dz*dz);
+                    // A body's own cell is treated as if it were half a cell away
+                    green[Index(x, y, z)] = -h*h*h/std::max(r, 0.5*h);
+                }
+            }
+        }
+        FFT3D(green, n, false, pool, lines);
+        greenSize = n;
+        greenH = h;
+    }
+
+    // Acceleration is minus the gradient of the potential, by central differences
+    void Gradient ()
+    {
+        size_t cells = size_t(n)*n*n;
+        fx.resize(cells);
+        fy.resize(cells);
+        fz.resize(cells);
+        double k = -1/(2*h);
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int z = begin; z < end; z++)
+            {
+                for (int y = 0; y < n; y++)
+                {
+                    for (int x = 0; x < n; x++)
+                    {
+                        int c = Index(x, y, z);
+                        fx[c] = k*(grid[Index(Wrap(x + 1), y, z)].real() - grid[Index(Wrap(x - 1), y, z)].real());
+                        fy[c] = k*(grid[Index(x, Wrap(y + 1), z)].real() - grid[Index(x, Wrap(y - 1), z)].real());
+                        fz[c] = k*(grid[Index(x, y, Wrap(z + 1))].real() - grid[Index(x, y, Wrap(z - 1))].real());
+                    }
+                }
+            }
+        });
+    }
+
+    // Read the acceleration at every body back off the grid with the weights used to deposit it
+    void Interpolate (const BodyStore &s, const std::vector<int> &active, Accelerations &acc)
+    {
+        ParallelFor(pool, int(active.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = active[k];
+                Footprint f = Spread(s, i);
+                double ax = 0, ay = 0, az = 0;
+                for (int c = 0; c < f.count; c++)
+                {
+                    int z = Wrap(f.first[2] + c);
+                    for (int b = 0; b < f.count; b++)
+                    {
+                        int y = Wrap(f.first[1] + b);
+                        for (int a = 0; a < f.count; a++)
+                        {
+                            int cell = Index(Wrap(f.first[0] + a), y, z);
+                            double w = f.w[0][a]*f.w[1][b]*f.w[2][c];
+                            ax += w*fx[cell];
+                            ay += w*fy[cell];
+                            az += w*fz[cell];
+                        }
+                    }
+                }
+                acc.x[i] = ax;
+                acc.y[i] = ay;
+                acc.z[i] = az;
+            }
+        });
+    }
+};
+
+#endif // PM_H_INCLUDED
@@ -0,0 +1,208 @@
+#ifndef REPLAY_H_INCLUDED
+#define REPLAY_H_INCLUDED
+
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "bodies.h"
+#include "simthread.h"
+#include "trajectory.h"
+
+// Playing a recorded trajectory back instead of simulating
+// The file stays mapped rather than read in, and only the two frames either side of the
+// moment being shown are decoded, so a run of any length opens at once and jumping anywhere
+// in it costs at most one chunk. Playback speed is in simulated seconds per second of the
+// clock, the same as the time warp of a live simulation, and may be negative to play
+// backwards. What is shown is a Snapshot, so it is drawn exactly the way a live one is.
+//
+// The moment shown is kept in simulated seconds and found among the frames by their times,
+// since frames needn't be evenly spaced: a recording that had to drop frames has gaps of
+// anything from one step to hundreds, and those still play back at the speed they happened.
+
+class Replay
+{
+public:
+    // Play path back over scene, which supplies everything trajectories don't record (radii,
+    // masses, flags) and must have as many bodies
+    bool Open (const std::string &path, const BodyStore &scene, std::string &error)
+    {
+        if (!reader.Open(path, error)) return false;
+        if (reader.Frames() == 0)
+        {
+            error = path + " has no frames";
+            return false;
+        }
+        if (reader.Bodies() != scene.Size())
+        {
+            error = path + " isn't of this scene";
+            return false;
+        }
+        if (!(reader.Fields() & TRAJECTORY_POSITIONS))
+        {
+            error = path + " has no positions to show";
+            return false;
+        }
+
+        // The length of the run, from its first and last frames
+        if (!reader.Read(reader.Frames() - 1, after) || !reader.Read(0, before))
+        {
+            error = path + " is damaged";
+            return false;
+        }
+        startTime = before.time;
+        endTime = after.time;
+
+        shown.bodies = scene;
+        shown.visible.clear();
+        for (int i = 0; i < scene.Size(); i++)
+        {
+            if (!scene.Hidden(i)) shown.visible.push_back(i);
+        }
+        beforeFrame = 0;
+        afterFrame = -1;
+        time = startTime;
+        Show();
+        last = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // Move on by however long it has been since the last call, and decode what is now shown
+    // Call once per frame drawn.
+    void Update ()
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        last = now;
+        if (playing) time += seconds*speed;
+        Clamp();
+        Show();
+    }
+
+    // Simulated seconds to show every second of the clock, negative to play backwards
+    void SetSpeed (double warp)
+    {
+        speed = warp;
+    }
+
+    void SetPlaying (bool play)
+    {
+        playing = play;
+    }
+
+    // Jump to a fraction of the way through the run, 0 for the start and 1 for the end
+    void Seek (double fraction)
+    {
+        time = startTime + fraction*(endTime - startTime);
+        Clamp();
+        Show();
+    }
+
+    // Jump to a frame, or move a number of frames either way from the one shown
+    void SeekFrame (long long frame)
+    {
+        frame = std::max(0LL, std::min(frame, (long long)Frames() - 1));
+        if (!Bracket(frame)) return;
+        time = before.time;
+        Draw();
+    }
+
+    void StepFrames (int frames)
+    {
+        SeekFrame(beforeFrame + frames);
+    }
+
+    // What to draw, valid until the next Update or Seek
+    const Snapshot &Shown () const
+    {
+        return shown;
+    }
+
+    // The frame shown, counting from 0, with how far it is on the way to the next
+    double Position () const { return beforeFrame + blend; }
+    // The simulated moment shown
+    double Time () const { return time; }
+    unsigned long long Frames () const { return reader.Frames(); }
+    double Speed () const { return speed; }
+    bool Playing () const { return playing; }
+
+private:
+    TrajectoryReader reader;
+    TrajectoryFrame before, after;// The frames either side of time
+    long long beforeFrame = 0, afterFrame = -1;// Which frames those are, -1 if not decoded
+    double time = 0;// Simulated seconds shown
+    double startTime = 0, endTime = 0;// Times of the first and last frames
+    double blend = 0;// How far time is from the frame before to the frame after
+    double speed = 1;
+    bool playing = true;
+    std::chrono::steady_clock::time_point last;// When Update was last called
+    Snapshot shown;
+
+    void Clamp ()
+    {
+        time = std::max(startTime, std::min(time, endTime));
+    }
+
+    // Decode the frames either side of time and blend between them into shown
+    // While time stays between the two decoded frames nothing needs decoding at all.
+    void Show ()
+    {
+        bool inside = afterFrame >= 0 && time >= before.time && (time < after.time || afterFrame == beforeFrame);
+        if (!inside && !Bracket((long long)reader.FrameAt(time))) return;
+        Draw();
+    }
+
+    // Decode frame first into before and the one after it into after
+    bool Bracket (long long first)
+    {
+        long long second = std::min(first + 1, (long long)Frames() - 1);
+        if (first == afterFrame)
+        {
+            // Playing forwards, the frame after is now the one before
+            std::swap(before, after);
+            std::swap(beforeFrame, afterFrame);
+        }
+        if (first != beforeFrame || afterFrame < 0)
+        {
+            if (!reader.Read(first, before)) return false;
+            beforeFrame = first;
+            afterFrame = -1;
+        }
+        if (second != afterFrame)
+        {
+            if (!reader.Read(second, after)) return false;
+            afterFrame = second;
+        }
+        return true;
+    }
+
+    // Blend between the decoded frames into shown
+    void Draw ()
+    {
+        // The bodies are put where they are between the two frames, by time rather than by
+        // frame, with the last locations the same so Location shows them there whatever
+        // blend it is asked for
+        blend = after.time > before.time ? std::max(0.0, std::min((time - before.time)/(after.time - before.time), 1.0)) : 0;
+        BodyStore &s = shown.bodies;
+        for (int i = 0; i < s.Size(); i++)
+        {
+            s.x[i] = before.x[i] + (after.x[i] - before.x[i])*blend;
+            s.y[i] = before.y[i] + (after.y[i] - before.y[i])*blend;
+            s.z[i] = before.z[i] + (after.z[i] - before.z[i])*blend;
+        }
+        if (reader.Fields() & TRAJECTORY_VELOCITIES)
+        {
+            std::copy(before.vx.begin(), before.vx.end(), s.vx.begin());
+            std::copy(before.vy.begin(), before.vy.end(), s.vy.begin());
+            std::copy(before.vz.begin(), before.vz.end(), s.vz.begin());
+        }
+        shown.lastX = s.x;
+        shown.lastY = s.y;
+        shown.lastZ = s.z;
+        shown.time = time;
+        shown.steps = before.steps;
+        shown.timeWarp = 0;
+    }
+};
+
+#endif // REPLAY_H_INCLUDED
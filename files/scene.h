@@ -0,0 +1,762 @@
+#ifndef SCENE_H_INCLUDED
+#define SCENE_H_INCLUDED
+
+#include <vector>
+#include <array>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <charconv>
+#include <algorithm>
+#include "vec3.h"
+#include "bodies.h"
+#include "units.h"
+#include "parallel.h"
+#include "engine.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "pm.h"
+#include "checkpoint.h"
+
+// Scene files: the bodies a simulation starts from, the lights it is drawn with and the
+// settings it is run with, read the same way by the windowed program and by headless
+//
+// The text form has one thing per line, and anything after a # is a comment:
+//   sphere X Y Z VX VY VZ RADIUS MASS_NUM MASS_EXP ELASTICITY [hidden] [ghost] [mesh PATH]
+//   domain X Y Z VX VY VZ RADIUS MASS_NUM MASS_EXP ELASTICITY [hidden] [ghost] [mesh PATH]
+//     A body. Bodies are numbered from 0 in the order they appear. The mass is MASS_NUM times
+//     ten to the MASS_EXP, the way the GUI shows it. hidden bodies aren't simulated or drawn,
+//     ghosts don't collide, and PATH (the rest of the line) is the model the windowed
+//     program draws the body with.
+//   mesh BODY PATH
+//     The model body number BODY is drawn with.
+//   light point|directional|spot X Y Z DX DY DZ R G B CONSTANT LINEAR QUADRATIC CUTOFF OUTER_CUTOFF
+//     A light at X Y Z pointing along DX DY DZ, of colour R G B (for its ambient, diffuse and
+//     specular parts alike), falling off as CONSTANT, LINEAR and QUADRATIC, with the cut off
+//     angles of a spot light.
+//   step SECONDS
+//   solver direct|simd|barneshut|fmm|pm
+//   integrator euler|leapfrog|verlet|yoshida4|block
+//   broadphase allpairs|hash|sap
+//   contacts islands|pairwise
+//   ccd on|off
+//   softening LENGTH
+//   theta ANGLE
+//   units si|scene|LENGTH MASS
+//     Settings, the same as the headless options of those names. A setting that isn't
+//     given is left to whoever runs the scene.
+//
+// The binary form holds the bodies as columns, the same way a checkpoint does, and the
+// lights, settings and models as a block of the text form. It loads at the speed of
+// mapping the file. The text form is split into pieces that are parsed on every thread
+// of a pool at once: each piece counts its bodies first, so each knows where its bodies
+// go, and then fills them straight into the columns.
+
+#define SCENE_MAGIC "GRAVSCNE"// First eight bytes of a binary scene
+#define SCENE_VERSION 1// Bumped whenever the binary layout changes
+#define SCENE_DOUBLES 10// Columns of doubles in a binary scene
+#define SCENE_COLUMNS 11// Those and the flags
+#define SCENE_PIECE_BYTES (1 << 20)// Smallest piece of a text scene worth parsing on a thread of its own
+#define SCENE_PIECES_PER_THREAD 4// Pieces to split a text scene into for every thread, so uneven pieces even out
+
+// Kinds of light, the same numbers the shader uses
+#define SCENE_LIGHT_POINT 0
+#define SCENE_LIGHT_DIRECTIONAL 1
+#define SCENE_LIGHT_SPOT 2
+
+// What the units setting says
+#define SCENE_UNITS_UNSET 0// Not given
+#define SCENE_UNITS_SI 1// Metres, kilograms and seconds
+#define SCENE_UNITS_SCENE 2// Picked from the bodies (see UnitSystem::ForScene)
+#define SCENE_UNITS_FIXED 3// unitLength and unitMass, with G = 1
+
+struct SceneLight
+{
+    int type = SCENE_LIGHT_POINT;
+    Vec3 location;
+    Vec3 direction;
+    Vec3 colour = Vec3(1, 1, 1);
+    double constant = 1;
+    double linear = 0;
+    double quadratic = 0;
+    double cutOff = 12.5;
+    double outerCutOff = 17.5;
+};
+
+// Settings a scene can give, each left unset if it doesn't
+struct SceneSettings
+{
+    double step = 0;// Seconds, 0 if not given
+    std::string solver;// Empty if not given
+    std::string integrator;
+    std::string broadPhase;
+    int contacts = -1;// CONTACTS_ISLANDS or CONTACTS_PAIRWISE, -1 if not given
+    int continuous = -1;// 1 to sweep drifts, 0 not to, -1 if not given
+    double softening = -1;// Negative if not given
+    double theta = -1;
+    int units = SCENE_UNITS_UNSET;
+    double unitLength = 1, unitMass = 1;// When units is SCENE_UNITS_FIXED
+};
+
+// The model one body is drawn with
+struct SceneMesh
+{
+    int body;
+    std::string path;
+};
+
+struct Scene
+{
+    SceneSettings settings;
+    std::vector<SceneLight> lights;
+    BodyStore bodies;
+    std::vector<SceneMesh> meshes;// Only for the bodies given one, in the order given
+};
+
+// Create the gravity solver, integrator or broad phase a scene names, with the defaults for the rest
+// The names have been checked when the scene was read.
+inline GravitySolver *MakeSceneSolver (const SceneSettings &settings)
+{
+    double theta = settings.theta > 0 ? settings.theta : 0.5;
+    if (settings.solver == "direct") return new DirectGravity();
+    if (settings.solver == "barneshut") return new BarnesHutGravity(theta);
+    if (settings.solver == "fmm") return new FastMultipoleGravity(6, theta);
+    if (settings.solver == "pm") return new ParticleMeshGravity();
+    return new SimdDirectGravity(std::max(settings.softening, 0.0));
+}
+
+inline Integrator *MakeSceneIntegrator (const SceneSettings &settings)
+{
+    if (settings.integrator == "euler") return new EulerIntegrator();
+    if (settings.integrator == "verlet") return new VerletIntegrator();
+    if (settings.integrator == "yoshida4") return new YoshidaIntegrator();
+    if (settings.integrator == "block") return new BlockTimestepIntegrator();
+    return new LeapfrogIntegrator();
+}
+
+inline BroadPhase *MakeSceneBroadPhase (const SceneSettings &settings)
+{
+    if (settings.broadPhase == "allpairs") return new AllPairsBroadPhase();
+    if (settings.broadPhase == "sap") return new SweepAndPruneBroadPhase();
+    return new SpatialHashBroadPhase();
+}
+
+// Set the engine up the way the scene says, leaving anything it doesn't say alone
+// Call once the scene's bodies are in the engine, scene units are picked from them.
+inline void ConfigureEngine (Engine &engine, const SceneSettings &settings)
+{
+    if (!settings.solver.empty() || settings.softening >= 0 || settings.theta > 0) engine.SetGravitySolver(MakeSceneSolver(settings));
+    if (!settings.integrator.empty()) engine.SetIntegrator(MakeSceneIntegrator(settings));
+    if (!settings.broadPhase.empty()) engine.SetBroadPhase(MakeSceneBroadPhase(settings));
+    if (settings.contacts >= 0) engine.contactScheme = settings.contacts;
+    if (settings.continuous >= 0) engine.continuous = settings.continuous != 0;
+    if (settings.units == SCENE_UNITS_SI) engine.useUnits = false;
+    if (settings.units == SCENE_UNITS_SCENE) engine.SetSceneUnits();
+    if (settings.units == SCENE_UNITS_FIXED) engine.SetUnits(UnitSystem::For(settings.unitLength, settings.unitMass, GRAVITATIONAL_CONSTANT));
+}
+
+// Reads the words of one line of a text scene
+class SceneLine
+{
+public:
+    SceneLine (const char *begin, const char *end): p(begin), end(end)
+    {
+        // Comments and line endings aren't part of the line
+        const char *hash = (const char *)memchr(begin, '#', end - begin);
+        if (hash != NULL) this->end = hash;
+        while (this->end > p && (this->end[-1] == '\r' || this->end[-1] == ' ' || this->end[-1] == '\t')) this->end--;
+    }
+
+    // The next word, empty at the end of the line
+    std::string Word ()
+    {
+        Skip();
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != '\t') p++;
+        return std::string(start, p);
+    }
+
+    // Whether the next word is word, and if so move past it
+    bool Is (const char *word)
+    {
+        Skip();
+        size_t n = strlen(word);
+        if (size_t(end - p) < n || memcmp(p, word, n) != 0) return false;
+        if (p + n < end && p[n] != ' ' && p[n] != '\t') return false;
+        p += n;
+        return true;
+    }
+
+    // Returns false if the next word isn't a number
+    bool Number (double &value)
+    {
+        Skip();
+        if (p < end && *p == '+') p++;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || (result.ptr < end && *result.ptr != ' ' && *result.ptr != '\t')) return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // Everything left on the line
+    std::string Rest ()
+    {
+        Skip();
+        const char *start = p;
+        p = end;
+        return std::string(start, end);
+    }
+
+    bool Done ()
+    {
+        Skip();
+        return p == end;
+    }
+
+private:
+    const char *p, *end;
+
+    void Skip ()
+    {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+    }
+};
+
+// Whether a line starts a body, looking no further than its first word
+inline bool IsBodyLine (const char *line, const char *end)
+{
+    while (line < end && (*line == ' ' || *line == '\t')) line++;
+    size_t left = end - line;
+    return left >= 6 && (memcmp(line, "sphere", 6) == 0 || memcmp(line, "domain", 6) == 0)
+        && (left == 6 || line[6] == ' ' || line[6] == '\t' || line[6] == '\r' || line[6] == '#');
+}
+
+// Parse a body line into body i of s, and its model into mesh
+// Returns false with the reason in error if it isn't one.
+inline bool ParseBody (SceneLine &line, BodyStore &s, int i, std::string &mesh, std::string &error)
+{
+    unsigned char flags = BODY_COLLISION;
+    if (line.Is("sphere")) flags |= BODY_SPHERE;
+    else line.Is("domain");
+
+    double values[10];
+    for (double &value : values)
+    {
+        if (!line.Number(value))
+        {
+            error = "a body needs ten numbers: location, velocity, radius, mass (as a digit and an exponent) and elasticity";
+            return false;
+        }
+    }
+    s.x[i] = values[0];
+    s.y[i] = values[1];
+    s.z[i] = values[2];
+    s.vx[i] = s.oldVx[i] = values[3];
+    s.vy[i] = s.oldVy[i] = values[4];
+    s.vz[i] = s.oldVz[i] = values[5];
+    s.radius[i] = values[6];
+    s.massNum[i] = values[7];
+    s.massExp[i] = values[8];
+    s.mass[i] = values[7]*pow(10, values[8]);
+    s.elasticity[i] = values[9];
+
+    while (!line.Done())
+    {
+        if (line.Is("hidden")) flags |= BODY_HIDDEN;
+        else if (line.Is("ghost")) flags &= ~BODY_COLLISION;
+        else if (line.Is("mesh"))
+        {
+            mesh = line.Rest();
+            if (mesh.empty())
+            {
+                error = "mesh needs a path";
+                return false;
+            }
+        }
+        else
+        {
+            error = "unknown word " + line.Word() + " after a body";
+            return false;
+        }
+    }
+    s.flags[i] = flags;
+    return true;
+}
+
+// Parse any line but a body into the scene, bodies being how many bodies there are
+inline bool ParseSceneLine (SceneLine &line, Scene &scene, int bodies, std::string &error)
+{
+    SceneSettings &settings = scene.settings;
+    std::string word = line.Word();
+    bool ok = true;
+    if (word == "step") ok = line.Number(settings.step) && settings.step > 0;
+    else if (word == "softening") ok = line.Number(settings.softening) && settings.softening >= 0;
+    else if (word == "theta") ok = line.Number(settings.theta) && settings.theta > 0;
+    else if (word == "solver")
+    {
+        settings.solver = line.Word();
+        ok = settings.solver == "direct" || settings.solver == "simd" || settings.solver == "barneshut"
+            || settings.solver == "fmm" || settings.solver == "pm";
+    }
+    else if (word == "integrator")
+    {
+        settings.integrator = line.Word();
+        ok = settings.integrator == "euler" || settings.integrator == "leapfrog" || settings.integrator == "verlet"
+            || settings.integrator == "yoshida4" || settings.integrator == "block";
+    }
+    else if (word == "broadphase")
+    {
+        settings.broadPhase = line.Word();
+        ok = settings.broadPhase == "allpairs" || settings.broadPhase == "hash" || settings.broadPhase == "sap";
+    }
+    else if (word == "contacts")
+    {
+        if (line.Is("islands")) settings.contacts = CONTACTS_ISLANDS;
+        else if (line.Is("pairwise")) settings.contacts = CONTACTS_PAIRWISE;
+        else ok = false;
+    }
+    else if (word == "ccd")
+    {
+        if (line.Is("on")) settings.continuous = 1;
+        else if (line.Is("off")) settings.continuous = 0;
+        else ok = false;
+    }
+    else if (word == "units")
+    {
+        if (line.Is("si")) settings.units = SCENE_UNITS_SI;
+        else if (line.Is("scene")) settings.units = SCENE_UNITS_SCENE;
+        else
+        {
+            settings.units = SCENE_UNITS_FIXED;
+            ok = line.Number(settings.unitLength) && line.Number(settings.unitMass) && settings.unitLength > 0 && settings.unitMass > 0;
+        }
+    }
+    else if (word == "light")
+    {
+        SceneLight light;
+        if (line.Is("point")) light.type = SCENE_LIGHT_POINT;
+        else if (line.Is("directional")) light.type = SCENE_LIGHT_DIRECTIONAL;
+        else if (line.Is("spot")) light.type = SCENE_LIGHT_SPOT;
+        else ok = false;
+        double *values[14] = {&light.location.x, &light.location.y, &light.location.z, &light.direction.x, &light.direction.y,
+                              &light.direction.z, &light.colour.x, &light.colour.y, &light.colour.z, &light.constant,
+                              &light.linear, &light.quadratic, &light.cutOff, &light.outerCutOff};
+        for (double *value : values) ok = ok && line.Number(*value);
+        if (ok) scene.lights.push_back(light);
+    }
+    else if (word == "mesh")
+    {
+        double body;
+        SceneMesh mesh;
+        ok = line.Number(body) && body >= 0 && body < bodies && body == floor(body);
+        mesh.body = int(body);
+        mesh.path = line.Rest();
+        ok = ok && !mesh.path.empty();
+        if (ok) scene.meshes.push_back(mesh);
+    }
+    else
+    {
+        error = "unknown line " + word;
+        return false;
+    }
+    if (!ok || !line.Done())
+    {
+        error = "can't make sense of " + word;
+        return false;
+    }
+    return true;
+}
+
+// Parse the text form of a scene, from begin to end, on the pool's threads
+// columnBodies is how many bodies the binary form holds besides, for the models given them.
+inline bool ParseScene (const char *begin, const char *end, Scene &scene, std::string &error, ThreadPool *pool, int columnBodies = 0)
+{
+    // A piece of the text, parsed by one thread
+    struct Piece
+    {
+        const char *begin, *end;
+        int lines = 0;// Lines in the piece
+        int bodies = 0;// Body lines in the piece
+        int firstLine = 0, firstBody = 0;// Numbers of the piece's first line and first body in the whole scene
+        std::vector<std::pair<const char *, int>> others;// Every other line that isn't blank, with its line number in the piece
+        std::vector<SceneMesh> meshes;// Models given on body lines
+        std::string error;// Why the first bad line in the piece is bad
+        int errorLine = -1;
+    };
+
+    // Split the text where lines end, into pieces of roughly equal size
+    int threads = pool != NULL ? pool->Size() : 1;
+    size_t bytes = end - begin;
+    int count = int(std::max<size_t>(1, std::min<size_t>(size_t(threads)*SCENE_PIECES_PER_THREAD, bytes/SCENE_PIECE_BYTES)));
+    std::vector<Piece> pieces(count);
+    const char *at = begin;
+    for (int k = 0; k < count; k++)
+    {
+        const char *split = k + 1 == count ? end : begin + bytes*(k + 1)/count;
+        if (split < at) split = at;
+        const char *newline = split < end ? (const char *)memchr(split, '\n', end - split) : NULL;
+        if (k + 1 < count) split = newline != NULL ? newline + 1 : end;
+        pieces[k].begin = at;
+        pieces[k].end = split;
+        at = split;
+    }
+
+    // Walk the lines of a piece, calling line(start, finish, number in the piece) for each
+    auto walk = [](const Piece &piece, auto &&line)
+    {
+        int number = 0;
+        for (const char *p = piece.begin; p < piece.end; number++)
+        {
+            const char *next = (const char *)memchr(p, '\n', piece.end - p);
+            const char *finish = next != NULL ? next : piece.end;
+            if (!line(p, finish, number)) return;
+            p = finish + 1;
+        }
+    };
+
+    // Count the bodies of every piece, and find the lines that aren't bodies
+    ParallelFor(pool, count, [&](int first, int last)
+    {
+        for (int k = first; k < last; k++)
+        {
+            Piece &piece = pieces[k];
+            walk(piece, [&](const char *p, const char *finish, int number)
+            {
+                piece.lines = number + 1;
+                if (IsBodyLine(p, finish)) piece.bodies++;
+                else if (!SceneLine(p, finish).Done()) piece.others.push_back(std::make_pair(p, number));
+                return true;
+            });
+        }
+    });
+
+    // Each piece's bodies follow the last piece's
+    int bodies = 0, lines = 0;
+    for (Piece &piece : pieces)
+    {
+        piece.firstBody = bodies;
+        piece.firstLine = lines;
+        bodies += piece.bodies;
+        lines += piece.lines;
+    }
+    BodyStore &s = scene.bodies;
+    s.Clear();
+    s.Resize(bodies);
+
+    // Fill the bodies in, every piece straight into its own part of the columns
+    ParallelFor(pool, count, [&](int first, int last)
+    {
+        for (int k = first; k < last; k++)
+        {
+            Piece &piece = pieces[k];
+            int i = piece.firstBody;
+            walk(piece, [&](const char *p, const char *finish, int number)
+            {
+                if (!IsBodyLine(p, finish)) return true;
+                SceneLine line(p, finish);
+                SceneMesh mesh;
+                mesh.body = i;
+                if (!ParseBody(line, s, i, mesh.path, piece.error))
+                {
+                    piece.errorLine = number;
+                    return false;
+                }
+                if (!mesh.path.empty()) piece.meshes.push_back(mesh);
+                i++;
+                return true;
+            });
+        }
+    });
+
+    // Everything else, in the order it was written
+    scene.meshes.clear();
+    scene.lights.clear();
+    scene.settings = SceneSettings();
+    for (Piece &piece : pieces)
+    {
+        if (piece.errorLine >= 0)
+        {
+            error = "line " + std::to_string(piece.firstLine + piece.errorLine + 1) + ": " + piece.error;
+            return false;
+        }
+        scene.meshes.insert(scene.meshes.end(), piece.meshes.begin(), piece.meshes.end());
+    }
+    for (Piece &piece : pieces)
+    {
+        for (std::pair<const char *, int> other : piece.others)
+        {
+            const char *finish = (const char *)memchr(other.first, '\n', piece.end - other.first);
+            SceneLine line(other.first, finish != NULL ? finish : piece.end);
+            if (!ParseSceneLine(line, scene, bodies + columnBodies, error))
+            {
+                error = "line " + std::to_string(piece.firstLine + other.second + 1) + ": " + error;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Append a number to text, written so it reads back exactly
+inline void PutSceneNumber (std::string &text, double value)
+{
+    char buffer[32];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    text += ' ';
+    text.append(buffer, result.ptr);
+}
+
+// Everything in the text form of a scene but its bodies, and the models given them if withMeshes
+inline std::string SceneSettingsText (const Scene &scene, bool withMeshes)
+{
+    const SceneSettings &settings = scene.settings;
+    std::string text;
+    if (settings.step > 0)
+    {
+        text += "step";
+        PutSceneNumber(text, settings.step);
+        text += '\n';
+    }
+    if (!settings.solver.empty()) text += "solver " + settings.solver + "\n";
+    if (!settings.integrator.empty()) text += "integrator " + settings.integrator + "\n";
+    if (!settings.broadPhase.empty()) text += "broadphase " + settings.broadPhase + "\n";
+    if (settings.contacts >= 0) text += settings.contacts == CONTACTS_PAIRWISE ? "contacts pairwise\n" : "contacts islands\n";
+    if (settings.continuous >= 0) text += settings.continuous ? "ccd on\n" : "ccd off\n";
+    if (settings.softening >= 0)
+    {
+        text += "softening";
+        PutSceneNumber(text, settings.softening);
+        text += '\n';
+    }
+    if (settings.theta > 0)
+    {
+        text += "theta";
+        PutSceneNumber(text, settings.theta);
+        text += '\n';
+    }
+    if (settings.units == SCENE_UNITS_SI) text += "units si\n";
+    if (settings.units == SCENE_UNITS_SCENE) text += "units scene\n";
+    if (settings.units == SCENE_UNITS_FIXED)
+    {
+        text += "units";
+        PutSceneNumber(text, settings.unitLength);
+        PutSceneNumber(text, settings.unitMass);
+        text += '\n';
+    }
+
+    const char *types[3] = {"point", "directional", "spot"};
+    for (const SceneLight &light : scene.lights)
+    {
+        text += "light ";
+        text += types[std::max(0, std::min(light.type, 2))];
+        double values[14] = {light.location.x, light.location.y, light.location.z, light.direction.x, light.direction.y,
+                             light.direction.z, light.colour.x, light.colour.y, light.colour.z, light.constant,
+                             light.linear, light.quadratic, light.cutOff, light.outerCutOff};
+        for (double value : values) PutSceneNumber(text, value);
+        text += '\n';
+    }
+    if (withMeshes)
+    {
+        for (const SceneMesh &mesh : scene.meshes) text += "mesh " + std::to_string(mesh.body) + " " + mesh.path + "\n";
+    }
+    return text;
+}
+
+struct SceneHeader
+{
+    char magic[8];// SCENE_MAGIC
+    uint32_t version;// SCENE_VERSION
+    uint32_t byteOrder;// CHECKPOINT_BYTE_ORDER
+    uint64_t headerSize;// sizeof(SceneHeader)
+    uint64_t fileSize;// Bytes in the whole file
+    uint64_t bodies;// Bodies in every column
+    uint64_t textOffset, textBytes;// Where the lights, settings and models are, in the text form
+    uint64_t textSum;// Checksum of them
+    uint64_t offset[SCENE_COLUMNS];// Where each column starts
+    uint64_t sum[SCENE_COLUMNS];// Checksum of each column
+    uint64_t headerSum;// Checksum of everything above
+};
+
+// The double columns of a binary scene, in the order they are in the file
+inline std::array<const std::vector<double> *, SCENE_DOUBLES> SceneColumns (const BodyStore &s)
+{
+    return {&s.x, &s.y, &s.z, &s.vx, &s.vy, &s.vz, &s.radius, &s.massNum, &s.massExp, &s.elasticity};
+}
+
+inline std::array<std::vector<double> *, SCENE_DOUBLES> SceneColumns (BodyStore &s)
+{
+    return {&s.x, &s.y, &s.z, &s.vx, &s.vy, &s.vz, &s.radius, &s.massNum, &s.massExp, &s.elasticity};
+}
+
+// Write the scene to path, as text or in the binary form
+inline bool WriteScene (const std::string &path, const Scene &scene, bool binary, std::string &error)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        error = "can't write " + path;
+        return false;
+    }
+    const BodyStore &s = scene.bodies;
+    std::string settings = SceneSettingsText(scene, binary);
+    bool ok = true;
+
+    if (binary)
+    {
+        SceneHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SCENE_MAGIC, 8);
+        header.version = SCENE_VERSION;
+        header.byteOrder = CHECKPOINT_BYTE_ORDER;
+        header.headerSize = sizeof(SceneHeader);
+        header.bodies = s.Size();
+        header.textOffset = sizeof(SceneHeader);
+        header.textBytes = settings.size();
+        header.textSum = CheckpointSum(settings.data(), settings.size());
+        std::array<const std::vector<double> *, SCENE_DOUBLES> columns = SceneColumns(s);
+        uint64_t at = CheckpointAlign(header.textOffset + header.textBytes);
+        for (int c = 0; c < SCENE_DOUBLES; c++)
+        {
+            header.offset[c] = at;
+            header.sum[c] = CheckpointSum(columns[c]->data(), columns[c]->size()*sizeof(double));
+            at = CheckpointAlign(at + columns[c]->size()*sizeof(double));
+        }
+        header.offset[SCENE_DOUBLES] = at;
+        header.sum[SCENE_DOUBLES] = CheckpointSum(s.flags.data(), s.flags.size());
+        header.fileSize = at + s.flags.size();
+        header.headerSum = CheckpointSum(&header, offsetof(SceneHeader, headerSum));
+
+        PaddedWriter writer(file);
+        writer.Put(&header, sizeof(header), header.textOffset);
+        writer.Put(settings.data(), settings.size(), header.offset[0]);
+        for (int c = 0; c < SCENE_DOUBLES; c++) writer.Put(columns[c]->data(), columns[c]->size()*sizeof(double), header.offset[c + 1]);
+        writer.Put(s.flags.data(), s.flags.size(), header.fileSize);
+        ok = writer.ok;
+    }
+    else
+    {
+        ok = fwrite(settings.data(), 1, settings.size(), file) == settings.size();
+
+        // Models are written on the lines of their bodies instead
+        std::vector<const std::string *> meshes(s.Size(), NULL);
+        for (const SceneMesh &mesh : scene.meshes) meshes[mesh.body] = &mesh.path;
+        std::string text;
+        for (int i = 0; i < s.Size() && ok; i++)
+        {
+            text += s.IsSphere(i) ? "sphere" : "domain";
+            double values[10] = {s.x[i], s.y[i], s.z[i], s.vx[i], s.vy[i], s.vz[i], s.radius[i], s.massNum[i], s.massExp[i], s.elasticity[i]};
+            for (double value : values) PutSceneNumber(text, value);
+            if (s.Hidden(i)) text += " hidden";
+            if (!s.Collides(i)) text += " ghost";
+            if (meshes[i] != NULL) text += " mesh " + *meshes[i];
+            text += '\n';
+            if (text.size() >= SCENE_PIECE_BYTES || i + 1 == s.Size())
+            {
+                ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+                text.clear();
+            }
+        }
+    }
+
+    ok = fclose(file) == 0 && ok;
+    if (!ok) error = "couldn't finish writing " + path;
+    return ok;
+}
+
+// Read the scene in path, in either form, parsing text on the pool's threads
+// Returns false with the reason in error if it can't be read. Every body is marked as changed.
+inline bool ReadScene (const std::string &path, Scene &scene, std::string &error, ThreadPool *pool = NULL)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "can't read " + path;
+        return false;
+    }
+    const char *data = (const char *)file.Data();
+    if (file.Size() < 8 || memcmp(data, SCENE_MAGIC, 8) != 0)
+    {
+        if (!ParseScene(data, data + file.Size(), scene, error, pool))
+        {
+            error = path + " " + error;
+            return false;
+        }
+        return true;
+    }
+
+    SceneHeader header;
+    if (file.Size() < sizeof(header))
+    {
+        error = path + " is too short to be a scene";
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.byteOrder != CHECKPOINT_BYTE_ORDER)
+    {
+        error = path + " was written on a machine of the other byte order";
+        return false;
+    }
+    if (header.version != SCENE_VERSION || header.headerSize != sizeof(header))
+    {
+        error = path + " is a scene of a different version";
+        return false;
+    }
+    if (header.headerSum != CheckpointSum(&header, offsetof(SceneHeader, headerSum)) || header.fileSize != file.Size())
+    {
+        error = path + " is damaged or cut short";
+        return false;
+    }
+
+    // Check every block fits and is intact before using any of it
+    uint64_t n = header.bodies;
+    bool fits = header.textOffset <= file.Size() && header.textBytes <= file.Size() - header.textOffset
+        && CheckpointSum(data + header.textOffset, header.textBytes) == header.textSum;
+    for (int c = 0; c < SCENE_COLUMNS && fits; c++)
+    {
+        uint64_t bytes = c < SCENE_DOUBLES ? n*sizeof(double) : n;
+        fits = header.offset[c] % sizeof(double) == 0 && header.offset[c] <= file.Size() && bytes <= file.Size() - header.offset[c]
+            && CheckpointSum(data + header.offset[c], bytes) == header.sum[c];
+    }
+    if (!fits || n > uint64_t(INT32_MAX))
+    {
+        error = path + " has a damaged block";
+        return false;
+    }
+
+    // The lights, settings and models first, since they need to know how many bodies there are
+    Scene settings;
+    if (!ParseScene(data + header.textOffset, data + header.textOffset + header.textBytes, settings, error, NULL, int(n)))
+    {
+        error = path + " " + error;
+        return false;
+    }
+    scene.settings = settings.settings;
+    scene.lights = settings.lights;
+    scene.meshes = settings.meshes;
+
+    BodyStore &s = scene.bodies;
+    s.Clear();
+    s.Resize(int(n));
+    std::array<std::vector<double> *, SCENE_DOUBLES> columns = SceneColumns(s);
+    ParallelFor(pool, SCENE_COLUMNS, [&](int first, int last)
+    {
+        for (int c = first; c < last; c++)
+        {
+            if (c < SCENE_DOUBLES) memcpy(columns[c]->data(), data + header.offset[c], n*sizeof(double));
+            else memcpy(s.flags.data(), data + header.offset[c], n);
+        }
+    });
+    for (uint64_t i = 0; i < n; i++)
+    {
+        s.oldVx[i] = s.vx[i];
+        s.oldVy[i] = s.vy[i];
+        s.oldVz[i] = s.vz[i];
+        s.mass[i] = s.massNum[i]*pow(10, s.massExp[i]);
+    }
+    return true;
+}
+
+#endif // SCENE_H_INCLUDED
@@ -0,0 +1,527 @@
+#ifndef SIMD_H_INCLUDED
+#define SIMD_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "gravity.h"
+#include "parallel.h"
+
+// Direct summation, done quickly
+// Every pair of bodies is still visited, but only once: the pull of j on i and of i on j
+// are worked out together (Newton's third law). The active bodies are copied into packed
+// arrays so the inner loop can run over several bodies at once with AVX2 or AVX-512, and
+// the pairs are worked through in tiles small enough to stay in cache. Pairs of tiles are
+// shared out over the engine's threads, each adding into its own copy of the sums.
+//
+// The instruction set is picked when the program runs, so one build works on any x86-64
+// machine. Other compilers and processors get the plain loop.
+//
+// Plummer softening replaces r^2 with r^2 + softening^2, so close bodies don't fling each
+// other apart. With singlePrecision, positions and masses are kept as floats to halve the
+// memory traffic but every sum is still done in doubles. floatMath goes further and does
+// the pair arithmetic in floats too, twice as many lanes at once, keeping only the running
+// totals in doubles. That is only as accurate as floats allow, so it's meant for engines
+// working in scene units (units.h), where every number is near 1.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+#define SIMD_SCALAR 0// Plain C++
+#define SIMD_AVX2 1// 4 doubles at a time, with fused multiply add
+#define SIMD_AVX512 2// 8 doubles at a time
+
+#define SIMD_TILE 512// Bodies in each tile of the pair loop
+
+// Best instruction set this processor has
+inline int DetectSimd ()
+{
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+#endif
+    return SIMD_SCALAR;
+}
+
+// Packed copy of the active bodies
+template <class Real>
+struct PackedBodies
+{
+    std::vector<Real> x, y, z, m;
+    int n = 0;
+
+    void Pack (const BodyStore &s, const std::vector<int> &active)
+    {
+        n = int(active.size());
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        m.resize(n);
+        for (int k = 0; k < n; k++)
+        {
+            int i = active[k];
+            x[k] = Real(s.x[i]);
+            y[k] = Real(s.y[i]);
+            z[k] = Real(s.z[i]);
+            m[k] = Real(s.mass[i]);
+        }
+    }
+};
+
+// Where one thread adds up accelerations, indexed like the packed bodies
+struct PackedSums
+{
+    double *x, *y, *z;
+};
+
+// Pull between body i and bodies [begin, end), added to both sides
+// Used for the tails the vector loops leave over, and for everything on the scalar path.
+// Every kernel is compiled with and without softening (Soft), so exact gravity doesn't
+// carry the extra add.
+template <class Real, bool Soft>
+inline void PairsScalar (const PackedBodies<Real> &p, PackedSums a, int i, int begin, int end, double eps2)
+{
+    double xi = p.x[i], yi = p.y[i], zi = p.z[i], mi = p.m[i];
+    double ax = 0, ay = 0, az = 0;
+    for (int j = begin; j < end; j++)
+    {
+        double dx = p.x[j] - xi;
+        double dy = p.y[j] - yi;
+        double dz = p.z[j] - zi;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        if (Soft) r2 += eps2;
+        double k = 1/(r2*sqrt(r2));
+        double kj = k*p.m[j];
+        ax += dx*kj;
+        ay += dy*kj;
+        az += dz*kj;
+        double ki = k*mi;
+        a.x[j] -= dx*ki;
+        a.y[j] -= dy*ki;
+        a.z[j] -= dz*ki;
+    }
+    a.x[i] += ax;
+    a.y[i] += ay;
+    a.z[i] += az;
+}
+
+// As PairsScalar, but with the arithmetic in floats
+template <bool Soft>
+inline void PairsScalarFloat (const PackedBodies<float> &p, PackedSums a, int i, int begin, int end, double eps2)
+{
+    float xi = p.x[i], yi = p.y[i], zi = p.z[i], mi = p.m[i], soft = float(eps2);
+    float ax = 0, ay = 0, az = 0;
+    for (int j = begin; j < end; j++)
+    {
+        float dx = p.x[j] - xi;
+        float dy = p.y[j] - yi;
+        float dz = p.z[j] - zi;
+        float r2 = dx*dx + dy*dy + dz*dz;
+        if (Soft) r2 += soft;
+        float k = 1/(r2*sqrtf(r2));
+        float kj = k*p.m[j];
+        ax += dx*kj;
+        ay += dy*kj;
+        az += dz*kj;
+        float ki = k*mi;
+        a.x[j] -= dx*ki;
+        a.y[j] -= dy*ki;
+        a.z[j] -= dz*ki;
+    }
+    a.x[i] += ax;
+    a.y[i] += ay;
+    a.z[i] += az;
+}
+
+#if SIMD_X86
+
+// GCC 12's intrinsic headers start some results from a deliberately undefined register,
+// which -Wall reports as uninitialized once they're inlined here
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// Four values from either storage type, as doubles
+__attribute__((target("avx2,fma"), always_inline)) inline __m256d Load4 (const double *v) { return _mm256_loadu_pd(v); }
+__attribute__((target("avx2,fma"), always_inline)) inline __m256d Load4 (const float *v) { return _mm256_cvtps_pd(_mm_loadu_ps(v)); }
+
+// 1/r^3 from r^2
+// Dividing and taking square roots are the slowest instructions in the loop, so start from
+// the processor's single precision estimate of 1/sqrt and refine it with Newton's method.
+// Each step squares the relative error: 12 bits becomes 24, then 48.
+__attribute__((target("avx2,fma"), always_inline)) inline __m256d InverseCube4 (__m256d r2)
+{
+    __m256d half = _mm256_set1_pd(0.5), threeHalves = _mm256_set1_pd(1.5);
+    __m256d y = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+    __m256d halfR2 = _mm256_mul_pd(half, r2);
+    y = _mm256_mul_pd(y, _mm256_fnmadd_pd(halfR2, _mm256_mul_pd(y, y), threeHalves));
+    y = _mm256_mul_pd(y, _mm256_fnmadd_pd(halfR2, _mm256_mul_pd(y, y), threeHalves));
+    return _mm256_mul_pd(y, _mm256_mul_pd(y, y));
+}
+
+template <class Real, bool Soft>
+__attribute__((target("avx2,fma"))) void PairsAvx2 (const PackedBodies<Real> &p, PackedSums a, int i, int begin, int end, double eps2)
+{
+    __m256d xi = _mm256_set1_pd(p.x[i]), yi = _mm256_set1_pd(p.y[i]), zi = _mm256_set1_pd(p.z[i]);
+    __m256d mi = _mm256_set1_pd(p.m[i]), soft = _mm256_set1_pd(eps2);
+    __m256d ax = _mm256_setzero_pd(), ay = _mm256_setzero_pd(), az = _mm256_setzero_pd();
+    int j = begin;
+    for (; j + 4 <= end; j += 4)
+    {
+        __m256d dx = _mm256_sub_pd(Load4(&p.x[j]), xi);
+        __m256d dy = _mm256_sub_pd(Load4(&p.y[j]), yi);
+        __m256d dz = _mm256_sub_pd(Load4(&p.z[j]), zi);
+        __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, Soft ? _mm256_fmadd_pd(dz, dz, soft) : _mm256_mul_pd(dz, dz)));
+        __m256d k = InverseCube4(r2);
+        __m256d kj = _mm256_mul_pd(k, Load4(&p.m[j]));
+        ax = _mm256_fmadd_pd(dx, kj, ax);
+        ay = _mm256_fmadd_pd(dy, kj, ay);
+        az = _mm256_fmadd_pd(dz, kj, az);
+        __m256d ki = _mm256_mul_pd(k, mi);
+        _mm256_storeu_pd(&a.x[j], _mm256_fnmadd_pd(dx, ki, _mm256_loadu_pd(&a.x[j])));
+        _mm256_storeu_pd(&a.y[j], _mm256_fnmadd_pd(dy, ki, _mm256_loadu_pd(&a.y[j])));
+        _mm256_storeu_pd(&a.z[j], _mm256_fnmadd_pd(dz, ki, _mm256_loadu_pd(&a.z[j])));
+    }
+
+    double sum[3][4];
+    _mm256_storeu_pd(sum[0], ax);
+    _mm256_storeu_pd(sum[1], ay);
+    _mm256_storeu_pd(sum[2], az);
+    a.x[i] += sum[0][0] + sum[0][1] + sum[0][2] + sum[0][3];
+    a.y[i] += sum[1][0] + sum[1][1] + sum[1][2] + sum[1][3];
+    a.z[i] += sum[2][0] + sum[2][1] + sum[2][2] + sum[2][3];
+    PairsScalar<Real, Soft>(p, a, i, j, end, eps2);
+}
+
+// 1/r^3 from r^2 in floats: the 12 bit estimate and one Newton step is as good as floats get
+__attribute__((target("avx2,fma"), always_inline)) inline __m256 InverseCube8f (__m256 r2)
+{
+    __m256 y = _mm256_rsqrt_ps(r2);
+    y = _mm256_mul_ps(y, _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), r2), _mm256_mul_ps(y, y), _mm256_set1_ps(1.5f)));
+    return _mm256_mul_ps(y, _mm256_mul_ps(y, y));
+}
+
+// Take eight float contributions away from eight double sums
+__attribute__((target("avx2,fma"), always_inline)) inline void Subtract8 (double *sum, __m256 v)
+{
+    _mm256_storeu_pd(sum, _mm256_sub_pd(_mm256_loadu_pd(sum), _mm256_cvtps_pd(_mm256_castps256_ps128(v))));
+    _mm256_storeu_pd(sum + 4, _mm256_sub_pd(_mm256_loadu_pd(sum + 4), _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1))));
+}
+
+template <bool Soft>
+__attribute__((target("avx2,fma"))) void PairsAvx2Float (const PackedBodies<float> &p, PackedSums a, int i, int begin, int end, double eps2)
+{
+    __m256 xi = _mm256_set1_ps(p.x[i]), yi = _mm256_set1_ps(p.y[i]), zi = _mm256_set1_ps(p.z[i]);
+    __m256 mi = _mm256_set1_ps(p.m[i]), soft = _mm256_set1_ps(float(eps2));
+    __m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+    int j = begin;
+    for (; j + 8 <= end; j += 8)
+    {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&p.x[j]), xi);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&p.y[j]), yi);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&p.z[j]), zi);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, Soft ? _mm256_fmadd_ps(dz, dz, soft) : _mm256_mul_ps(dz, dz)));
+        __m256 k = InverseCube8f(r2);
+        __m256 kj = _mm256_mul_ps(k, _mm256_loadu_ps(&p.m[j]));
+        ax = _mm256_fmadd_ps(dx, kj, ax);
+        ay = _mm256_fmadd_ps(dy, kj, ay);
+        az = _mm256_fmadd_ps(dz, kj, az);
+        __m256 ki = _mm256_mul_ps(k, mi);
+        Subtract8(&a.x[j], _mm256_mul_ps(dx, ki));
+        Subtract8(&a.y[j], _mm256_mul_ps(dy, ki));
+        Subtract8(&a.z[j], _mm256_mul_ps(dz, ki));
+    }
+
+    float sum[3][8];
+    _mm256_storeu_ps(sum[0], ax);
+    _mm256_storeu_ps(sum[1], ay);
+    _mm256_storeu_ps(sum[2], az);
+    for (int l = 0; l < 8; l++)
+    {
+        a.x[i] += sum[0][l];
+        a.y[i] += sum[1][l];
+        a.z[i] += sum[2][l];
+    }
+    PairsScalarFloat<Soft>(p, a, i, j, end, eps2);
+}
+
+// Eight values from either storage type, as doubles
+__attribute__((target("avx512f"), always_inline)) inline __m512d Load8 (const double *v) { return _mm512_loadu_pd(v); }
+__attribute__((target("avx512f"), always_inline)) inline __m512d Load8 (const float *v) { return _mm512_cvtps_pd(_mm256_loadu_ps(v)); }
+
+// 1/r^3 from r^2, as above but from a 14 bit estimate
+__attribute__((target("avx512f"), always_inline)) inline __m512d InverseCube8 (__m512d r2)
+{
+    __m512d half = _mm512_set1_pd(0.5), threeHalves = _mm512_set1_pd(1.5);
+    __m512d y = _mm512_rsqrt14_pd(r2);
+    __m512d halfR2 = _mm512_mul_pd(half, r2);
+    y = _mm512_mul_pd(y, _mm512_fnmadd_pd(halfR2, _mm512_mul_pd(y, y), threeHalves));
+    y = _mm512_mul_pd(y, _mm512_fnmadd_pd(halfR2, _mm512_mul_pd(y, y), threeHalves));
+    return _mm512_mul_pd(y, _mm512_mul_pd(y, y));
+}
+
+template <class Real, bool Soft>
+__attribute__((target("avx512f"))) void PairsAvx512 (const PackedBodies<Real> &p, PackedSums a, int i, int begin, int end, double eps2)
+{
+    __m512d xi = _mm512_set1_pd(p.x[i]), yi = _mm512_set1_pd(p.y[i]), zi = _mm512_set1_pd(p.z[i]);
+    __m512d mi = _mm512_set1_pd(p.m[i]), soft = _mm512_set1_pd(eps2);
+    __m512d ax = _mm512_setzero_pd(), ay = _mm512_setzero_pd(), az = _mm512_setzero_pd();
+    int j = begin;
+    for (; j + 8 <= end; j += 8)
+    {
+        __m512d dx = _mm512_sub_pd(Load8(&p.x[j]), xi);
+        __m512d dy = _mm512_sub_pd(Load8(&p.y[j]), yi);
+        __m512d dz = _mm512_sub_pd(Load8(&p.z[j]), zi);
+        __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, Soft ? _mm512_fmadd_pd(dz, dz, soft) : _mm512_mul_pd(dz, dz)));
+        __m512d k = InverseCube8(r2);
+        __m512d kj = _mm512_mul_pd(k, Load8(&p.m[j]));
+        ax = _mm512_fmadd_pd(dx, kj, ax);
+        ay = _mm512_fmadd_pd(dy, kj, ay);
+        az = _mm512_fmadd_pd(dz, kj, az);
+        __m512d ki = _mm512_mul_pd(k, mi);
+        _mm512_storeu_pd(&a.x[j], _mm512_fnmadd_pd(dx, ki, _mm512_loadu_pd(&a.x[j])));
+        _mm512_storeu_pd(&a.y[j], _mm512_fnmadd_pd(dy, ki, _mm512_loadu_pd(&a.y[j])));
+        _mm512_storeu_pd(&a.z[j], _mm512_fnmadd_pd(dz, ki, _mm512_loadu_pd(&a.z[j])));
+    }
+
+    a.x[i] += _mm512_reduce_add_pd(ax);
+    a.y[i] += _mm512_reduce_add_pd(ay);
+    a.z[i] += _mm512_reduce_add_pd(az);
+    PairsScalar<Real, Soft>(p, a, i, j, end, eps2);
+}
+
+// 1/r^3 from r^2 in floats, from a 14 bit estimate
+__attribute__((target("avx512f"), always_inline)) inline __m512 InverseCube16f (__m512 r2)
+{
+    __m512 y = _mm512_rsqrt14_ps(r2);
+    y = _mm512_mul_ps(y, _mm512_fnmadd_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), r2), _mm512_mul_ps(y, y), _mm512_set1_ps(1.5f)));
+    return _mm512_mul_ps(y, _mm512_mul_ps(y, y));
+}
+
+// Take sixteen float contributions away from sixteen double sums
+__attribute__((target("avx512f"), always_inline)) inline void Subtract16 (double *sum, __m512 v)
+{
+    __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+    _mm512_storeu_pd(sum, _mm512_sub_pd(_mm512_loadu_pd(sum), _mm512_cvtps_pd(_mm512_castps512_ps256(v))));
+    _mm512_storeu_pd(sum + 8, _mm512_sub_pd(_mm512_loadu_pd(sum + 8), _mm512_cvtps_pd(high)));
+}
+
+template <bool Soft>
+__attribute__((target("avx512f"))) void PairsAvx512Float (const PackedBodies<float> &p, PackedSums a, int i, int begin, int end, double eps2)
+{
+    __m512 xi = _mm512_set1_ps(p.x[i]), yi = _mm512_set1_ps(p.y[i]), zi = _mm512_set1_ps(p.z[i]);
+    __m512 mi = _mm512_set1_ps(p.m[i]), soft = _mm512_set1_ps(float(eps2));
+    __m512 ax = _mm512_setzero_ps(), ay = _mm512_setzero_ps(), az = _mm512_setzero_ps();
+    int j = begin;
+    for (; j + 16 <= end; j += 16)
+    {
+        __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&p.x[j]), xi);
+        __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&p.y[j]), yi);
+        __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(&p.z[j]), zi);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, Soft ? _mm512_fmadd_ps(dz, dz, soft) : _mm512_mul_ps(dz, dz)));
+        __m512 k = InverseCube16f(r2);
+        __m512 kj = _mm512_mul_ps(k, _mm512_loadu_ps(&p.m[j]));
+        ax = _mm512_fmadd_ps(dx, kj, ax);
+        ay = _mm512_fmadd_ps(dy, kj, ay);
+        az = _mm512_fmadd_ps(dz, kj, az);
+        __m512 ki = _mm512_mul_ps(k, mi);
+        Subtract16(&a.x[j], _mm512_mul_ps(dx, ki));
+        Subtract16(&a.y[j], _mm512_mul_ps(dy, ki));
+        Subtract16(&a.z[j], _mm512_mul_ps(dz, ki));
+    }
+
+    a.x[i] += _mm512_reduce_add_ps(ax);
+    a.y[i] += _mm512_reduce_add_ps(ay);
+    a.z[i] += _mm512_reduce_add_ps(az);
+    PairsScalarFloat<Soft>(p, a, i, j, end, eps2);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // SIMD_X86
+
+// Direct summation over each pair once, vectorized where the processor allows
+class SimdDirectGravity : public GravitySolver
+{
+public:
+    double softening = 0;// Plummer softening length in metres, 0 for exact Newtonian gravity
+    bool singlePrecision = false;// Store positions and masses as floats
+    bool floatMath = false;// With singlePrecision, do the pair arithmetic in floats as well
+    int simd = DetectSimd();// SIMD_SCALAR, SIMD_AVX2 or SIMD_AVX512, lower it to force a slower path
+
+    SimdDirectGravity (double softening = 0, bool singlePrecision = false):
+        softening(softening), singlePrecision(singlePrecision) {}
+
+    void ComputeAccelerations (const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc)
+    {
+        if (singlePrecision) Compute(floats, s, active, G, acc);
+        else Compute(doubles, s, active, G, acc);
+    }
+
+    // Only the targets, pulled by every active body
+    // Each pair is seen from one side only, so this is a plain loop over the sources per target.
+    void ComputeAccelerationsOn (const BodyStore &s, const std::vector<int> &active, const std::vector<int> &targets,
+                                 double G, Accelerations &acc)
+    {
+        if (singlePrecision) ComputeOn(floats, s, active, targets, G, acc);
+        else ComputeOn(doubles, s, active, targets, G, acc);
+    }
+
+    void SetLengthUnit (double metres)
+    {
+        lengthUnit = metres;
+    }
+
+    const char *Name () const
+    {
+        if (singlePrecision && floatMath)
+        {
+            if (simd == SIMD_AVX512) return "direct-avx512-floatmath";
+            if (simd == SIMD_AVX2) return "direct-avx2-floatmath";
+            return "direct-scalar-floatmath";
+        }
+        if (simd == SIMD_AVX512) return singlePrecision ? "direct-avx512-float" : "direct-avx512";
+        if (simd == SIMD_AVX2) return singlePrecision ? "direct-avx2-float" : "direct-avx2";
+        return singlePrecision ? "direct-scalar-float" : "direct-scalar";
+    }
+
+private:
+    double lengthUnit = 1;// Metres in one unit of the positions being given
+    PackedBodies<double> doubles;
+    PackedBodies<float> floats;
+    std::vector<double> sums;// x, y and z sums of every body for each thread, one after the other
+    std::vector<int> tilePairs;// First tile and second tile of every pair of tiles, flattened
+
+    template <class Real>
+    using PairsKernel = void (*)(const PackedBodies<Real> &, PackedSums, int, int, int, double);
+
+    template <class Real>
+    void Compute (PackedBodies<Real> &p, const BodyStore &s, const std::vector<int> &active, double G, Accelerations &acc)
+    {
+        p.Pack(s, active);
+        int n = p.n;
+        double eps2 = (softening/lengthUnit)*(softening/lengthUnit);
+        PairsKernel<Real> pairs = softening != 0 ? Kernel<Real, true>(Real()) : Kernel<Real, false>(Real());
+
+        // Each thread adds into its own sums, since both bodies of a pair are written
+        int threads = pool == NULL ? 1 : pool->Size();
+        sums.assign(size_t(threads)*3*n, 0);
+
+        // Tiles of i against tiles of j at or after them, so both tiles stay in cache
+        // With several threads the tiles shrink until there are enough pairs to share out.
+        int tile = SIMD_TILE;
+        while (tile > 64 && n/tile < 4*threads) tile /= 2;
+        int tiles = (n + tile - 1)/tile;
+        tilePairs.clear();
+        for (int ti = 0; ti < tiles; ti++)
+        {
+            for (int tj = ti; tj < tiles; tj++)
+            {
+                tilePairs.push_back(ti);
+                tilePairs.push_back(tj);
+            }
+        }
+
+        ParallelFor(pool, int(tilePairs.size()/2), [&](int first, int last)
+        {
+            double *base = &sums[size_t(CurrentWorker(pool))*3*n];
+            PackedSums sum = {base, base + n, base + 2*n};
+            for (int t = first; t < last; t++)
+            {
+                int ti = tilePairs[2*t]*tile, tj = tilePairs[2*t + 1]*tile;
+                int tiEnd = std::min(n, ti + tile), tjEnd = std::min(n, tj + tile);
+                for (int i = ti; i < tiEnd; i++)
+                {
+                    // Inside the diagonal tile only the pairs after i are left
+                    int begin = tj == ti ? i + 1 : tj;
+                    pairs(p, sum, i, begin, tjEnd, eps2);
+                }
+            }
+        });
+
+        ParallelFor(pool, n, [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                double ax = 0, ay = 0, az = 0;
+                for (int t = 0; t < threads; t++)
+                {
+                    const double *base = &sums[size_t(t)*3*n];
+                    ax += base[k];
+                    ay += base[n + k];
+                    az += base[2*n + k];
+                }
+                int i = active[k];
+                acc.x[i] = G*ax;
+                acc.y[i] = G*ay;
+                acc.z[i] = G*az;
+            }
+        }, 4096);
+    }
+
+    template <class Real>
+    void ComputeOn (PackedBodies<Real> &p, const BodyStore &s, const std::vector<int> &active, const std::vector<int> &targets,
+                    double G, Accelerations &acc)
+    {
+        p.Pack(s, active);
+        double eps2 = (softening/lengthUnit)*(softening/lengthUnit);
+        ParallelFor(pool, int(targets.size()), [&](int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                int i = targets[k];
+                // Rounded the same way as the packed copy, so the target lines up with itself
+                double xi = Real(s.x[i]), yi = Real(s.y[i]), zi = Real(s.z[i]);
+                double ax = 0, ay = 0, az = 0;
+                for (int j = 0; j < p.n; j++)
+                {
+                    double dx = p.x[j] - xi;
+                    double dy = p.y[j] - yi;
+                    double dz = p.z[j] - zi;
+                    double r2 = dx*dx + dy*dy + dz*dz;
+                    // The target itself
+                    if (r2 == 0) continue;
+                    r2 += eps2;
+                    double kj = p.m[j]/(r2*sqrt(r2));
+                    ax += dx*kj;
+                    ay += dy*kj;
+                    az += dz*kj;
+                }
+                acc.x[i] = G*ax;
+                acc.y[i] = G*ay;
+                acc.z[i] = G*az;
+            }
+        }, 16);
+    }
+
+    // The kernel for this instruction set and storage type, picked once per solve rather than per body
+    // The argument is only there to pick between doing the arithmetic in doubles (this one)
+    // and, for floats, possibly in floats (the next).
+    template <class Real, bool Soft>
+    PairsKernel<Real> Kernel (double) const
+    {
+#if SIMD_X86
+        if (simd == SIMD_AVX512) return &PairsAvx512<Real, Soft>;
+        if (simd == SIMD_AVX2) return &PairsAvx2<Real, Soft>;
+#endif
+        return &PairsScalar<Real, Soft>;
+    }
+
+    template <class Real, bool Soft>
+    PairsKernel<float> Kernel (float) const
+    {
+        if (!floatMath) return Kernel<float, Soft>(0.0);
+#if SIMD_X86
+        if (simd == SIMD_AVX512) return &PairsAvx512Float<Soft>;
+        if (simd == SIMD_AVX2) return &PairsAvx2Float<Soft>;
+#endif
+        return &PairsScalarFloat<Soft>;
+    }
+};
+
+#endif // SIMD_H_INCLUDED
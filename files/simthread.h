@@ -0,0 +1,407 @@
+#ifndef SIMTHREAD_H_INCLUDED
+#define SIMTHREAD_H_INCLUDED
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "bodies.h"
+#include "engine.h"
+#include "trajectory.h"
+
+// Running the engine on its own thread
+// The window used to step the engine once per frame, so the simulation ran at the frame rate
+// and a slow frame held the physics up. A SimThread steps the engine on a thread of its own,
+// and after every batch of steps copies what the renderer needs into a snapshot.
+// Snapshots are handed over through a triple buffer, so neither side ever waits for the
+// other: the simulation always has a spare slot to write into, and the renderer always has
+// the newest finished snapshot to draw.
+//
+// Edits go the other way through a queue of commands, which the simulation applies between
+// steps. Only the thread that owns the SimThread may send commands or read snapshots.
+
+#define SIM_COMMANDS 256// Commands that can be waiting at once, more are refused until the simulation catches up
+#define SIM_STEP 0.01// Seconds every step advances the simulation by, unless another step is chosen
+#define SIM_MAX_SUBSTEPS 32// Most steps taken at once to catch up with the clock, the rest of the time is dropped
+#define SIM_LONGEST_SLEEP 0.001// Longest the thread sleeps for at a time, so edits are made soon after they're sent
+
+// Fields a command can set, the same ones a BodyHandle can
+#define COMMAND_X 0
+#define COMMAND_Y 1
+#define COMMAND_Z 2
+#define COMMAND_VX 3
+#define COMMAND_VY 4
+#define COMMAND_VZ 5
+#define COMMAND_MASS_NUM 6
+#define COMMAND_MASS_EXP 7
+#define COMMAND_RADIUS 8
+#define COMMAND_ELASTICITY 9
+#define COMMAND_HIDDEN 10// value is 1 to hide the body, 0 to show it
+
+// One edit to one body
+struct Command
+{
+    int body;// Index in the BodyStore
+    int field;// COMMAND_ constant
+    double value;
+};
+
+// Carry out a command through a handle, so the engine sees what changed
+inline void ApplyCommand (BodyStore &s, const Command &command)
+{
+    if (command.body < 0 || command.body >= s.Size()) return;
+    BodyHandle body = s.Handle(command.body);
+    switch (command.field)
+    {
+        case COMMAND_X: body.SetX(command.value); break;
+        case COMMAND_Y: body.SetY(command.value); break;
+        case COMMAND_Z: body.SetZ(command.value); break;
+        case COMMAND_VX: body.SetVx(command.value); break;
+        case COMMAND_VY: body.SetVy(command.value); break;
+        case COMMAND_VZ: body.SetVz(command.value); break;
+        case COMMAND_MASS_NUM: body.SetMassNum(command.value); break;
+        case COMMAND_MASS_EXP: body.SetMassExp(command.value); break;
+        case COMMAND_RADIUS: body.SetRadius(command.value); break;
+        case COMMAND_ELASTICITY: body.SetElasticity(command.value); break;
+        case COMMAND_HIDDEN: body.SetHidden(command.value != 0); break;
+    }
+}
+
+// Queue of commands from one thread to one other
+// A fixed ring: the sender only moves head and the receiver only moves tail, so both finish
+// in a few instructions whatever the other is doing.
+class CommandQueue
+{
+public:
+    // Returns false if the queue is full
+    bool Push (const Command &command)
+    {
+        unsigned long long h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == SIM_COMMANDS) return false;
+        ring[h % SIM_COMMANDS] = command;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool Pop (Command &command)
+    {
+        unsigned long long t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        command = ring[t % SIM_COMMANDS];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    Command ring[SIM_COMMANDS];
+    // Kept on separate cache lines so the two threads don't fight over one
+    alignas(64) std::atomic<unsigned long long> head{0};// Next place to write
+    alignas(64) std::atomic<unsigned long long> tail{0};// Next place to read
+};
+
+// Three copies of something written by one thread and read by another
+// The writer fills the back copy and swaps it with the middle one; the reader swaps its
+// front copy with the middle one whenever the middle is newer. The swaps are single atomic
+// exchanges, so nobody waits and the copy being written or read is never touched by the other.
+template <class T>
+class TripleBuffer
+{
+public:
+    // Set every copy the same way, before either thread has started using the buffer
+    // The middle copy counts as published.
+    template <class Fill>
+    void Reset (const Fill &fill)
+    {
+        for (T &slot : slots) fill(slot);
+        back = 0;
+        front = 1;
+        middle.store(2 | FRESH, std::memory_order_release);
+    }
+
+    // The copy the writer fills
+    T &Back ()
+    {
+        return slots[back];
+    }
+
+    // Hand the back copy over to the reader
+    void Publish ()
+    {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & SLOT;
+    }
+
+    // Take the newest published copy, if there is one the reader hasn't seen
+    // Returns whether the front copy changed.
+    bool Update ()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & SLOT;
+        return true;
+    }
+
+    // The copy the reader has
+    const T &Front () const
+    {
+        return slots[front];
+    }
+
+private:
+    static const int SLOT = 3;// Bits of middle holding the slot
+    static const int FRESH = 4;// Set in middle when it was published after the reader last looked
+
+    T slots[3];
+    int back = 0;// Only used by the writer
+    int front = 1;// Only used by the reader
+    std::atomic<int> middle{2};
+};
+
+// What the renderer needs from one moment of the simulation
+struct Snapshot
+{
+    BodyStore bodies;
+    std::vector<int> visible;// Bodies to draw
+    // Locations one step before, so drawing can blend between the two
+    std::vector<double> lastX, lastY, lastZ;
+    double time = 0;// Simulated seconds
+    unsigned long long steps = 0;// Steps taken
+    double stepSize = 0;// Seconds between the last locations and these
+    double lag = 0;// Simulated seconds the clock had already moved past time when this was taken
+    double timeWarp = 0;// Simulated seconds per second of the clock, 0 if the simulation isn't following it
+    std::chrono::steady_clock::time_point taken;// When this was taken
+
+    // Remember the locations before a step, reusing the memory from last time
+    void Remember (const Engine &engine)
+    {
+        lastX = engine.bodies.x;
+        lastY = engine.bodies.y;
+        lastZ = engine.bodies.z;
+    }
+
+    // Copy the engine, reusing the memory from the last time this snapshot was taken
+    void Take (const Engine &engine)
+    {
+        bodies = engine.bodies;
+        visible = engine.visible;
+        time = engine.time;
+        steps = engine.steps;
+        taken = std::chrono::steady_clock::now();
+    }
+
+    // How far from the last locations to these to draw now, from 0 to 1
+    // Drawing runs a step behind the simulation, so the bodies move smoothly whatever the
+    // frame rate rather than jumping a whole step at a time.
+    double Blend () const
+    {
+        if (timeWarp <= 0 || stepSize <= 0) return 1;
+        double since = std::chrono::duration<double>(std::chrono::steady_clock::now() - taken).count();
+        return std::min((lag + since*timeWarp)/stepSize, 1.0);
+    }
+
+    // Location of body i, blend of the way from its last location
+    Vec3 Location (int i, double blend) const
+    {
+        return Vec3(lastX[i] + (bodies.x[i] - lastX[i])*blend, lastY[i] + (bodies.y[i] - lastY[i])*blend,
+                    lastZ[i] + (bodies.z[i] - lastZ[i])*blend);
+    }
+};
+
+// Steps the engine on a thread of its own
+// Every step is stepSize long, however long frames take, so a run always comes out the
+// same. The thread keeps count of how far the clock (sped up by the time warp) has moved
+// ahead of the simulation and takes as many steps as that covers. A machine too slow to
+// keep up drops the time it can't cover, rather than falling further and further behind.
+class SimThread
+{
+public:
+    // Seconds every step advances by, set before Start
+    double stepSize = SIM_STEP;
+    // Steps to stop at, as if paused, or 0 to carry on until stopped
+    unsigned long long stepLimit = 0;
+    // If set before Start, the engine as it starts and then every recordEvery steps is recorded to it
+    // Recording drops frames rather than waiting, so it never holds the steps up.
+    TrajectoryWriter *recorder = NULL;
+    // Steps between recorded frames, or 0 to record the step after every snapshot the
+    // renderer takes, so a recording has about as many frames as were drawn
+    unsigned long long recordEvery = 0;
+
+    SimThread (Engine &engine): engine(engine) {}
+
+    ~SimThread ()
+    {
+        Stop();
+    }
+
+    SimThread (const SimThread &) = delete;
+    SimThread &operator= (const SimThread &) = delete;
+
+    // Start stepping, with a first snapshot ready before this returns
+    void Start ()
+    {
+        if (thread.joinable()) return;
+        // Every copy is sized now, so taking snapshots doesn't allocate
+        engine.UpdateLists();
+        snapshots.Reset([this](Snapshot &snapshot)
+        {
+            snapshot.Remember(engine);
+            snapshot.Take(engine);
+        });
+        stopping = false;
+        recordedFrame = framesTaken.load(std::memory_order_relaxed);
+        if (recorder != NULL) recorder->Record(engine);
+        thread = std::thread([this]() { Run(); });
+    }
+
+    // Finish the step in progress and stop; the engine can be used directly again afterwards
+    void Stop ()
+    {
+        if (!thread.joinable()) return;
+        stopping = true;
+        thread.join();
+        // Anything sent after the last step still gets made
+        ApplyCommands();
+    }
+
+    // Pause or carry on the simulation, edits are still made while paused
+    void SetRunning (bool run)
+    {
+        running = run;
+    }
+
+    // Simulated seconds to cover every second of the clock, or 0 to step as fast as possible
+    void SetTimeWarp (double warp)
+    {
+        timeWarp = warp;
+    }
+
+    // Ask for an edit, returns false if too many are waiting already
+    bool Send (const Command &command)
+    {
+        return commands.Push(command);
+    }
+
+    // The newest snapshot, valid until the next call
+    const Snapshot &Latest ()
+    {
+        if (snapshots.Update()) framesTaken.fetch_add(1, std::memory_order_relaxed);
+        return snapshots.Front();
+    }
+
+    // Steps taken by the thread so far
+    unsigned long long Steps () const
+    {
+        return stepsTaken.load(std::memory_order_relaxed);
+    }
+
+    // Simulated seconds dropped because the thread couldn't keep up with the time warp
+    double Dropped () const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    Engine &engine;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> running{true};
+    std::atomic<double> timeWarp{1};
+    std::atomic<unsigned long long> stepsTaken{0};
+    std::atomic<double> dropped{0};
+    std::atomic<unsigned long long> framesTaken{0};// Snapshots the renderer has taken
+    unsigned long long recordedFrame = 0;// framesTaken when the last frame was recorded, only used by the thread
+    CommandQueue commands;
+    TripleBuffer<Snapshot> snapshots;
+
+    // Make every edit waiting, returns whether there were any
+    bool ApplyCommands ()
+    {
+        Command command;
+        bool any = false;
+        while (commands.Pop(command))
+        {
+            ApplyCommand(engine.bodies, command);
+            any = true;
+        }
+        return any;
+    }
+
+    // Whether the step just taken is one to record
+    bool RecordDue ()
+    {
+        if (recordEvery > 0) return engine.steps % recordEvery == 0;
+        unsigned long long taken = framesTaken.load(std::memory_order_relaxed);
+        if (taken == recordedFrame) return false;
+        recordedFrame = taken;
+        return true;
+    }
+
+    bool Finished () const
+    {
+        return stepLimit != 0 && stepsTaken.load(std::memory_order_relaxed) >= stepLimit;
+    }
+
+    void Run ()
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point last = Clock::now();
+        double behind = 0;// Simulated seconds the clock is ahead of the engine
+        while (!stopping)
+        {
+            bool edited = ApplyCommands();
+
+            Clock::time_point now = Clock::now();
+            double elapsed = std::chrono::duration<double>(now - last).count();
+            last = now;
+            double warp = timeWarp.load(std::memory_order_relaxed);
+
+            // Steps due now
+            int due = 0;
+            if (!running || Finished()) behind = 0;
+            else if (warp <= 0) due = 1;
+            else
+            {
+                behind += elapsed*warp;
+                due = int(std::min(behind/stepSize, double(SIM_MAX_SUBSTEPS)));
+            }
+
+            if (due == 0 && !edited)
+            {
+                // Wake up for the next step, or soon enough to make edits while paused
+                double wait = warp > 0 && running ? (stepSize - behind)/warp : SIM_LONGEST_SLEEP;
+                std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait, SIM_LONGEST_SLEEP)));
+                continue;
+            }
+
+            Snapshot &next = snapshots.Back();
+            if (due == 0)
+            {
+                // Paused, only the edits need showing and there's nothing to blend from
+                engine.UpdateLists();
+                next.Remember(engine);
+            }
+            for (int k = 0; k < due && !Finished(); k++)
+            {
+                if (k == due - 1) next.Remember(engine);
+                engine.Step(stepSize);
+                if (recorder != NULL && RecordDue()) recorder->Record(engine);
+                stepsTaken.fetch_add(1, std::memory_order_relaxed);
+                if (warp > 0) behind -= stepSize;
+            }
+            // Too far behind to catch up in one go, give up on the rest
+            if (behind >= stepSize)
+            {
+                dropped.store(dropped.load(std::memory_order_relaxed) + behind, std::memory_order_relaxed);
+                behind = 0;
+            }
+
+            next.Take(engine);
+            next.stepSize = stepSize;
+            next.lag = due > 0 ? behind : 0;
+            next.timeWarp = running ? warp : 0;
+            snapshots.Publish();
+        }
+    }
+};
+
+#endif // SIMTHREAD_H_INCLUDED
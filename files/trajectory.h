@@ -0,0 +1,713 @@
+#ifndef TRAJECTORY_H_INCLUDED
+#define TRAJECTORY_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "bodies.h"
+#include "engine.h"
+#include "checkpoint.h"
+
+// Trajectory files: every body's path through a run, frame by frame
+//
+// The step loop hands each frame to a TrajectoryWriter, which copies the columns asked for
+// into a free slot of a fixed ring and returns. A thread of the writer's own, woken by every
+// frame, encodes the frames and writes them out. When the ring is full the frame is dropped and counted, so
+// recording never holds the simulation up, however slow the disk is.
+//
+// The file is the header, then chunks of up to chunkFrames frames, then an index of where
+// every chunk starts. Each chunk stands on its own, so a reader can seek to any chunk through
+// the index and only decode from there. A file whose writer never closed it has no index,
+// and readers find the chunks by walking them from the front instead.
+//
+// Frames are stored either raw, as the doubles the engine holds, or delta encoded: every
+// value is rounded to a multiple of a quantum (a micrometre for positions by default) and
+// stored as the change from the frame before, as a variable length integer. Bodies move
+// little between frames, so most changes fit in one or two bytes rather than eight.
+// The first frame of every chunk is stored as the change from zero.
+
+#define TRAJECTORY_MAGIC "GRAVTRAJ"// First eight bytes of every trajectory file
+#define TRAJECTORY_CHUNK_TAG 0x4b4e4843u// "CHNK" at the start of every chunk
+#define TRAJECTORY_VERSION 1// Bumped whenever the layout changes
+#define TRAJECTORY_QUEUE 8// Frames that can be waiting to be written, more are dropped
+#define TRAJECTORY_CHUNK_FRAMES 16// Frames in a chunk, unless another number is chosen
+#define TRAJECTORY_INDEX_RESERVE 4096// Chunks the index has room for before it has to grow
+#define TRAJECTORY_POSITION_QUANTUM 1e-6// Metres positions are rounded to when delta encoded
+#define TRAJECTORY_VELOCITY_QUANTUM 1e-9// Metres per second velocities are rounded to when delta encoded
+
+// What each frame holds
+#define TRAJECTORY_POSITIONS 1// x, y and z of every body
+#define TRAJECTORY_VELOCITIES 2// vx, vy and vz of every body
+#define TRAJECTORY_DIAGNOSTICS 4// Kinetic energy, momentum and the engine's counters
+
+// How frames are stored
+#define TRAJECTORY_RAW 0
+#define TRAJECTORY_DELTA 1
+
+struct TrajectoryHeader
+{
+    char magic[8];// TRAJECTORY_MAGIC
+    uint32_t version;// TRAJECTORY_VERSION
+    uint32_t byteOrder;// CHECKPOINT_BYTE_ORDER
+    uint64_t headerSize;// sizeof(TrajectoryHeader)
+    uint64_t bodies;// Bodies in every frame
+    uint32_t fields;// TRAJECTORY_ bits
+    uint32_t encoding;// TRAJECTORY_RAW or TRAJECTORY_DELTA
+    double positionQuantum, velocityQuantum;// What delta encoded values are multiples of
+    uint32_t chunkFrames;// Most frames in one chunk
+    uint32_t reserved;// Zero
+    uint64_t frames;// Frames in the file, filled in when it is closed
+    uint64_t chunks;// Chunks in the file and entries in the index, filled in when it is closed
+    uint64_t indexOffset;// Where the index starts, 0 if the file was never closed
+    uint64_t headerSum;// Checksum of everything above
+};
+
+struct TrajectoryChunk
+{
+    uint32_t tag;// TRAJECTORY_CHUNK_TAG
+    uint32_t frames;// Frames in this chunk
+    uint64_t firstFrame;// Number of its first frame in the file
+    double firstTime;// Simulated seconds at its first frame
+    uint64_t bytes;// Bytes of frames after this header
+    uint64_t sum;// Checksum of those bytes
+};
+
+// One entry of the index per chunk
+struct TrajectoryIndexEntry
+{
+    uint64_t firstFrame;
+    uint64_t offset;// Where the chunk's header starts
+    double firstTime;
+};
+
+// What the whole run looked like at one frame, worked out on the writer's thread
+struct TrajectoryDiagnostics
+{
+    double kinetic = 0;// Total kinetic energy
+    double px = 0, py = 0, pz = 0;// Total momentum
+    uint64_t impacts = 0;// The engine's count of impacts swept
+    uint64_t forceEvaluations = 0;// The engine's count of full force evaluations
+};
+
+// One frame, as recorded or read back
+// Only the columns of the fields being recorded are filled; mass is only kept while the
+// diagnostics are worked out, it isn't written.
+struct TrajectoryFrame
+{
+    double time = 0;
+    unsigned long long steps = 0;
+    TrajectoryDiagnostics diagnostics;
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> mass;
+
+    // Size the columns fields needs for n bodies, so filling them never allocates
+    // withMass is for frames being recorded, which need the velocities and masses to work the diagnostics out.
+    void Size (int n, int fields, bool withMass)
+    {
+        int positions = fields & TRAJECTORY_POSITIONS ? n : 0;
+        int velocities = (fields & TRAJECTORY_VELOCITIES) || (withMass && (fields & TRAJECTORY_DIAGNOSTICS)) ? n : 0;
+        x.resize(positions);
+        y.resize(positions);
+        z.resize(positions);
+        vx.resize(velocities);
+        vy.resize(velocities);
+        vz.resize(velocities);
+        mass.resize(withMass && (fields & TRAJECTORY_DIAGNOSTICS) ? n : 0);
+    }
+};
+
+// Signed integers are stored zigzagged (0, -1, 1, -2, ...) so small changes either way stay small
+inline void PutVarint (std::vector<unsigned char> &out, int64_t value)
+{
+    uint64_t v = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    while (v >= 0x80)
+    {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+// Returns false if the bytes run out before the number ends
+inline bool GetVarint (const unsigned char *&p, const unsigned char *end, int64_t &value)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end) return false;
+        unsigned char byte = *p++;
+        v |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            value = int64_t(v >> 1) ^ -int64_t(v & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// value as a whole number of quanta, kept well inside what an int64_t holds
+inline int64_t Quantize (double value, double perQuantum)
+{
+    double q = value*perQuantum;
+    const double limit = 4e18;
+    if (!(q > -limit)) q = -limit;// Also catches NaN
+    if (q > limit) q = limit;
+    return int64_t(llround(q));
+}
+
+inline void PutBytes (std::vector<unsigned char> &out, const void *data, size_t bytes)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    out.insert(out.end(), p, p + bytes);
+}
+
+class TrajectoryWriter
+{
+public:
+    // Used by Open; change them before calling it
+    double positionQuantum = TRAJECTORY_POSITION_QUANTUM;
+    double velocityQuantum = TRAJECTORY_VELOCITY_QUANTUM;
+    int chunkFrames = TRAJECTORY_CHUNK_FRAMES;
+
+    TrajectoryWriter () {}
+    TrajectoryWriter (const TrajectoryWriter &) = delete;
+    TrajectoryWriter &operator= (const TrajectoryWriter &) = delete;
+
+    ~TrajectoryWriter ()
+    {
+        Close();
+    }
+
+    // Start a trajectory of the given number of bodies in path, recording fields (TRAJECTORY_
+    // bits) stored as encoding, with up to queueFrames frames waiting to be written
+    // Returns false with the reason in error if the file can't be made.
+    bool Open (const std::string &path, int bodies, int fields, int encoding, std::string &error, int queueFrames = TRAJECTORY_QUEUE)
+    {
+        Close();
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+        {
+            error = "can't write " + path;
+            return false;
+        }
+        this->bodies = bodies;
+        this->fields = fields;
+        this->encoding = encoding;
+        chunkFrames = std::max(chunkFrames, 1);
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRAJECTORY_MAGIC, 8);
+        header.version = TRAJECTORY_VERSION;
+        header.byteOrder = CHECKPOINT_BYTE_ORDER;
+        header.headerSize = sizeof(TrajectoryHeader);
+        header.bodies = bodies;
+        header.fields = fields;
+        header.encoding = encoding;
+        header.positionQuantum = positionQuantum;
+        header.velocityQuantum = velocityQuantum;
+        header.chunkFrames = chunkFrames;
+        header.headerSum = CheckpointSum(&header, offsetof(TrajectoryHeader, headerSum));
+        if (fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            error = "can't write " + path;
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+        at = sizeof(header);
+
+        // Everything the thread and the ring need is made now, so recording doesn't allocate
+        slots.resize(std::max(queueFrames, 1));
+        for (TrajectoryFrame &slot : slots) slot.Size(bodies, fields, true);
+        int columns = (fields & TRAJECTORY_POSITIONS ? 3 : 0) + (fields & TRAJECTORY_VELOCITIES ? 3 : 0);
+        chunk.reserve(size_t(chunkFrames)*(sizeof(double) + sizeof(uint64_t) + sizeof(TrajectoryDiagnostics) + size_t(columns)*bodies*10));
+        last.assign(size_t(columns)*bodies, 0);
+        index.clear();
+        index.reserve(TRAJECTORY_INDEX_RESERVE);
+        chunkCount = 0;
+        frames = 0;
+        head.store(0);
+        tail.store(0);
+        bytes.store(sizeof(header));
+        failed.store(false);
+        closing.store(false);
+        recorded = 0;
+        dropped = 0;
+        this->error.clear();
+        thread = std::thread(&TrajectoryWriter::Run, this);
+        return true;
+    }
+
+    // Copy the engine's bodies into the ring to be written, or drop the frame and return
+    // false if the ring is full, the engine has a different number of bodies or writing failed
+    bool Record (const Engine &engine)
+    {
+        const BodyStore &s = engine.bodies;
+        if (file == NULL || failed.load(std::memory_order_relaxed) || s.Size() != bodies)
+        {
+            dropped++;
+            return false;
+        }
+        unsigned long long h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size())
+        {
+            dropped++;
+            return false;
+        }
+
+        TrajectoryFrame &frame = slots[h % slots.size()];
+        frame.time = engine.time;
+        frame.steps = engine.steps;
+        frame.diagnostics.impacts = engine.impacts;
+        frame.diagnostics.forceEvaluations = engine.forceEvaluations;
+        if (fields & TRAJECTORY_POSITIONS)
+        {
+            std::copy(s.x.begin(), s.x.end(), frame.x.begin());
+            std::copy(s.y.begin(), s.y.end(), frame.y.begin());
+            std::copy(s.z.begin(), s.z.end(), frame.z.begin());
+        }
+        if (fields & (TRAJECTORY_VELOCITIES | TRAJECTORY_DIAGNOSTICS))
+        {
+            std::copy(s.vx.begin(), s.vx.end(), frame.vx.begin());
+            std::copy(s.vy.begin(), s.vy.end(), frame.vy.begin());
+            std::copy(s.vz.begin(), s.vz.end(), frame.vz.begin());
+        }
+        if (fields & TRAJECTORY_DIAGNOSTICS) std::copy(s.mass.begin(), s.mass.end(), frame.mass.begin());
+
+        head.store(h + 1, std::memory_order_release);
+        Wake();
+        recorded++;
+        return true;
+    }
+
+    // Write out every frame still waiting, then the index, and close the file
+    // Returns false if anything couldn't be written, with the reason in Error().
+    bool Close ()
+    {
+        if (file == NULL) return error.empty();
+        closing.store(true, std::memory_order_release);
+        Wake();
+        thread.join();
+
+        if (!failed.load())
+        {
+            FlushChunk();
+            header.frames = frames;
+            header.chunks = chunkCount;
+            header.indexOffset = at;
+            header.headerSum = CheckpointSum(&header, offsetof(TrajectoryHeader, headerSum));
+            bool ok = index.empty() || fwrite(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file) == index.size();
+            bytes.fetch_add(index.size()*sizeof(TrajectoryIndexEntry));
+            ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+            if (!ok) Fail("couldn't finish the trajectory file");
+        }
+        bool ok = fclose(file) == 0 && !failed.load();
+        file = NULL;
+        return ok;
+    }
+
+    // Frames handed to Record and accepted, and ones it had to drop
+    unsigned long long Recorded () const { return recorded; }
+    unsigned long long Dropped () const { return dropped; }
+    // Frames the thread has written out so far
+    unsigned long long Written () const { return written.load(std::memory_order_relaxed); }
+    // Bytes in the file so far
+    unsigned long long Bytes () const { return bytes.load(std::memory_order_relaxed); }
+    // Why writing failed, once the thread has stopped
+    const std::string &Error () const { return error; }
+
+private:
+    FILE *file = NULL;
+    int bodies = 0, fields = 0, encoding = TRAJECTORY_RAW;
+    TrajectoryHeader header;
+    std::thread thread;
+
+    // The ring: the step loop only moves head and the writer thread only moves tail
+    std::vector<TrajectoryFrame> slots;
+    alignas(64) std::atomic<unsigned long long> head{0};// Next slot to fill
+    alignas(64) std::atomic<unsigned long long> tail{0};// Next slot to write
+    unsigned long long recorded = 0, dropped = 0;// Only used by the step loop
+
+    // Only used by the writer thread, or once it has stopped
+    std::vector<unsigned char> chunk;// Frames of the chunk being filled, encoded
+    TrajectoryChunk chunkHeader;
+    std::vector<int64_t> last;// Every value of the last frame, in quanta, for the deltas
+    std::vector<TrajectoryIndexEntry> index;
+    unsigned long long chunkCount = 0, frames = 0;
+    uint64_t at = 0;// Bytes written so far
+    std::string error;
+
+    std::atomic<unsigned long long> written{0};
+    std::atomic<unsigned long long> bytes{0};
+    std::atomic<bool> failed{false};
+    std::atomic<bool> closing{false};
+    std::mutex sleep;// Held by the writer thread while it checks for work before sleeping
+    std::condition_variable wake;
+
+    void Fail (const std::string &reason)
+    {
+        if (error.empty()) error = reason;
+        failed.store(true, std::memory_order_relaxed);
+    }
+
+    // Wake the writer thread for a new frame or to close
+    // Taking the lock, even for no time at all, means the thread is either still to check
+    // for work or already waiting, so the wake up can't fall between the two.
+    void Wake ()
+    {
+        {
+            std::lock_guard<std::mutex> hold(sleep);
+        }
+        wake.notify_one();
+    }
+
+    void Run ()
+    {
+        while (true)
+        {
+            unsigned long long t = tail.load(std::memory_order_relaxed);
+            if (t != head.load(std::memory_order_acquire))
+            {
+                if (!failed.load(std::memory_order_relaxed)) Encode(slots[t % slots.size()]);
+                tail.store(t + 1, std::memory_order_release);
+                continue;
+            }
+            // Only stop once the ring is empty, the step loop has stopped filling it by now
+            if (closing.load(std::memory_order_acquire)) return;
+            std::unique_lock<std::mutex> hold(sleep);
+            wake.wait(hold, [&]
+            {
+                return head.load(std::memory_order_acquire) != t || closing.load(std::memory_order_acquire);
+            });
+        }
+    }
+
+    // Add a frame to the chunk being filled, writing the chunk out once it is full
+    void Encode (TrajectoryFrame &frame)
+    {
+        if (chunk.empty())
+        {
+            chunkHeader.tag = TRAJECTORY_CHUNK_TAG;
+            chunkHeader.frames = 0;
+            chunkHeader.firstFrame = frames;
+            chunkHeader.firstTime = frame.time;
+            std::fill(last.begin(), last.end(), 0);
+        }
+        PutBytes(chunk, &frame.time, sizeof(double));
+        uint64_t steps = frame.steps;
+        PutBytes(chunk, &steps, sizeof(uint64_t));
+
+        if (fields & TRAJECTORY_DIAGNOSTICS)
+        {
+            TrajectoryDiagnostics &d = frame.diagnostics;
+            d.kinetic = d.px = d.py = d.pz = 0;
+            for (int i = 0; i < bodies; i++)
+            {
+                double m = frame.mass[i];
+                d.kinetic += 0.5*m*(frame.vx[i]*frame.vx[i] + frame.vy[i]*frame.vy[i] + frame.vz[i]*frame.vz[i]);
+                d.px += m*frame.vx[i];
+                d.py += m*frame.vy[i];
+                d.pz += m*frame.vz[i];
+            }
+            PutBytes(chunk, &d, sizeof(d));
+        }
+
+        int column = 0;
+        if (fields & TRAJECTORY_POSITIONS)
+        {
+            PutColumn(frame.x, positionQuantum, column++);
+            PutColumn(frame.y, positionQuantum, column++);
+            PutColumn(frame.z, positionQuantum, column++);
+        }
+        if (fields & TRAJECTORY_VELOCITIES)
+        {
+            PutColumn(frame.vx, velocityQuantum, column++);
+            PutColumn(frame.vy, velocityQuantum, column++);
+            PutColumn(frame.vz, velocityQuantum, column++);
+        }
+
+        chunkHeader.frames++;
+        frames++;
+        written.fetch_add(1, std::memory_order_relaxed);
+        if (int(chunkHeader.frames) == chunkFrames) FlushChunk();
+    }
+
+    void PutColumn (const std::vector<double> &values, double quantum, int column)
+    {
+        if (encoding == TRAJECTORY_RAW)
+        {
+            PutBytes(chunk, values.data(), values.size()*sizeof(double));
+            return;
+        }
+        int64_t *previous = last.data() + size_t(column)*bodies;
+        double perQuantum = 1/quantum;
+        for (int i = 0; i < bodies; i++)
+        {
+            int64_t q = Quantize(values[i], perQuantum);
+            PutVarint(chunk, q - previous[i]);
+            previous[i] = q;
+        }
+    }
+
+    // Write the chunk being filled, if it has any frames
+    void FlushChunk ()
+    {
+        if (chunk.empty() || failed.load(std::memory_order_relaxed)) return;
+        chunkHeader.bytes = chunk.size();
+        chunkHeader.sum = CheckpointSum(chunk.data(), chunk.size());
+        TrajectoryIndexEntry entry = {chunkHeader.firstFrame, at, chunkHeader.firstTime};
+        if (fwrite(&chunkHeader, sizeof(chunkHeader), 1, file) != 1 || fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size())
+        {
+            Fail("couldn't write a chunk of the trajectory");
+            return;
+        }
+        index.push_back(entry);
+        at += sizeof(chunkHeader) + chunk.size();
+        bytes.store(at, std::memory_order_relaxed);
+        chunkCount++;
+        chunk.clear();
+    }
+};
+
+// Reads frames back out of a trajectory file, mapped into memory rather than read in
+// Any frame can be asked for in any order. Reading the frame after the last one read only
+// decodes that frame; anything else decodes its chunk from the start, at most chunkFrames
+// frames, found through the index.
+class TrajectoryReader
+{
+public:
+    // Returns false with the reason in error if path isn't a trajectory this can read
+    bool Open (const std::string &path, std::string &error)
+    {
+        index.clear();
+        cursorChunk = -1;
+        if (!file.Open(path))
+        {
+            error = "can't read " + path;
+            return false;
+        }
+        if (file.Size() < sizeof(header))
+        {
+            error = path + " is too short to be a trajectory";
+            return false;
+        }
+        memcpy(&header, file.Data(), sizeof(header));
+        if (memcmp(header.magic, TRAJECTORY_MAGIC, 8) != 0)
+        {
+            error = path + " isn't a trajectory";
+            return false;
+        }
+        if (header.byteOrder != CHECKPOINT_BYTE_ORDER)
+        {
+            error = path + " was written on a machine of the other byte order";
+            return false;
+        }
+        if (header.version != TRAJECTORY_VERSION || header.headerSize != sizeof(header))
+        {
+            error = path + " is a trajectory of a different version";
+            return false;
+        }
+        if (header.headerSum != CheckpointSum(&header, offsetof(TrajectoryHeader, headerSum)))
+        {
+            error = path + " has a damaged header";
+            return false;
+        }
+        // Everything sized from the header is checked first, so nothing can be sized for what isn't there
+        if (header.bodies > uint64_t(INT32_MAX))
+        {
+            error = path + " has too many bodies";
+            return false;
+        }
+        if ((header.fields & ~uint32_t(TRAJECTORY_POSITIONS | TRAJECTORY_VELOCITIES | TRAJECTORY_DIAGNOSTICS)) != 0
+            || (header.encoding != TRAJECTORY_RAW && header.encoding != TRAJECTORY_DELTA))
+        {
+            error = path + " is stored in a way this version can't read";
+            return false;
+        }
+
+        if (header.indexOffset != 0 && header.indexOffset <= file.Size()
+            && header.chunks <= (file.Size() - header.indexOffset)/sizeof(TrajectoryIndexEntry))
+        {
+            const TrajectoryIndexEntry *entries = (const TrajectoryIndexEntry *)(file.Data() + header.indexOffset);
+            index.assign(entries, entries + header.chunks);
+            frameCount = header.frames;
+        }
+        else FindChunks();
+
+        int columns = (header.fields & TRAJECTORY_POSITIONS ? 3 : 0) + (header.fields & TRAJECTORY_VELOCITIES ? 3 : 0);
+        last.assign(size_t(columns)*header.bodies, 0);
+        return true;
+    }
+
+    unsigned long long Frames () const { return frameCount; }
+    int Bodies () const { return int(header.bodies); }
+    int Fields () const { return int(header.fields); }
+    int Encoding () const { return int(header.encoding); }
+
+    // The frame at or just before a simulated time, going by the index and then the frames of that chunk
+    unsigned long long FrameAt (double time)
+    {
+        if (index.empty()) return 0;
+        size_t c = std::upper_bound(index.begin(), index.end(), time,
+                                    [](double t, const TrajectoryIndexEntry &entry){ return t < entry.firstTime; }) - index.begin();
+        if (c > 0) c--;
+        unsigned long long first = index[c].firstFrame;
+        unsigned long long end = c + 1 < index.size() ? index[c + 1].firstFrame : frameCount;
+        unsigned long long found = first;
+        TrajectoryFrame frame;
+        for (unsigned long long f = first; f < end && Read(f, frame, false); f++)
+        {
+            if (frame.time > time) break;
+            found = f;
+        }
+        return found;
+    }
+
+    // Decode frame number f into frame, sizing its columns to the fields recorded
+    // Returns false if there is no such frame or its chunk is damaged.
+    bool Read (unsigned long long f, TrajectoryFrame &frame, bool columns = true)
+    {
+        if (f >= frameCount) return false;
+        int c = int(std::upper_bound(index.begin(), index.end(), f,
+                                     [](unsigned long long n, const TrajectoryIndexEntry &entry){ return n < entry.firstFrame; }) - index.begin()) - 1;
+        if (c < 0) return false;
+
+        // Carry on from the last frame read if that's in the same chunk and before this one
+        if (c != cursorChunk || f < cursorFrame)
+        {
+            if (!StartChunk(c)) return false;
+        }
+        if (columns) frame.Size(Bodies(), Fields(), false);
+        while (cursorFrame <= f)
+        {
+            if (!NextFrame(frame, columns && cursorFrame == f)) return false;
+        }
+        return true;
+    }
+
+private:
+    MappedFile file;
+    TrajectoryHeader header;
+    std::vector<TrajectoryIndexEntry> index;
+    unsigned long long frameCount = 0;
+
+    // Where decoding has got to
+    int cursorChunk = -1;
+    unsigned long long cursorFrame = 0;// Number of the next frame at cursor
+    const unsigned char *cursor = NULL, *chunkEnd = NULL;
+    std::vector<int64_t> last;// Every value of the frame before cursor, in quanta
+
+    // Rebuild the index of a file that was never closed, by walking its chunks from the front
+    // Stops at the first chunk that is cut short or damaged, which is where writing stopped.
+    void FindChunks ()
+    {
+        frameCount = 0;
+        uint64_t at = sizeof(header);
+        while (at + sizeof(TrajectoryChunk) <= file.Size())
+        {
+            TrajectoryChunk chunk;
+            memcpy(&chunk, file.Data() + at, sizeof(chunk));
+            uint64_t start = at + sizeof(chunk);
+            if (chunk.tag != TRAJECTORY_CHUNK_TAG || chunk.firstFrame != frameCount || chunk.bytes > file.Size() - start) break;
+            if (CheckpointSum(file.Data() + start, chunk.bytes) != chunk.sum) break;
+            TrajectoryIndexEntry entry = {chunk.firstFrame, at, chunk.firstTime};
+            index.push_back(entry);
+            frameCount += chunk.frames;
+            at = start + chunk.bytes;
+        }
+    }
+
+    bool StartChunk (int c)
+    {
+        cursorChunk = -1;
+        uint64_t at = index[c].offset;
+        if (at > file.Size() || sizeof(TrajectoryChunk) > file.Size() - at) return false;
+        TrajectoryChunk chunk;
+        memcpy(&chunk, file.Data() + at, sizeof(chunk));
+        uint64_t start = at + sizeof(chunk);
+        if (chunk.tag != TRAJECTORY_CHUNK_TAG || chunk.bytes > file.Size() - start) return false;
+        if (CheckpointSum(file.Data() + start, chunk.bytes) != chunk.sum) return false;
+        cursor = file.Data() + start;
+        chunkEnd = cursor + chunk.bytes;
+        cursorChunk = c;
+        cursorFrame = chunk.firstFrame;
+        std::fill(last.begin(), last.end(), 0);
+        return true;
+    }
+
+    // Decode the frame at cursor, into frame if keep is set
+    bool NextFrame (TrajectoryFrame &frame, bool keep)
+    {
+        uint64_t steps;
+        if (size_t(chunkEnd - cursor) < sizeof(double) + sizeof(steps)) return Damaged();
+        memcpy(&frame.time, cursor, sizeof(double));
+        memcpy(&steps, cursor + sizeof(double), sizeof(steps));
+        frame.steps = steps;
+        cursor += sizeof(double) + sizeof(steps);
+        if (header.fields & TRAJECTORY_DIAGNOSTICS)
+        {
+            if (size_t(chunkEnd - cursor) < sizeof(TrajectoryDiagnostics)) return Damaged();
+            memcpy(&frame.diagnostics, cursor, sizeof(TrajectoryDiagnostics));
+            cursor += sizeof(TrajectoryDiagnostics);
+        }
+
+        int column = 0;
+        bool ok = true;
+        if (header.fields & TRAJECTORY_POSITIONS)
+        {
+            ok = ok && GetColumn(frame.x, header.positionQuantum, column++, keep);
+            ok = ok && GetColumn(frame.y, header.positionQuantum, column++, keep);
+            ok = ok && GetColumn(frame.z, header.positionQuantum, column++, keep);
+        }
+        if (header.fields & TRAJECTORY_VELOCITIES)
+        {
+            ok = ok && GetColumn(frame.vx, header.velocityQuantum, column++, keep);
+            ok = ok && GetColumn(frame.vy, header.velocityQuantum, column++, keep);
+            ok = ok && GetColumn(frame.vz, header.velocityQuantum, column++, keep);
+        }
+        if (!ok) return Damaged();
+        cursorFrame++;
+        return true;
+    }
+
+    bool GetColumn (std::vector<double> &values, double quantum, int column, bool keep)
+    {
+        int n = Bodies();
+        if (header.encoding == TRAJECTORY_RAW)
+        {
+            size_t bytes = size_t(n)*sizeof(double);
+            if (size_t(chunkEnd - cursor) < bytes) return false;
+            if (keep) memcpy(values.data(), cursor, bytes);
+            cursor += bytes;
+            return true;
+        }
+        // Every delta has to be decoded to find where the next frame starts, kept or not
+        int64_t *previous = last.data() + size_t(column)*n;
+        for (int i = 0; i < n; i++)
+        {
+            int64_t delta;
+            if (!GetVarint(cursor, chunkEnd, delta)) return false;
+            previous[i] += delta;
+            if (keep) values[i] = previous[i]*quantum;
+        }
+        return true;
+    }
+
+    bool Damaged ()
+    {
+        cursorChunk = -1;
+        return false;
+    }
+};
+
+#endif // TRAJECTORY_H_INCLUDED
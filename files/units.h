@@ -0,0 +1,67 @@
+#ifndef UNITS_H_INCLUDED
+#define UNITS_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include "bodies.h"
+
+// Scene units for the gravity solvers
+// Bodies are stored in metres, kilograms and seconds, where G is 6.67e-11 and the masses
+// the GUI sets are around 1e10. Multiplying numbers that far apart is harmless in doubles,
+// but squeezes floats towards the ends of their range. In N-body units a length scale and
+// a mass scale are picked to suit the scene, and the time scale follows from making G = 1:
+// time = sqrt(length^3/(G*mass)). Positions and masses handed to a solver are then all
+// near 1, and its answer only has to be multiplied by length/time^2 to get back to metres
+// per second squared.
+
+struct UnitSystem
+{
+    double length = 1;// Metres in one unit of length
+    double mass = 1;// Kilograms in one unit of mass
+    double time = 1;// Seconds in one unit of time
+
+    // Units with the given length and mass, and whatever time makes G = 1
+    static UnitSystem For (double length, double mass, double G)
+    {
+        UnitSystem units;
+        units.length = length;
+        units.mass = mass;
+        units.time = sqrt(length*length*length/(G*mass));
+        return units;
+    }
+
+    // Units suited to the active bodies: their total mass, and how far they are spread
+    // (root mean square distance from their centre of mass)
+    static UnitSystem ForScene (const BodyStore &s, const std::vector<int> &active, double G)
+    {
+        double total = 0, cx = 0, cy = 0, cz = 0;
+        for (int i : active)
+        {
+            total += s.mass[i];
+            cx += s.mass[i]*s.x[i];
+            cy += s.mass[i]*s.y[i];
+            cz += s.mass[i]*s.z[i];
+        }
+        if (total <= 0) return For(1, 1, G);
+        cx /= total;
+        cy /= total;
+        cz /= total;
+
+        double spread = 0;
+        for (int i : active)
+        {
+            double dx = s.x[i] - cx, dy = s.y[i] - cy, dz = s.z[i] - cz;
+            spread += dx*dx + dy*dy + dz*dz;
+        }
+        spread = sqrt(spread/active.size());
+        return For(spread > 0 ? spread : 1, total, G);
+    }
+
+    // Metres per second squared in one unit of acceleration
+    double Acceleration () const
+    {
+        return length/(time*time);
+    }
+};
+
+#endif // UNITS_H_INCLUDED
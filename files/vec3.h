@@ -0,0 +1,46 @@
+#ifndef VEC3_H_INCLUDED
+#define VEC3_H_INCLUDED
+
+#include <cmath>
+
+// A tiny double precision vector used by the physics engine.
+// The engine can't use glm because it has to build on machines without any of the
+// graphics libraries, so this only has the handful of operations the physics needs.
+struct Vec3
+{
+    double x, y, z;
+
+    Vec3 (): x(0), y(0), z(0) {}
+    Vec3 (double x, double y, double z): x(x), y(y), z(z) {}
+
+    Vec3 operator + (const Vec3 &v) const { return Vec3(x + v.x, y + v.y, z + v.z); }
+    Vec3 operator - (const Vec3 &v) const { return Vec3(x - v.x, y - v.y, z - v.z); }
+    Vec3 operator - () const { return Vec3(-x, -y, -z); }
+    Vec3 operator * (double s) const { return Vec3(x*s, y*s, z*s); }
+    Vec3 operator / (double s) const { return Vec3(x/s, y/s, z/s); }
+    Vec3 &operator += (const Vec3 &v) { x += v.x; y += v.y; z += v.z; return *this; }
+    Vec3 &operator -= (const Vec3 &v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    Vec3 &operator *= (double s) { x *= s; y *= s; z *= s; return *this; }
+};
+
+inline Vec3 operator * (double s, const Vec3 &v) { return v*s; }
+
+inline double Dot (const Vec3 &a, const Vec3 &b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+inline double Length (const Vec3 &v) { return std::sqrt(Dot(v, v)); }
+inline double Distance (const Vec3 &a, const Vec3 &b) { return Length(a - b); }
+
+// Returns the zero vector instead of NaNs when asked to normalize nothing
+inline Vec3 Normalize (const Vec3 &v)
+{
+    double l = Length(v);
+    if (l == 0) return Vec3();
+    return v/l;
+}
+
+// Same as glm::reflect, n must be normalized
+inline Vec3 Reflect (const Vec3 &v, const Vec3 &n)
+{
+    return v - n*(2*Dot(v, n));
+}
+
+#endif // VEC3_H_INCLUDED
@@ -0,0 +1,1179 @@
+// N-body Gravity and Collision simulator - headless batch runner
+// Runs the physics engine without a window, GL context, models or fonts and
+// reports how many steps per second the machine can manage.
+//
+// Usage: headless [--steps N] [--dt SECONDS] [--random BODIES] [--seed S] [--quiet] [--count-allocs]
+//                 [--no-collisions] [--solver direct|simd|barneshut|fmm|pm] [--theta T] [--quadrupole] [--order P]
+//                 [--threads T] [--compare SAMPLES] [--sizes N1,N2,...] [--grid N] [--assign cic|tsc] [--periodic]
+//                 [--softening E] [--float] [--simd scalar|avx2|avx512] [--pin] [--scaling]
+//                 [--integrator euler|leapfrog|verlet|yoshida4|block] [--energy] [--eta E] [--max-level L]
+//                 [--broadphase allpairs|hash|sap] [--radii same|spread|mixed] [--bench-broadphase] [--ccd]
+//                 [--contacts islands|pairwise] [--bench-kernels] [--units si|scene] [--float-math]
+//                 [--sim-thread FRAME_MS] [--warp W] [--ensemble M] [--perturb SIGMA] [--output FILE]
+//                 [--checkpoint FILE] [--checkpoint-every N] [--restore FILE]
+//                 [--record FILE] [--record-fields pvd] [--record-every N] [--encoding raw|delta] [--quantum Q]
+//                 [--bench-record] [--scene FILE] [--save-scene FILE] [--scene-format text|binary]
+//
+// --compare reports the error of the chosen gravity solver against direct summation on
+// the starting state, checking up to SAMPLES bodies.
+// --sizes runs the same comparison on random scenes of each size instead of simulating,
+// to show how a solver's time and error change with N.
+//
+// --solver pm spreads the bodies over a GRID^3 mesh of the domain box. --periodic makes the
+// box repeat in every direction, which direct summation doesn't, so --compare only
+// measures the isolated mode exactly.
+//
+// --solver simd is direct summation over each pair once with AVX2/AVX-512, the engine's
+// default. --simd lowers the instruction set it uses, --float stores positions as floats
+// and --softening adds Plummer softening (which --compare counts as error).
+//
+// --threads sets how many threads the engine splits every pass over (all cores by default)
+// and --pin keeps each worker thread on its own core. --scaling runs the same simulation
+// with 1, 2, ... up to that many threads and reports the speedup of each over 1 thread.
+//
+// --integrator picks how bodies are moved through each step (leapfrog by default, euler is
+// the original scheme). --energy reports how far the total energy drifted over the run,
+// the usual way to compare integrators at a given --dt. --integrator block gives every body
+// its own step of dt/2^L (L up to --max-level) chosen by the accuracy --eta, and reports how
+// many bodies ended up on each level.
+//
+// --broadphase picks how spheres that might be touching are found: every pair against every
+// other (allpairs), a uniform grid sized from the largest sphere (hash, the default) or
+// intervals along one axis kept sorted between steps (sap). --radii sets how the sizes of
+// the random spheres vary: all the same, spread evenly over orders of magnitude, or mostly
+// small with a few large ones mixed in. --bench-broadphase runs the random scene with every
+// broad phase on every kind of radii and reports the time spent finding pairs each step.
+//
+// --ccd sweeps spheres along their paths while they drift and bounces them at the moment
+// they meet, so long steps don't let fast spheres pass through each other or the walls.
+//
+// --contacts picks how touching spheres bounce: gathered into islands and solved together
+// (islands, the default) or each sphere off its contacts in turn (pairwise, the original
+// scheme, which the simulator's results before islands can be reproduced with).
+//
+// --bench-kernels runs the random scene as gravity only, with elastic, inelastic or mixed
+// collisions, without walls and with softening, and reports steps per second for each along
+// with the collision features the engine compiled that case for.
+//
+// --units scene has the gravity solver work in units picked from the starting scene, with
+// G = 1, instead of metres, kilograms and seconds. --float-math stores the simd solver's
+// positions as floats and does its pair arithmetic in floats too, which scene units keep
+// accurate.
+//
+// --sim-thread steps the engine on a thread of its own, the way the windowed program does,
+// while this thread plays the renderer: every frame it takes the newest snapshot, sends an
+// edit and then spends FRAME_MS milliseconds "drawing". It reports steps per second along
+// with the frames drawn, to show the physics no longer waits for the frames. Steps are --dt
+// long and taken as fast as possible, or with --warp at W simulated seconds to every second
+// of the clock, dropping whatever time the machine can't keep up with.
+//
+// --ensemble runs M copies of the scene side by side in one Ensemble (ensemble.h), each
+// stepped exactly as the engine would step it alone with --solver direct and --contacts
+// pairwise. Every copy but the first has its spheres nudged by a normal distribution of
+// --perturb metres. The first copy is printed the same way a single run is, and --output
+// writes the final state of every sphere in every copy to FILE.
+//
+// --checkpoint saves the engine to FILE when the run ends (see checkpoint.h), and with
+// --checkpoint-every every N steps along the way too, written on a thread of their own while
+// the engine carries on. --restore starts from a checkpoint instead of a scene: the bodies,
+// time, steps, units and contact settings come from the file, and the solver, integrator and
+// broad phase from the command line. With direct summation, a run restored from a checkpoint
+// taken at step K and stepped N - K more times ends exactly as a run of N steps does. Solvers
+// and integrators that carry something over between steps (the Barnes-Hut tree refits, the
+// block timestep levels) start that afresh, so they only agree to their own accuracy.
+//
+// --record writes the whole run to the trajectory FILE (see trajectory.h), a frame at the
+// start and then one every N steps of --record-every, on a thread of its own. --record-fields
+// picks what each frame holds, any of p (positions), v (velocities) and d (kinetic energy,
+// momentum and the engine's counters). --encoding stores frames as the raw doubles, or as
+// changes rounded to multiples of Q metres (and Q/1000 metres per second), the default.
+// Frames the writer can't keep up with are dropped and counted rather than waited for.
+// With --sim-thread and no --record-every, the step after every frame drawn is recorded.
+// --bench-record runs the random scene (100000 spheres unless --random says otherwise)
+// without recording and recording every step both ways, and reports steps per second and
+// what was written for each.
+//
+// --scene starts from a scene file (see scene.h), the same files the windowed program reads,
+// instead of a built-in scene. Whatever settings the file gives are used unless the command
+// line says otherwise. The file is read on --threads threads. --save-scene writes the scene
+// the run starts from, with the settings it runs with, to FILE as text or in the binary form
+// that reads back at the speed of the disk, before stepping. --random N --save-scene FILE
+// --steps 0 makes a scene of any size to time reading with.
+//
+// --count-allocs counts every heap allocation made after the first step (including an edit
+// through a BodyHandle every step, the same way the GUI edits bodies) and exits with
+// an error if there were any.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <new>
+#include <fstream>
+
+#include "files/engine.h"
+#include "files/barneshut.h"
+#include "files/fmm.h"
+#include "files/pm.h"
+#include "files/simthread.h"
+#include "files/ensemble.h"
+#include "files/checkpoint.h"
+#include "files/trajectory.h"
+#include "files/scene.h"
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// Every call to the global operator new is counted here
+// These are kept out of line, or GCC sees malloc and free through them and warns that new
+// and delete don't match.
+atomic<unsigned long long> allocations(0);
+
+__attribute__((noinline)) void *operator new (size_t size)
+{
+    allocations++;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete (void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete (void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Settings read from the command line
+struct Settings
+{
+    long long steps = 10000;// Number of steps to run
+    double dt = 0.016;// Fixed timestep in seconds
+    int random = 0;// If not zero, use this many randomly placed spheres instead of the default scene
+    unsigned seed = 1;// Seed for the random scene
+    bool quiet = false;// Don't print the final state of every body
+    bool countAllocs = false;// Fail if stepping allocates any memory
+    bool collisions = true;// Whether the random spheres collide
+    string solver = "simd";// Gravity solver
+    double theta = 0.5;// Barnes-Hut opening angle
+    bool quadrupole = false;// Barnes-Hut quadrupole term
+    int compare = 0;// Number of bodies to check against direct summation
+    int order = 6;// FMM expansion order
+    int threads = DefaultThreadCount();// Threads the engine uses
+    bool pin = false;// Pin each worker thread to a core
+    bool scaling = false;// Report the speedup from 1 thread up to threads
+    string integrator = "leapfrog";// How bodies are moved through each step
+    bool energy = false;// Report the energy drift over the run
+    double eta = 0.02;// Block timestep accuracy
+    int maxLevel = 10;// Deepest block timestep level
+    string broadPhase = "hash";// How spheres that might be touching are found
+    string radii = "same";// How the sizes of the random spheres vary
+    bool benchBroadPhase = false;// Time every broad phase on every kind of radii
+    bool continuous = false;// Sweep spheres along their paths while drifting
+    int contacts = CONTACTS_ISLANDS;// How touching spheres bounce
+    bool benchKernels = false;// Time the engine on every kind of scene it has a specialized pass for
+    vector<int> sizes;// Scene sizes to compare solvers at
+    int grid = 64;// Particle-mesh cells along each side of the domain
+    int assignment = PM_CIC;// Particle-mesh mass assignment
+    bool periodic = false;// Particle-mesh boundaries
+    double softening = 0;// Plummer softening length for the simd solver
+    bool singlePrecision = false;// Store simd solver positions as floats
+    bool floatMath = false;// Do the simd solver's pair arithmetic in floats
+    bool sceneUnits = false;// Work gravity out in units picked from the scene, with G = 1
+    double unitLength = 0, unitMass = 0;// If not zero, work gravity out in these units with G = 1 instead
+    int simd = DetectSimd();// Instruction set for the simd solver
+    double frameMs = -1;// If not negative, step on a SimThread while frames taking this long are drawn
+    double warp = 0;// Simulated seconds the SimThread covers every second, 0 for as fast as possible
+    int ensemble = 0;// If not zero, step this many copies of the scene in an Ensemble
+    double perturb = 0.01;// Spread of the nudges given to the spheres of every copy but the first
+    string output;// File the final state of every copy is written to
+    string checkpoint;// File the engine is saved to
+    long long checkpointEvery = 0;// Steps between checkpoints, 0 for only at the end
+    string restore;// Checkpoint to start from instead of a scene
+    string record;// Trajectory file the run is written to
+    int recordFields = TRAJECTORY_POSITIONS;// TRAJECTORY_ bits recorded in every frame
+    long long recordEvery = 0;// Steps between frames, 0 for every step (or every frame drawn with --sim-thread)
+    int encoding = TRAJECTORY_DELTA;// How frames are stored
+    double quantum = TRAJECTORY_POSITION_QUANTUM;// Metres positions are rounded to when delta encoded
+    bool benchRecord = false;// Time the random scene with and without recording
+    string sceneFile;// Scene file to start from instead of a built-in scene
+    const Scene *scene = NULL;// What was read from it
+    string saveScene;// File the starting scene is written to
+    bool binaryScene = false;// Write it in the binary form
+};
+
+// The same six spheres in a box that the windowed program starts with
+void LoadDefaultScene (Engine &engine)
+{
+    // The domain
+    Body domain;
+    domain.radius = 15;
+    domain.collision = true;
+    domain.mass = 1.0;
+    engine.AddBody(domain);
+
+    // The spheres
+    Vec3 starts[6] = {Vec3(0,0,0), Vec3(3,0,0), Vec3(6,0,0), Vec3(-3,0,0), Vec3(-6,0,0), Vec3(0,0,3)};
+    for (int i = 0; i < 6; i++)
+    {
+        Body sphere;
+        sphere.location = starts[i];
+        sphere.radius = 1;
+        sphere.isSphere = true;
+        sphere.collision = true;
+        sphere.massNum = 1;
+        sphere.massExp = 10;
+        sphere.mass = 1e10;
+        sphere.elasticity = 1.0;
+        engine.AddBody(sphere);
+    }
+}
+
+// Fill the domain with small spheres at random locations and velocities
+// radii is "same" for every sphere 0.05 across, "spread" for sizes spread evenly over
+// 0.01 to 1 on a log scale, or "mixed" for one sphere in a hundred 1.5 across among
+// spheres 0.03 across.
+void LoadRandomScene (Engine &engine, int count, unsigned seed, bool collisions, const string &radii = "same")
+{
+    mt19937 rng(seed);
+    double halfWidth = 15.0;
+    uniform_real_distribution<double> speed(-0.1, 0.1);
+    uniform_real_distribution<double> exponent(-2, 0);
+    uniform_real_distribution<double> chance(0, 1);
+
+    Body domain;
+    domain.radius = halfWidth;
+    domain.collision = true;
+    domain.mass = 1.0;
+    engine.AddBody(domain);
+
+    for (int i = 0; i < count; i++)
+    {
+        double radius = 0.05;
+        if (radii == "spread") radius = pow(10.0, exponent(rng));
+        else if (radii == "mixed") radius = chance(rng) < 0.01 ? 1.5 : 0.03;
+        uniform_real_distribution<double> place(-halfWidth + radius, halfWidth - radius);
+
+        Body sphere;
+        sphere.location = Vec3(place(rng), place(rng), place(rng));
+        sphere.velocity = Vec3(speed(rng), speed(rng), speed(rng));
+        sphere.radius = radius;
+        sphere.isSphere = true;
+        sphere.collision = collisions;
+        sphere.massNum = 1;
+        sphere.massExp = 6;
+        sphere.mass = 1e6;
+        sphere.elasticity = 1.0;
+        engine.AddBody(sphere);
+    }
+}
+
+// Fill the engine with the scene asked for
+void LoadScene (Engine &engine, const Settings &settings)
+{
+    if (settings.scene != NULL)
+    {
+        engine.bodies = settings.scene->bodies;
+        return;
+    }
+    engine.bodies.Reserve(settings.random + 1);
+    if (settings.random > 0) LoadRandomScene(engine, settings.random, settings.seed, settings.collisions, settings.radii);
+    else LoadDefaultScene(engine);
+}
+
+// Create the gravity solver asked for, or NULL if there isn't one by that name
+GravitySolver *MakeSolver (const Settings &settings)
+{
+    if (settings.solver == "direct") return new DirectGravity();
+    if (settings.solver == "simd")
+    {
+        SimdDirectGravity *simd = new SimdDirectGravity(settings.softening, settings.singlePrecision || settings.floatMath);
+        simd->floatMath = settings.floatMath;
+        simd->simd = min(simd->simd, settings.simd);
+        return simd;
+    }
+    if (settings.solver == "barneshut") return new BarnesHutGravity(settings.theta, settings.quadrupole);
+    if (settings.solver == "fmm")
+    {
+        FastMultipoleGravity *fmm = new FastMultipoleGravity(settings.order, settings.theta);
+        return fmm;
+    }
+    if (settings.solver == "pm")
+    {
+        ParticleMeshGravity *pm = new ParticleMeshGravity(settings.grid, settings.assignment, settings.periodic);
+        return pm;
+    }
+    return NULL;
+}
+
+// Create the integrator asked for, or NULL if there isn't one by that name
+Integrator *MakeIntegrator (const Settings &settings)
+{
+    if (settings.integrator == "euler") return new EulerIntegrator();
+    if (settings.integrator == "leapfrog") return new LeapfrogIntegrator();
+    if (settings.integrator == "verlet") return new VerletIntegrator();
+    if (settings.integrator == "yoshida4") return new YoshidaIntegrator();
+    if (settings.integrator == "block") return new BlockTimestepIntegrator(settings.eta, settings.maxLevel);
+    return NULL;
+}
+
+// Create the broad phase asked for, or NULL if there isn't one by that name
+BroadPhase *MakeBroadPhase (const Settings &settings)
+{
+    if (settings.broadPhase == "allpairs") return new AllPairsBroadPhase();
+    if (settings.broadPhase == "hash") return new SpatialHashBroadPhase();
+    if (settings.broadPhase == "sap") return new SweepAndPruneBroadPhase();
+    return NULL;
+}
+
+// Passes every search on to another broad phase and keeps count of the time it takes
+class TimedBroadPhase : public BroadPhase
+{
+public:
+    double seconds = 0;// Time spent finding pairs
+    long long searches = 0;// Number of times pairs were looked for
+    long long found = 0;// Pairs found over all the searches
+
+    TimedBroadPhase (BroadPhase *inner): inner(inner) {}
+
+    void FindPairs (const BodyStore &s, const std::vector<int> &spheres, std::vector<SpherePair> &pairs)
+    {
+        inner->pool = pool;
+        auto start = chrono::steady_clock::now();
+        inner->FindPairs(s, spheres, pairs);
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        searches++;
+        found += pairs.size();
+    }
+
+    const char *Name () const { return inner->Name(); }
+
+private:
+    unique_ptr<BroadPhase> inner;
+};
+
+// Run the random scene with every broad phase on every kind of radii, timing only the search for pairs
+void BenchBroadPhases (const Settings &settings)
+{
+    const char *radii[3] = {"same", "spread", "mixed"};
+    const char *broadPhases[3] = {"allpairs", "hash", "sap"};
+    int count = settings.random > 0 ? settings.random : 2000;
+    cout << "radii    broad phase  ms/step  pairs/step  speedup" << endl;
+    for (const char *kind : radii)
+    {
+        double allPairs = 0;
+        for (const char *name : broadPhases)
+        {
+            Settings chosen = settings;
+            chosen.broadPhase = name;
+            Engine engine(settings.threads, settings.pin);
+            engine.bodies.Reserve(count + 1);
+            LoadRandomScene(engine, count, settings.seed, true, kind);
+            engine.SetGravitySolver(MakeSolver(chosen));
+            engine.SetIntegrator(MakeIntegrator(chosen));
+            TimedBroadPhase *timed = new TimedBroadPhase(MakeBroadPhase(chosen));
+            engine.SetBroadPhase(timed);
+            for (long long s = 0; s < settings.steps; s++) engine.Step(settings.dt);
+
+            double perStep = timed->searches > 0 ? timed->seconds/timed->searches : 0;
+            if (allPairs == 0) allPairs = perStep;
+            cout << setw(6) << kind << "  " << setw(11) << name << "  " << setw(7) << setprecision(4) << perStep*1000
+                 << "  " << setw(10) << (timed->searches > 0 ? double(timed->found)/timed->searches : 0)
+                 << "  " << setw(7) << (perStep > 0 ? allPairs/perStep : 0) << endl;
+        }
+    }
+}
+
+// Time one solve of the engine's gravity solver and report its error against direct summation
+void CompareSolver (Engine &engine, int samples)
+{
+    // Not counted as part of the run
+    unsigned long long full = engine.forceEvaluations, bodyByBody = engine.bodyForceEvaluations;
+    auto start = chrono::steady_clock::now();
+    engine.ComputeForces();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    engine.forceEvaluations = full;
+    engine.bodyForceEvaluations = bodyByBody;
+    GravityError error = CompareWithDirect(engine.bodies, engine.gravitating, GRAVITATIONAL_CONSTANT, engine.acc, samples);
+    cout << "solve seconds " << seconds << ", bodies per second " << (seconds > 0 ? engine.gravitating.size()/seconds : 0)
+         << ", relative error rms " << error.rms << " max " << error.max << " (" << error.samples << " bodies checked)" << endl;
+    engine.gravity->Invalidate();
+}
+
+// The FEATURE_ bits as words, for reports
+string FeatureNames (int features)
+{
+    string names;
+    const char *words[5] = {"walls", "swept", "islands", "elastic", "inelastic"};
+    for (int bit = 0; bit < 5; bit++)
+    {
+        if (!(features & (1 << bit))) continue;
+        if (!names.empty()) names += "+";
+        names += words[bit];
+    }
+    return names.empty() ? "none" : names;
+}
+
+// Run the random scene in every form the engine has a specialized collision pass or gravity kernel for
+void BenchKernels (const Settings &settings)
+{
+    const char *cases[6] = {"gravity only", "elastic", "inelastic", "mixed", "no walls", "softened"};
+    int count = settings.random > 0 ? settings.random : 2000;
+    cout << "scene          features                  steps/s" << endl;
+    for (const char *name : cases)
+    {
+        string kind = name;
+        Settings chosen = settings;
+        if (kind == "softened") chosen.softening = max(settings.softening, 0.01);
+        Engine engine(settings.threads, settings.pin);
+        engine.bodies.Reserve(count + 1);
+        LoadRandomScene(engine, count, settings.seed, kind != "gravity only", settings.radii);
+        for (int i = 1; i < engine.bodies.Size(); i++)
+        {
+            BodyHandle sphere = engine.bodies.Handle(i);
+            if (kind == "inelastic") sphere.SetElasticity(0);
+            if (kind == "mixed") sphere.SetElasticity(i % 2 ? 1 : 0.5);
+        }
+        if (kind == "no walls")
+        {
+            Body domain = engine.bodies.Get(0);
+            domain.collision = false;
+            engine.bodies.Set(0, domain);
+        }
+        engine.SetGravitySolver(MakeSolver(chosen));
+        engine.SetIntegrator(MakeIntegrator(chosen));
+        engine.SetBroadPhase(MakeBroadPhase(chosen));
+        engine.continuous = settings.continuous;
+        engine.contactScheme = settings.contacts;
+        if (settings.sceneUnits) engine.SetSceneUnits();
+
+        engine.Step(settings.dt);
+        auto start = chrono::steady_clock::now();
+        for (long long s = 1; s < settings.steps; s++) engine.Step(settings.dt);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << setw(13) << left << name << "  " << setw(24) << FeatureNames(engine.Features()) << right << "  "
+             << setprecision(4) << (seconds > 0 ? (settings.steps - 1)/seconds : 0) << endl;
+    }
+}
+
+// Start recording the engine's bodies to path as the settings ask
+bool StartRecording (TrajectoryWriter &recorder, const Engine &engine, const string &path, const Settings &settings, int encoding)
+{
+    string error;
+    recorder.positionQuantum = settings.quantum;
+    recorder.velocityQuantum = settings.quantum/1000;
+    if (!recorder.Open(path, engine.bodies.Size(), settings.recordFields, encoding, error))
+    {
+        cout << "Can't record: " << error << endl;
+        return false;
+    }
+    return true;
+}
+
+// What a recording came to, for reports
+void ReportRecording (const TrajectoryWriter &recorder, int bodies)
+{
+    cout << "frames recorded: " << recorder.Written() << ", dropped: " << recorder.Dropped() << ", bytes: " << recorder.Bytes()
+         << " (" << (recorder.Written() > 0 && bodies > 0 ? double(recorder.Bytes())/recorder.Written()/bodies : 0) << " per body per frame)" << endl;
+}
+
+// Run the random scene without recording, then recording every step raw and delta encoded
+void BenchRecording (const Settings &settings)
+{
+    const char *cases[3] = {"off", "raw", "delta"};
+    int count = settings.random > 0 ? settings.random : 100000;
+    string path = settings.record.empty() ? "bench.trajectory" : settings.record;
+    cout << "recording  steps/s  frames  dropped  MB written  bytes/body/frame" << endl;
+    for (const char *name : cases)
+    {
+        string kind = name;
+        Engine engine(settings.threads, settings.pin);
+        engine.bodies.Reserve(count + 1);
+        LoadRandomScene(engine, count, settings.seed, settings.collisions, settings.radii);
+        engine.SetGravitySolver(MakeSolver(settings));
+        engine.SetIntegrator(MakeIntegrator(settings));
+        engine.SetBroadPhase(MakeBroadPhase(settings));
+        engine.continuous = settings.continuous;
+        engine.contactScheme = settings.contacts;
+        if (settings.sceneUnits) engine.SetSceneUnits();
+
+        TrajectoryWriter recorder;
+        bool recording = kind != "off";
+        if (recording && !StartRecording(recorder, engine, path, settings, kind == "raw" ? TRAJECTORY_RAW : TRAJECTORY_DELTA)) return;
+        engine.Step(settings.dt);
+        auto start = chrono::steady_clock::now();
+        for (long long s = 1; s < settings.steps; s++)
+        {
+            engine.Step(settings.dt);
+            if (recording) recorder.Record(engine);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        recorder.Close();
+
+        cout << setw(9) << name << "  " << setw(7) << setprecision(4) << (seconds > 0 ? (settings.steps - 1)/seconds : 0)
+             << "  " << setw(6) << recorder.Written() << "  " << setw(7) << recorder.Dropped()
+             << "  " << setw(10) << recorder.Bytes()/1e6
+             << "  " << setw(16) << (recorder.Written() > 0 ? double(recorder.Bytes())/recorder.Written()/count : 0) << endl;
+    }
+    remove(path.c_str());
+}
+
+// Step the engine on a SimThread while this thread draws frames from its snapshots
+// The first step is taken here, to size the engine's buffers before allocationsBefore is set.
+// If recorder isn't NULL the thread records to it, every frame drawn unless --record-every says otherwise.
+void RunSimThread (Engine &engine, const Settings &settings, unsigned long long &allocationsBefore, TrajectoryWriter *recorder)
+{
+    if (settings.steps <= 0) return;
+    engine.Step(settings.dt);
+
+    SimThread sim(engine);
+    sim.stepSize = settings.dt;
+    sim.SetTimeWarp(settings.warp);
+    sim.stepLimit = settings.steps - 1;
+    sim.recorder = recorder;
+    sim.recordEvery = settings.recordEvery;
+    sim.Start();
+    allocationsBefore = allocations;
+
+    long long frames = 0;
+    unsigned long long shownSteps = 0;
+    double wander = 0;// How far the drawn sphere was from its last location, to show blending works
+    while (shownSteps < (unsigned long long)settings.steps)
+    {
+        const Snapshot &shown = sim.Latest();
+        shownSteps = shown.steps;
+        if (shown.bodies.Size() > 1) wander = max(wander, Distance(shown.Location(1, shown.Blend()), shown.Location(1, 0)));
+
+        // Edit a body the way the GUI does
+        if (settings.countAllocs && shown.bodies.Size() > 1)
+        {
+            sim.Send(Command{1, COMMAND_MASS_NUM, shown.bodies.massNum[1]});
+        }
+        if (settings.frameMs > 0) this_thread::sleep_for(chrono::duration<double, milli>(settings.frameMs));
+        else this_thread::yield();
+        frames++;
+    }
+    sim.Stop();
+    cout << "frames drawn: " << frames << endl;
+    cout << "furthest sphere 1 was drawn from its last location: " << wander << endl;
+    if (settings.warp > 0) cout << "simulated seconds dropped: " << sim.Dropped() << endl;
+}
+
+// Step copies of the scene side by side, each nudged a little differently
+int RunEnsemble (const Settings &settings)
+{
+    Engine scene(1);
+    LoadScene(scene, settings);
+
+    Ensemble ensemble(settings.threads, settings.pin);
+    ensemble.simd = min(ensemble.simd, settings.simd);
+    ensemble.Load(scene.bodies, settings.ensemble);
+
+    mt19937 rng(settings.seed);
+    normal_distribution<double> nudge(0, settings.perturb);
+    for (int s = 1; s < ensemble.scenarios && settings.perturb > 0; s++)
+    {
+        for (int b : ensemble.gravitating)
+        {
+            int i = ensemble.Index(b, s);
+            ensemble.x[i] += nudge(rng);
+            ensemble.y[i] += nudge(rng);
+            ensemble.z[i] += nudge(rng);
+        }
+        ensemble.Changed(s);
+    }
+    cout << "ensemble: " << ensemble.Name() << ", " << ensemble.scenarios << " scenarios of " << ensemble.bodies << " bodies" << endl;
+
+    auto start = chrono::steady_clock::now();
+    for (long long s = 0; s < settings.steps; s++) ensemble.Step(settings.dt);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "steps: " << ensemble.steps << endl;
+    cout << "simulated seconds: " << ensemble.time << endl;
+    cout << "wall seconds: " << seconds << endl;
+    cout << "scenario steps per second: " << (seconds > 0 ? double(ensemble.steps)*ensemble.scenarios/seconds : 0) << endl;
+
+    if (!settings.output.empty())
+    {
+        ofstream out(settings.output.c_str());
+        if (!out)
+        {
+            cout << "Can't write " << settings.output << endl;
+            return 1;
+        }
+        out << "scenario,body,x,y,z,vx,vy,vz" << endl;
+        out << setprecision(17);
+        for (int s = 0; s < ensemble.scenarios; s++)
+        {
+            for (int b : ensemble.gravitating)
+            {
+                Body body = ensemble.Get(s, b);
+                out << s << "," << b << "," << body.location.x << "," << body.location.y << "," << body.location.z << ","
+                    << body.velocity.x << "," << body.velocity.y << "," << body.velocity.z << endl;
+            }
+        }
+        cout << "written: " << settings.output << endl;
+    }
+
+    if (!settings.quiet)
+    {
+        for (int b = 0; b < ensemble.bodies; b++)
+        {
+            Body body = ensemble.Get(0, b);
+            if (!body.isSphere) continue;
+            cout << fixed << setprecision(3) << b << ": location (" << body.location.x << ", " << body.location.y << ", " << body.location.z
+                 << ") velocity (" << body.velocity.x << ", " << body.velocity.y << ", " << body.velocity.z << ")" << endl;
+        }
+    }
+    return 0;
+}
+
+// Take whatever a scene file says into settings
+void ApplySceneSettings (const SceneSettings &scene, Settings &settings)
+{
+    if (scene.step > 0) settings.dt = scene.step;
+    if (!scene.solver.empty()) settings.solver = scene.solver;
+    if (!scene.integrator.empty()) settings.integrator = scene.integrator;
+    if (!scene.broadPhase.empty()) settings.broadPhase = scene.broadPhase;
+    if (scene.contacts >= 0) settings.contacts = scene.contacts;
+    if (scene.continuous >= 0) settings.continuous = scene.continuous != 0;
+    if (scene.softening >= 0) settings.softening = scene.softening;
+    if (scene.theta > 0) settings.theta = scene.theta;
+    settings.sceneUnits = scene.units == SCENE_UNITS_SCENE;
+    if (scene.units == SCENE_UNITS_FIXED)
+    {
+        settings.unitLength = scene.unitLength;
+        settings.unitMass = scene.unitMass;
+    }
+}
+
+// The scene the engine is about to run, with the settings it runs with
+// Lights and models come from the scene file it was read from, if it was.
+Scene SceneOf (const Engine &engine, const Settings &settings, const Scene &read)
+{
+    Scene scene;
+    scene.bodies = engine.bodies;
+    scene.lights = read.lights;
+    scene.meshes = read.meshes;
+    SceneSettings &out = scene.settings;
+    out.step = settings.dt;
+    out.solver = settings.solver;
+    out.integrator = settings.integrator;
+    out.broadPhase = settings.broadPhase;
+    out.contacts = settings.contacts;
+    out.continuous = settings.continuous;
+    out.softening = settings.softening;
+    out.theta = settings.theta;
+    out.units = settings.sceneUnits ? SCENE_UNITS_SCENE : settings.unitLength > 0 ? SCENE_UNITS_FIXED : SCENE_UNITS_SI;
+    out.unitLength = settings.unitLength > 0 ? settings.unitLength : 1;
+    out.unitMass = settings.unitMass > 0 ? settings.unitMass : 1;
+    return scene;
+}
+
+bool ReadSettings (int argc, char *argv[], Settings &settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        // Every option except the flags takes a value
+        if (arg == "--quiet")
+        {
+            settings.quiet = true;
+            continue;
+        }
+        if (arg == "--count-allocs")
+        {
+            settings.countAllocs = true;
+            continue;
+        }
+        if (arg == "--no-collisions")
+        {
+            settings.collisions = false;
+            continue;
+        }
+        if (arg == "--quadrupole")
+        {
+            settings.quadrupole = true;
+            continue;
+        }
+        if (arg == "--periodic")
+        {
+            settings.periodic = true;
+            continue;
+        }
+        if (arg == "--energy")
+        {
+            settings.energy = true;
+            continue;
+        }
+        if (arg == "--pin")
+        {
+            settings.pin = true;
+            continue;
+        }
+        if (arg == "--scaling")
+        {
+            settings.scaling = true;
+            continue;
+        }
+        if (arg == "--ccd")
+        {
+            settings.continuous = true;
+            continue;
+        }
+        if (arg == "--bench-kernels")
+        {
+            settings.benchKernels = true;
+            continue;
+        }
+        if (arg == "--bench-broadphase")
+        {
+            settings.benchBroadPhase = true;
+            continue;
+        }
+        if (arg == "--float-math")
+        {
+            settings.floatMath = true;
+            continue;
+        }
+        if (arg == "--bench-record")
+        {
+            settings.benchRecord = true;
+            continue;
+        }
+        if (arg == "--float")
+        {
+            settings.singlePrecision = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            cout << "Missing value for " << arg << endl;
+            return false;
+        }
+        if (arg == "--steps") settings.steps = atoll(argv[++i]);
+        else if (arg == "--dt") settings.dt = atof(argv[++i]);
+        else if (arg == "--random") settings.random = atoi(argv[++i]);
+        else if (arg == "--seed") settings.seed = unsigned(atoi(argv[++i]));
+        else if (arg == "--solver") settings.solver = argv[++i];
+        else if (arg == "--theta") settings.theta = atof(argv[++i]);
+        else if (arg == "--compare") settings.compare = atoi(argv[++i]);
+        else if (arg == "--order") settings.order = atoi(argv[++i]);
+        else if (arg == "--threads") settings.threads = atoi(argv[++i]);
+        else if (arg == "--grid")
+        {
+            settings.grid = atoi(argv[++i]);
+            if (!IsPowerOfTwo(settings.grid))
+            {
+                cout << "--grid must be a power of two" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--integrator") settings.integrator = argv[++i];
+        else if (arg == "--broadphase") settings.broadPhase = argv[++i];
+        else if (arg == "--units")
+        {
+            string units = argv[++i];
+            settings.unitLength = settings.unitMass = 0;
+            if (units == "si") settings.sceneUnits = false;
+            else if (units == "scene") settings.sceneUnits = true;
+            else
+            {
+                cout << "Unknown units " << units << endl;
+                return false;
+            }
+        }
+        else if (arg == "--contacts")
+        {
+            string scheme = argv[++i];
+            if (scheme == "islands") settings.contacts = CONTACTS_ISLANDS;
+            else if (scheme == "pairwise") settings.contacts = CONTACTS_PAIRWISE;
+            else
+            {
+                cout << "Unknown contact scheme " << scheme << endl;
+                return false;
+            }
+        }
+        else if (arg == "--radii")
+        {
+            settings.radii = argv[++i];
+            if (settings.radii != "same" && settings.radii != "spread" && settings.radii != "mixed")
+            {
+                cout << "Unknown radii " << settings.radii << endl;
+                return false;
+            }
+        }
+        else if (arg == "--sim-thread") settings.frameMs = atof(argv[++i]);
+        else if (arg == "--warp") settings.warp = atof(argv[++i]);
+        else if (arg == "--ensemble") settings.ensemble = atoi(argv[++i]);
+        else if (arg == "--perturb") settings.perturb = atof(argv[++i]);
+        else if (arg == "--output") settings.output = argv[++i];
+        else if (arg == "--checkpoint") settings.checkpoint = argv[++i];
+        else if (arg == "--checkpoint-every") settings.checkpointEvery = atoll(argv[++i]);
+        else if (arg == "--restore") settings.restore = argv[++i];
+        else if (arg == "--scene") settings.sceneFile = argv[++i];
+        else if (arg == "--save-scene") settings.saveScene = argv[++i];
+        else if (arg == "--scene-format")
+        {
+            string format = argv[++i];
+            if (format == "text") settings.binaryScene = false;
+            else if (format == "binary") settings.binaryScene = true;
+            else
+            {
+                cout << "Unknown scene format " << format << endl;
+                return false;
+            }
+        }
+        else if (arg == "--record") settings.record = argv[++i];
+        else if (arg == "--record-every") settings.recordEvery = max(atoll(argv[++i]), 1LL);
+        else if (arg == "--quantum") settings.quantum = atof(argv[++i]);
+        else if (arg == "--record-fields")
+        {
+            string letters = argv[++i];
+            settings.recordFields = 0;
+            for (char letter : letters)
+            {
+                if (letter == 'p') settings.recordFields |= TRAJECTORY_POSITIONS;
+                else if (letter == 'v') settings.recordFields |= TRAJECTORY_VELOCITIES;
+                else if (letter == 'd') settings.recordFields |= TRAJECTORY_DIAGNOSTICS;
+                else
+                {
+                    cout << "Unknown field " << letter << " to record" << endl;
+                    return false;
+                }
+            }
+        }
+        else if (arg == "--encoding")
+        {
+            string encoding = argv[++i];
+            if (encoding == "raw") settings.encoding = TRAJECTORY_RAW;
+            else if (encoding == "delta") settings.encoding = TRAJECTORY_DELTA;
+            else
+            {
+                cout << "Unknown encoding " << encoding << endl;
+                return false;
+            }
+        }
+        else if (arg == "--eta") settings.eta = atof(argv[++i]);
+        else if (arg == "--max-level") settings.maxLevel = atoi(argv[++i]);
+        else if (arg == "--softening") settings.softening = atof(argv[++i]);
+        else if (arg == "--simd")
+        {
+            string set = argv[++i];
+            if (set == "scalar") settings.simd = SIMD_SCALAR;
+            else if (set == "avx2") settings.simd = SIMD_AVX2;
+            else if (set == "avx512") settings.simd = SIMD_AVX512;
+            else
+            {
+                cout << "Unknown instruction set " << set << endl;
+                return false;
+            }
+        }
+        else if (arg == "--assign")
+        {
+            string scheme = argv[++i];
+            if (scheme == "cic") settings.assignment = PM_CIC;
+            else if (scheme == "tsc") settings.assignment = PM_TSC;
+            else
+            {
+                cout << "Unknown assignment " << scheme << endl;
+                return false;
+            }
+        }
+        else if (arg == "--sizes")
+        {
+            stringstream list(argv[++i]);
+            string size;
+            while (getline(list, size, ',')) settings.sizes.push_back(atoi(size.c_str()));
+        }
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main (int argc, char *argv[])
+{
+    Settings settings;
+    if (!ReadSettings(argc, argv, settings))
+    {
+        cout << "Usage: headless [--steps N] [--dt SECONDS] [--random BODIES] [--seed S] [--quiet] [--count-allocs]" << endl;
+        cout << "                [--no-collisions] [--solver direct|simd|barneshut|fmm|pm] [--theta T] [--quadrupole] [--order P]" << endl;
+        cout << "                [--threads T] [--compare SAMPLES] [--sizes N1,N2,...] [--grid N] [--assign cic|tsc] [--periodic]" << endl;
+        cout << "                [--softening E] [--float] [--simd scalar|avx2|avx512] [--pin] [--scaling]" << endl;
+        cout << "                [--integrator euler|leapfrog|verlet|yoshida4|block] [--energy] [--eta E] [--max-level L]" << endl;
+        cout << "                [--broadphase allpairs|hash|sap] [--radii same|spread|mixed] [--bench-broadphase] [--ccd]" << endl;
+        cout << "                [--contacts islands|pairwise] [--bench-kernels] [--units si|scene] [--float-math]" << endl;
+        cout << "                [--sim-thread FRAME_MS] [--warp W] [--ensemble M] [--perturb SIGMA] [--output FILE]" << endl;
+        cout << "                [--checkpoint FILE] [--checkpoint-every N] [--restore FILE]" << endl;
+        cout << "                [--record FILE] [--record-fields pvd] [--record-every N] [--encoding raw|delta] [--quantum Q]" << endl;
+        cout << "                [--bench-record] [--scene FILE] [--save-scene FILE] [--scene-format text|binary]" << endl;
+        return 1;
+    }
+
+    // The scene file's settings come first, so that the command line can override them
+    Scene scene;
+    if (!settings.sceneFile.empty())
+    {
+        string error;
+        auto start = chrono::steady_clock::now();
+        {
+            ThreadPool pool(settings.threads, settings.pin);
+            if (!ReadScene(settings.sceneFile, scene, error, &pool))
+            {
+                cout << "Can't read scene: " << error << endl;
+                return 1;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "scene: " << settings.sceneFile << ", " << scene.bodies.Size() << " bodies read in " << seconds << " s" << endl;
+        settings = Settings();
+        ApplySceneSettings(scene.settings, settings);
+        ReadSettings(argc, argv, settings);
+        settings.scene = &scene;
+    }
+
+    // Only run the ensemble, the engine isn't used
+    if (settings.ensemble > 0) return RunEnsemble(settings);
+
+    Engine engine(settings.threads, settings.pin);
+    if (settings.restore.empty()) LoadScene(engine, settings);
+
+    GravitySolver *solver = MakeSolver(settings);
+    if (solver == NULL)
+    {
+        cout << "Unknown solver " << settings.solver << endl;
+        return 1;
+    }
+    engine.SetGravitySolver(solver);
+    cout << "solver: " << engine.gravity->Name() << endl;
+
+    Integrator *integrator = MakeIntegrator(settings);
+    if (integrator == NULL)
+    {
+        cout << "Unknown integrator " << settings.integrator << endl;
+        return 1;
+    }
+    engine.SetIntegrator(integrator);
+    cout << "integrator: " << engine.integrator->Name() << endl;
+
+    BroadPhase *broadPhase = MakeBroadPhase(settings);
+    if (broadPhase == NULL)
+    {
+        cout << "Unknown broad phase " << settings.broadPhase << endl;
+        return 1;
+    }
+    engine.SetBroadPhase(broadPhase);
+    cout << "broad phase: " << engine.broadPhase->Name() << endl;
+    engine.continuous = settings.continuous;
+    engine.contactScheme = settings.contacts;
+    if (!settings.restore.empty())
+    {
+        string error;
+        if (!LoadCheckpoint(engine, settings.restore, error))
+        {
+            cout << "Can't restore: " << error << endl;
+            return 1;
+        }
+        cout << "restored: " << settings.restore << " at step " << engine.steps << ", " << engine.time << " simulated seconds" << endl;
+    }
+    else if (settings.sceneUnits || settings.unitLength > 0)
+    {
+        if (settings.sceneUnits) engine.SetSceneUnits();
+        else engine.SetUnits(UnitSystem::For(settings.unitLength, settings.unitMass, GRAVITATIONAL_CONSTANT));
+        cout << "units: length " << engine.units.length << " m, mass " << engine.units.mass << " kg, time " << engine.units.time << " s" << endl;
+    }
+
+    if (!settings.saveScene.empty())
+    {
+        string error;
+        if (!WriteScene(settings.saveScene, SceneOf(engine, settings, scene), settings.binaryScene, error))
+        {
+            cout << "Can't save scene: " << error << endl;
+            return 1;
+        }
+        cout << "scene written: " << settings.saveScene << endl;
+    }
+
+    // Only time the specialized passes, don't report on one run
+    if (settings.benchKernels)
+    {
+        BenchKernels(settings);
+        return 0;
+    }
+
+    // Only time recording, don't report on one run
+    if (settings.benchRecord)
+    {
+        BenchRecording(settings);
+        return 0;
+    }
+
+    // Only time the broad phases, don't report on one run
+    if (settings.benchBroadPhase)
+    {
+        BenchBroadPhases(settings);
+        return 0;
+    }
+
+    // Only measure the solver at each size, don't simulate
+    if (!settings.sizes.empty())
+    {
+        for (int size : settings.sizes)
+        {
+            Engine sized(settings.threads, settings.pin);
+            sized.SetGravitySolver(MakeSolver(settings));
+            LoadRandomScene(sized, size, settings.seed, false);
+            if (settings.sceneUnits) sized.SetSceneUnits();
+            cout << "N " << size << ": ";
+            CompareSolver(sized, max(settings.compare, 100));
+        }
+        return 0;
+    }
+
+    // Run the same steps on more and more threads
+    if (settings.scaling)
+    {
+        double oneThread = 0;
+        cout << "threads  steps/s  speedup  efficiency" << endl;
+        for (int threads = 1; threads <= settings.threads; threads++)
+        {
+            Engine scaled(threads, settings.pin);
+            LoadScene(scaled, settings);
+            scaled.SetGravitySolver(MakeSolver(settings));
+            scaled.SetIntegrator(MakeIntegrator(settings));
+            scaled.SetBroadPhase(MakeBroadPhase(settings));
+            scaled.continuous = settings.continuous;
+            scaled.contactScheme = settings.contacts;
+            if (settings.sceneUnits) scaled.SetSceneUnits();
+            else if (settings.unitLength > 0) scaled.SetUnits(UnitSystem::For(settings.unitLength, settings.unitMass, GRAVITATIONAL_CONSTANT));
+            auto start = chrono::steady_clock::now();
+            for (long long s = 0; s < settings.steps; s++) scaled.Step(settings.dt);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double rate = seconds > 0 ? settings.steps/seconds : 0;
+            if (threads == 1) oneThread = rate;
+            double speedup = oneThread > 0 ? rate/oneThread : 0;
+            cout << setw(7) << threads << "  " << setw(7) << setprecision(4) << rate << "  " << setw(7) << speedup
+                 << "  " << setw(10) << speedup/threads << endl;
+        }
+        return 0;
+    }
+
+    // Check the solver against direct summation before anything moves
+    if (settings.compare > 0) CompareSolver(engine, settings.compare);
+
+    double startEnergy = settings.energy ? engine.Energy() : 0;
+
+    // Checkpoints are written while the engine steps
+    unique_ptr<CheckpointWriter> checkpoints;
+    if (!settings.checkpoint.empty()) checkpoints.reset(new CheckpointWriter(settings.checkpoint, settings.checkpointEvery));
+
+    // The trajectory starts with the bodies as they are now
+    TrajectoryWriter recorder;
+    bool recording = !settings.record.empty();
+    if (recording)
+    {
+        if (!StartRecording(recorder, engine, settings.record, settings, settings.encoding)) return 1;
+        recorder.Record(engine);
+    }
+
+    // Run as fast as the CPU allows
+    unsigned long long stepsBefore = engine.steps;
+    unsigned long long allocationsBefore = allocations;
+    auto start = chrono::steady_clock::now();
+    if (settings.frameMs >= 0)
+    {
+        RunSimThread(engine, settings, allocationsBefore, recording ? &recorder : NULL);
+        settings.steps = 0;
+    }
+    for (long long s = 0; s < settings.steps; s++)
+    {
+        // The first step is allowed to size the engine's buffers
+        if (s == 1) allocationsBefore = allocations;
+
+        // Poke a body the same way the GUI does, to show editing doesn't allocate either
+        if (settings.countAllocs && engine.bodies.Size() > 1)
+        {
+            BodyHandle sphere = engine.bodies.Handle(1);
+            sphere.SetMassNum(sphere.MassNum());
+        }
+        engine.Step(settings.dt);
+        if (checkpoints) checkpoints->Tick(engine);
+        if (recording && engine.steps % max(settings.recordEvery, 1LL) == 0) recorder.Record(engine);
+    }
+    auto end = chrono::steady_clock::now();
+    unsigned long long stepAllocations = allocations - allocationsBefore;
+    double seconds = chrono::duration<double>(end - start).count();
+
+    cout << "bodies: " << engine.bodies.Size() << endl;
+    cout << "steps: " << engine.steps << endl;
+    cout << "simulated seconds: " << engine.time << endl;
+    cout << "wall seconds: " << seconds << endl;
+    cout << "steps per second: " << (seconds > 0 ? (engine.steps - stepsBefore)/seconds : 0) << endl;
+    cout << "force evaluations: " << engine.forceEvaluations << " full, " << engine.bodyForceEvaluations << " body by body" << endl;
+    if (engine.continuous) cout << "impacts swept: " << engine.impacts << endl;
+    BlockTimestepIntegrator *block = dynamic_cast<BlockTimestepIntegrator *>(engine.integrator.get());
+    if (block != NULL)
+    {
+        vector<int> counts = block->LevelCounts(engine.gravitating);
+        cout << "bodies on each level:";
+        for (int count : counts) cout << " " << count;
+        cout << endl;
+    }
+    if (settings.energy)
+    {
+        double endEnergy = engine.Energy();
+        cout << "energy: start " << startEnergy << " end " << endEnergy << " relative drift "
+             << (startEnergy != 0 ? (endEnergy - startEnergy)/fabs(startEnergy) : 0) << endl;
+    }
+
+    if (recording)
+    {
+        if (!recorder.Close())
+        {
+            cout << "Recording failed: " << recorder.Error() << endl;
+            return 1;
+        }
+        ReportRecording(recorder, engine.bodies.Size());
+    }
+
+    if (checkpoints)
+    {
+        // The last checkpoint is always of the end of the run
+        checkpoints->Wait();
+        checkpoints->Save(engine);
+        checkpoints->Wait();
+        cout << "checkpoints written: " << checkpoints->Written() << ", skipped while one was being written: " << checkpoints->Skipped() << endl;
+        if (!checkpoints->Error().empty())
+        {
+            cout << "Checkpoint failed: " << checkpoints->Error() << endl;
+            return 1;
+        }
+    }
+
+    if (!settings.quiet)
+    {
+        for (int i = 0; i < engine.bodies.Size(); i++)
+        {
+            Body b = engine.bodies.Get(i);
+            if (!b.isSphere) continue;
+            cout << fixed << setprecision(3) << i << ": location (" << b.location.x << ", " << b.location.y << ", " << b.location.z
+                 << ") velocity (" << b.velocity.x << ", " << b.velocity.y << ", " << b.velocity.z << ")" << endl;
+        }
+    }
+    if (settings.countAllocs)
+    {
+        cout << "allocations while stepping: " << stepAllocations << endl;
+        if (stepAllocations != 0) return 2;
+    }
+    return 0;
+}
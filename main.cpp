@@ -10,6 +10,7 @@
 #include <SDL_image.h>
 #include <SDL_opengl.h>
 #include <string>
+#include <algorithm>
 // TEXTURES
 #include <SOIL2.h>
 // TRANSFORMATIONS
@@ -29,16 +30,22 @@
 #include "files/camera.h"
 #include "mesh.h"
 #include "files/model.h"
+#include "files/engine.h"
+#include "files/simthread.h"
+#include "files/checkpoint.h"
+#include "files/replay.h"
+#include "files/scene.h"
 #include "files/object.h"
 #include "files/gui.h"
 
 #define PI 3.14159265359// A PI constant because I think glm works in radians
-#define NUMBER_OF_OBJECTS 8//I don't want to just have a magic number, so I'm defining the number of objects here.
-// In a real game engine, they'd have hundreds of models and would probably just use a vector instead of manually counting
-#define NUMBER_OF_LIGHTS 2// The number of lights
-#define POINT 0// Defines for the types of lights
-#define DIRECTIONAL 1
-#define SPOT 2
+#define MAX_LIGHTS 20// The most lights the shader has room for (MAX_NUMBER_OF_LIGHTS)
+#define MIN_TIME_WARP 0.125// Slowest the simulation can be run, in simulated seconds per second
+#define MAX_TIME_WARP 1024// Fastest, if the machine can keep up
+#define CHECKPOINT_FILE "checkpoint.bin"// Where F5 saves the simulation to
+#define SCENE_FILE "resources/scenes/default.scene"// The scene started with, unless --scene says otherwise
+#define SPHERE_MESH "resources/models/Ball_A/Ball_A.obj"// Drawn for spheres the scene gives no model
+#define DOMAIN_MESH "resources/models/Domain/Domain.obj"// And for the domain
 
 using namespace std;
 
@@ -52,6 +59,10 @@ int SCREEN_WIDTH = 1000, SCREEN_HEIGHT = 800;
 void DoMovement (SDL_Event event);
 // Variable to control when the similation should be running
 bool simulate = true;
+// Simulated seconds to every real second, changed with [ and ]
+double timeWarp = 1;
+// 1 to play a replay forwards, -1 backwards, changed with R
+double replayDirection = 1;
 
 //create camera
 Camera camera(glm::vec3 (0.0f, 0.0f, 3.0f));
@@ -59,7 +70,6 @@ Camera camera(glm::vec3 (0.0f, 0.0f, 3.0f));
 GLfloat lastX = WIDTH / 2.0;
 GLfloat lastY = HEIGHT / 2.0;
 GLdouble deltaTime = 0.0f; // number of miliseconds since last frame
-GLdouble simTime = 0.0f; // number of miliseconds since last frame
 GLdouble lastFrame = 0.0f;
 
 // For reading keyboard
@@ -67,6 +77,29 @@ const Uint8 *keys = SDL_GetKeyboardState(NULL);
 
 int main(int argc, char *argv[])
 {
+    // Command line: [--scene FILE] [--replay FILE | --record FILE | CHECKPOINT]
+    // Read before the window opens, so a mistyped option is reported rather than taken for a checkpoint.
+    string scenePath = SCENE_FILE, replayPath, recordPath, checkpointPath;
+    for (int a = 1; a < argc; a++)
+    {
+        string arg = argv[a];
+        bool takesFile = arg == "--scene" || arg == "--replay" || arg == "--record";
+        if (takesFile && a + 1 >= argc)
+        {
+            cout << arg << " needs a file" << endl;
+            return -1;
+        }
+        if (arg == "--scene") scenePath = argv[++a];
+        else if (arg == "--replay") replayPath = argv[++a];
+        else if (arg == "--record") recordPath = argv[++a];
+        else if (arg.compare(0, 2, "--") != 0 && checkpointPath.empty()) checkpointPath = arg;
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            cout << "Usage: " << argv[0] << " [--scene FILE] [--replay FILE | --record FILE | CHECKPOINT]" << endl;
+            return -1;
+        }
+    }
 
 //==============================================================================================================
 // Initialize SDL
@@ -120,174 +153,63 @@ int main(int argc, char *argv[])
     Shader postShader ("resources/shaders/GUI.vs", "resources/shaders/GUI.frag");
     Shader textShader ("resources/shaders/text.vs", "resources/shaders/text.frag");
 
-    Object objects [NUMBER_OF_OBJECTS];// This line always makes me laugh
-
-    // LOAD AND INITIATE THE DOMAIN
-    objects[0].location = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[0].oldLocation = objects[0].location;
-    objects[0].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[0].scale = glm::vec3 (15.0f,15.0f,15.0f);
-    objects[0].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[0].oldVelocity = objects[0].velocity;
-    objects[0].isSphere = false;
-    objects[0].collision = true;
-    objects[0].massNum = 0;
-    objects[0].massExp = 0;
-    objects[0].mass = 1.0;
-    objects[0].elasticity = 0;
-    objects[0].meshDir = "resources/models/Domain/Domain.obj";
-    objects[0].hidden = false;
-
-      // LOAD AND INITIATE ARROW
-    objects[1].location = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[1].oldLocation = objects[1].location;
-    objects[1].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[1].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[1].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[1].oldVelocity = objects[1].velocity;
-    objects[1].isSphere = false;
-    objects[1].collision = false;
-    objects[1].massNum = 0;
-    objects[1].massExp = 0;
-    objects[1].mass = 0*pow(10,0);
-    objects[1].elasticity = 0.0;
-    objects[1].meshDir = "resources/models/Arrow/Arrow.obj";
-    objects[1].hidden = true;
-
-    // LOAD AND INITIATE SPHERE A
-    objects[2].location = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[2].oldLocation = objects[2].location;
-    objects[2].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[2].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[2].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[2].oldVelocity = objects[2].velocity;
-    objects[2].isSphere = true;
-    objects[2].collision = true;
-    objects[2].massNum = 1;
-    objects[2].massExp = 10;
-    objects[2].mass =1*pow(10,10);
-    objects[2].elasticity = 1.0;
-    objects[2].meshDir = "resources/models/Ball_A/Ball_A.obj";
-    objects[2].hidden = false;
-
-    // LOAD AND INITIATE SPHERE B
-    objects[3].location = glm::vec3 (3.0f,0.0f,0.0f);
-    objects[3].oldLocation = objects[3].location;
-    objects[3].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[3].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[3].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[3].oldVelocity = objects[3].velocity;
-    objects[3].isSphere = true;
-    objects[3].collision = true;
-    objects[3].massNum = 1;
-    objects[3].massExp = 10;
-    objects[3].mass = 1*pow(10,10);
-    objects[3].elasticity = 1.0;
-    objects[3].meshDir = "resources/models/Ball_B/Ball_B.obj";
-    objects[3].hidden = false;
-
-
-    // LOAD AND INITIATE SPHERE C
-    objects[4].location = glm::vec3 (6.0f,0.0f,0.0f);
-    objects[4].oldLocation = objects[4].location;
-    objects[4].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[4].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[4].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[4].oldVelocity = objects[4].velocity;
-    objects[4].isSphere = true;
-    objects[4].collision = true;
-    objects[4].massNum = 1;
-    objects[4].massExp = 10;
-    objects[4].mass = 1*pow(10,10);
-    objects[4].elasticity = 1.0;
-    objects[4].meshDir = "resources/models/Ball_C/Ball_C.obj";
-    objects[4].hidden = false;
-
-    // LOAD AND INITIATE SPHERE D
-    objects[5].location = glm::vec3 (-3.0f,0.0f,0.0f);
-    objects[5].oldLocation = objects[5].location;
-    objects[5].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[5].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[5].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[5].oldVelocity = objects[5].velocity;
-    objects[5].isSphere = true;
-    objects[5].collision = true;
-    objects[5].massNum = 1;
-    objects[5].massExp = 10;
-    objects[5].mass = 1*pow(10,10);
-    objects[5].elasticity = 1.0;
-    objects[5].meshDir = "resources/models/Ball_D/Ball_D.obj";
-    objects[5].hidden = false;
-
-    // LOAD AND INITIATE SPHERE E
-    objects[6].location = glm::vec3 (-6.0f,0.0f,0.0f);
-    objects[6].oldLocation = objects[6].location;
-    objects[6].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[6].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[6].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[6].oldVelocity = objects[6].velocity;
-    objects[6].isSphere = true;
-    objects[6].collision = true;
-    objects[6].massNum = 1;
-    objects[6].massExp = 10;
-    objects[6].mass = 1*pow(10,10);
-    objects[6].elasticity = 1.0;
-    objects[6].meshDir = "resources/models/Ball_E/Ball_E.obj";
-    objects[6].hidden = false;
-
-    // LOAD AND INITIATE SPHERE F
-    objects[7].location = glm::vec3 (0.0f,0.0f,3.0f);
-    objects[7].oldLocation = objects[7].location;
-    objects[7].rotation = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[7].scale = glm::vec3 (1.0f,1.0f,1.0f);
-    objects[7].velocity = glm::vec3 (0.0f,0.0f,0.0f);
-    objects[7].oldVelocity = objects[7].velocity;
-    objects[7].isSphere = true;
-    objects[7].collision = true;
-    objects[7].massNum = 1;
-    objects[7].massExp = 10;
-    objects[7].mass = 1*pow(10,10);
-    objects[7].elasticity = 1.0;
-    objects[7].meshDir = "resources/models/Ball_F/Ball_F.obj";
-    objects[7].hidden = false;
-
+    // The physics of each object lives in the engine, and what is needed to draw it
+    // is kept in objects at the same index
+    Engine engine;
+    vector<Object> objects;
 
+    // The bodies, the models they are drawn with, the lights and the settings all come from
+    // the scene file (see scene.h), the same one headless can run with --scene
+    Scene scene;
+    string sceneError;
+    if (!ReadScene(scenePath, scene, sceneError, &engine.pool))
+    {
+        cout << "Can't load scene: " << sceneError << endl;
+        return -1;
+    }
+    if (scene.bodies.Size() < 2)
+    {
+        // Body 1 is the arrow velocities are drawn with
+        cout << "Can't load scene: " << scenePath << " needs the domain and the arrow first" << endl;
+        return -1;
+    }
+    engine.bodies = scene.bodies;
+    ConfigureEngine(engine, scene.settings);
+    objects.resize(engine.bodies.Size());
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        objects[i].rotation = glm::vec3 (0.0f,0.0f,0.0f);
+        objects[i].meshDir = engine.bodies.IsSphere(int(i)) ? SPHERE_MESH : DOMAIN_MESH;
+    }
+    for (const SceneMesh &mesh : scene.meshes) objects[mesh.body].meshDir = mesh.path;
 
     // Load all models
-    for (int i = 0; i < NUMBER_OF_OBJECTS; i++)
+    for (size_t i = 0; i < objects.size(); i++)
     {
-        objects[i].model.LoadModel(objects[i].meshDir);
+        objects[i].model.LoadModel((GLchar *)objects[i].meshDir.c_str());
     }
 
     Model GUI;
     GUI.LoadModel("resources/models/GUI/GUI.obj");
 
-    Light lights[NUMBER_OF_LIGHTS];// LOL
-    lights[0].location = glm::vec3 (10.0f,10.0f,10.0f);
-    lights[0].type = POINT;
-    lights[0].diffuse = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[0].ambient = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[0].specular = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[0].direction = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[0].constant = 0.99;
-    lights[0].linear = 0.0;
-    lights[0].quadratic = 0.01;
-    lights[0].cutOff = 12.5;
-    lights[0].outerCutOff = 17.5;
-    lights[0].index = "0";
-
-    lights[1].location = glm::vec3 (-10.0f,10.0f,-10.0f);
-    lights[1].type = POINT;
-    lights[1].diffuse = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[1].ambient = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[1].specular = glm::vec3 (1.0f,1.0f,1.0f);
-    lights[1].direction = glm::vec3 (0.0f,0.0f,0.0f);
-    lights[1].constant = 0.99;
-    lights[1].linear = 0.0;
-    lights[1].quadratic = 0.01;
-    lights[1].cutOff = 12.5;
-    lights[1].outerCutOff = 17.5;
-    lights[1].index = "1";
+    // As many of the scene's lights as the shader has room for
+    vector<Light> lights(min(scene.lights.size(), size_t(MAX_LIGHTS)));
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const SceneLight &light = scene.lights[i];
+        lights[i].location = ToGlm(light.location);
+        lights[i].type = light.type;
+        lights[i].diffuse = ToGlm(light.colour);
+        lights[i].ambient = ToGlm(light.colour);
+        lights[i].specular = ToGlm(light.colour);
+        lights[i].direction = ToGlm(light.direction);
+        lights[i].constant = light.constant;
+        lights[i].linear = light.linear;
+        lights[i].quadratic = light.quadratic;
+        lights[i].cutOff = light.cutOff;
+        lights[i].outerCutOff = light.outerCutOff;
+        lights[i].index = to_string(i);
+    }
 
     // Projection type      //          // Projection Type//Field of view//Aspect ratio        // Near clip // Far clip
     glm::mat4 projection = glm::perspective(camera.GetZoom(), ((GLfloat)SCREEN_WIDTH - SDL_WIDTH)/(GLfloat)SCREEN_HEIGHT, 0.1f, 1000.0f);
@@ -302,44 +224,66 @@ int main(int argc, char *argv[])
     SDL_StartTextInput();
 //==============================================================================================================
 
-    ifstream fin;                               // Create input file
-    ofstream fout;                              // Output to file
+    // Play a recorded trajectory back instead of simulating, if started with --replay FILE
+    // The trajectory only holds where the bodies went, everything else comes from the scene above.
+    Replay replay;
+    bool replaying = false;
+    // Record the session for --replay to play back, if started with --record FILE
+    // A frame is recorded for every frame drawn (see SimThread::recordEvery), not for every step.
+    TrajectoryWriter recorder;
+    bool recording = false;
+    if (!replayPath.empty())
+    {
+        string error;
+        replaying = replay.Open(replayPath, engine.bodies, error);
+        if (!replaying) cout << "Can't replay: " << error << endl;
+    }
+    else if (!recordPath.empty())
+    {
+        string error;
+        recording = recorder.Open(recordPath, engine.bodies.Size(), TRAJECTORY_POSITIONS | TRAJECTORY_VELOCITIES, TRAJECTORY_DELTA, error);
+        if (!recording) cout << "Can't record: " << error << endl;
+    }
+    // Carry on from a checkpoint if one was given, as long as it is of this scene
+    else if (!checkpointPath.empty())
+    {
+        BodyStore restored;
+        CheckpointScene saved;
+        string error;
+        if (!ReadCheckpoint(checkpointPath, restored, saved, error)) cout << "Can't restore: " << error << endl;
+        else if (restored.Size() != engine.bodies.Size()) cout << "Can't restore: " << checkpointPath << " isn't of this scene" << endl;
+        else
+        {
+            engine.bodies = restored;
+            saved.ApplyTo(engine);
+        }
+    }
+    // Checkpoints are written on a thread of their own, so saving doesn't stall a frame
+    CheckpointWriter checkpoints(CHECKPOINT_FILE);
+
+    // The engine steps on its own thread from here on, and is only seen through snapshots
+    // and edited by sending commands (see simthread.h)
+    SimThread sim(engine);
+    if (scene.settings.step > 0) sim.stepSize = scene.settings.step;
+    if (recording) sim.recorder = &recorder;
+    if (!replaying) sim.Start();
 
 
     // MAIN LOOP HERE
     while (true)																																		// Loop forever
     {
-        // Write to info file
-        fout.open("files/info.txt",ios_base::out|ios_base::trunc);
-        fout.clear();
-
-        // Write "hidden" information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++)
+        // The newest state of the simulation, or the moment of the replay reached, drawn and
+        // shown in the table this frame
+        if (replaying)
         {
-            if (objects[i].hidden) fout << "no" <<endl;
-            else fout << "yes" <<endl;
+            replay.SetPlaying(simulate);
+            replay.SetSpeed(timeWarp*replayDirection);
+            replay.Update();
         }
-        // xLoc information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].location.x << endl;
-        // yLoc information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].location.y << endl;
-        // zLoc information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].location.z << endl;
-        // xVelocity information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].velocity.x << endl;
-        // yVelocity information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].velocity.y << endl;
-        // zVelocity information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].velocity.z << endl;
-        //  mass coefficient information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].massNum << endl;
-        //  mass exponent information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].massExp << endl;
-        //  radius information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].scale.x << endl;
-        //  elasticity information
-        for (int i = 2; i < NUMBER_OF_OBJECTS; i++) fout << fixed << setprecision(3) << objects[i].elasticity * 100 << endl;
-        fout.close();
+        const Snapshot &shown = replaying ? replay.Shown() : sim.Latest();
+
+        // Fill the GUI table with what the spheres are doing
+        guiBuffer.fillTable(shown.bodies);
 
         // SPHERE TEXTURES
         // WRITE WHILE INPUTTING
@@ -352,14 +296,12 @@ int main(int argc, char *argv[])
         // Stop simulation time if simulation is not running
         if (simulate)
         {
-            simTime = deltaTime;
             projection = glm::perspective(camera.GetZoom(), ((GLfloat)SCREEN_WIDTH)/(GLfloat)SCREEN_HEIGHT, 0.1f, 1000.0f);
             glViewport(0, 0, WIDTH, HEIGHT);
             guiBuffer.hit = false;
         }
         else
         {
-            simTime = 0;
             projection = glm::perspective(camera.GetZoom(), (GLfloat)SCREEN_WIDTH /(GLfloat)(SCREEN_HEIGHT-SDL_WIDTH), 0.1f, 1000.0f);
             glViewport(0, SDL_WIDTH, WIDTH, HEIGHT - SDL_WIDTH);
         }
@@ -376,14 +318,48 @@ int main(int argc, char *argv[])
             {
                 break;
             }
+
+            // Save what is on screen
+            // Only the snapshot is read, the settings below are never changed by the simulation thread.
+            if (!replaying && windowEvent.type == SDL_KEYDOWN && windowEvent.key.keysym.sym == SDLK_F5)
+            {
+                CheckpointScene saved;
+                saved.steps = shown.steps;
+                saved.time = shown.time;
+                saved.units = engine.units;
+                saved.useUnits = engine.useUnits;
+                saved.contactScheme = engine.contactScheme;
+                saved.continuous = engine.continuous;
+                checkpoints.Save(shown.bodies, saved);
+            }
+
+            // Scrub through a replay: step a frame either way, jump to either end or a tenth of the way through
+            // shown is the replay's own snapshot, so it shows wherever the replay jumps to.
+            if (replaying && windowEvent.type == SDL_KEYDOWN)
+            {
+                SDL_Keycode key = windowEvent.key.keysym.sym;
+                if (key == SDLK_r) replayDirection = -replayDirection;
+                if (key == SDLK_COMMA) replay.StepFrames(-1);
+                if (key == SDLK_PERIOD) replay.StepFrames(1);
+                if (key == SDLK_HOME) replay.Seek(0);
+                if (key == SDLK_END) replay.Seek(1);
+                if (key >= SDLK_0 && key <= SDLK_9) replay.Seek((key - SDLK_0)/10.0);
+            }
         }
 
         // Handle the movement of the camera
         DoMovement(windowEvent);
         // Handle GUI
         guiBuffer.checkClick (windowEvent);
-        objects[guiBuffer.activeColumn] = guiBuffer.inputValue(objects[guiBuffer.activeColumn], windowEvent);
-        guiBuffer.updateInfoFile();
+        // A replay can't be edited
+        if (!replaying && guiBuffer.activeColumn < shown.bodies.Size())
+        {
+            guiBuffer.inputValue(guiBuffer.activeColumn, shown.bodies, sim, windowEvent);
+        }
+        // Pausing only stops the simulation thread stepping, edits are still made
+        sim.SetRunning(simulate);
+        sim.SetTimeWarp(timeWarp);
+        guiBuffer.showInput();
         // RENDER
         //
 
@@ -397,11 +373,11 @@ int main(int argc, char *argv[])
         GLint viewPosLoc = glGetUniformLocation(shader.Program, "viewPos");
         glUniform3f (viewPosLoc, camera.GetPosition( ).x, camera.GetPosition( ).y, camera.GetPosition().z );
         glUniform1f(glGetUniformLocation(shader.Program, "material.shininess"), 32.0f);
-        glUniform1i(glGetUniformLocation(shader.Program, "NUMBER_OF_LIGHTS"), NUMBER_OF_LIGHTS);
+        glUniform1i(glGetUniformLocation(shader.Program, "NUMBER_OF_LIGHTS"), int(lights.size()));
 
 
         // Make all lights work
-        for (int i = 0; i < NUMBER_OF_LIGHTS; i++)
+        for (size_t i = 0; i < lights.size(); i++)
         {
             lights[i].Draw(shader);
         }
@@ -417,56 +393,18 @@ int main(int argc, char *argv[])
 
         glUniformMatrix4fv ( projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-        // Update velocitie, locations, and masses
-        for (int i = 0; i < NUMBER_OF_OBJECTS; i++)
-        {
-            // Skip if the object is hidden
-            if (objects[i].hidden) continue;
-            objects[i].oldVelocity = objects[i].velocity;
-            objects[i].oldLocation = objects[i].location;
-            objects[i].mass = objects[i].massNum * pow(10, objects[i].massExp);
-        }
-
-        // Do gravity
-        for (int i = 0; i < NUMBER_OF_OBJECTS; i++)
-        {
-            // Skip if the object is hidden
-            if (objects[i].hidden) continue;
-            for (int q = 0; q < NUMBER_OF_OBJECTS; q++)
-            {
-                // Skip if the object is hidden
-                if (objects[q].hidden) continue;
-                // Skip if the object is being compared to itself
-                if (q == i) continue;
-                objects[i].Gravity(objects[q], simTime/1000);
-            }
-        }
-
-        // check collisions
-        for (int i = 0; i < NUMBER_OF_OBJECTS; i++)
-        {
-            // Skip if the object is hidden
-            if (objects[i].hidden||!objects[i].collision) continue;
-            for (int q = 0; q < NUMBER_OF_OBJECTS; q++)
-            {
-                // Skip if the object is hidden
-                if (objects[q].hidden||!objects[q].collision) continue;
-                // Skip if the object is being compared to itself
-                if (q == i) continue;
-                objects[i].Collide(objects[q]);
-            }
-        }
+        // How far between the snapshot's last two steps the bodies are drawn
+        double blend = shown.Blend();
 
-        // For loop to set all objects
-        for (int i = 0; i < NUMBER_OF_OBJECTS; i++)
+        // For loop to set all visible objects
+        for (int i : shown.visible)
         {
 
-            // Skip if the object is hidden
-            if (objects[i].hidden||!objects[i].collision) continue;
-                objects[i].CalcLoc(simTime/1000);
+            // Skip if the object doesn't collide
+            if (!shown.bodies.Collides(i)) continue;
                 glm::mat4 model; // Prepare to apply all transformations to all models
-                model = glm::translate(model, objects[i].location); // Apply translations
-                model = glm::scale(model, objects[i].scale); // Apply dilation
+                model = glm::translate(model, ToGlm(shown.Location(i, blend))); // Apply translations
+                model = glm::scale(model, glm::vec3(float(shown.bodies.radius[i]))); // Apply dilation
                 model = glm::rotate(model, objects[i].rotation.z, glm::vec3(0.0f,0.0f,1.0f)); // Rotate on z axis
                 model = glm::rotate(model, objects[i].rotation.y, glm::vec3(0.0f,1.0f,0.0f)); // Rotate on y axis
                 model = glm::rotate(model, objects[i].rotation.x, glm::vec3(1.0f,0.0f,0.0f)); // Rotate on x axis
@@ -476,29 +414,30 @@ int main(int argc, char *argv[])
 
 
                 // Draw arrows
-                if (!simulate && objects[i].isSphere)
+                if (!simulate && shown.bodies.IsSphere(i))
                 {
 
                     // find the rotation of the object's velocity
                     //model =glm::orientation(objects[i].velocity, glm::vec3(0.0f,0.0f,0.0f));
-                    glm::vec2 temp = glm::normalize(glm::vec2(objects[i].velocity.x, objects[i].velocity.z));
+                    glm::vec3 velocity = ToGlm(shown.bodies.Velocity(i));
+                    glm::vec2 temp = glm::normalize(glm::vec2(velocity.x, velocity.z));
 
                     GLfloat roll = glm::orientedAngle(temp, glm::vec2(1.0,0.0));
 
                     // Rotation axis for the pitch
-                    glm::vec3 axis = glm::vec3 (objects[i].velocity);
+                    glm::vec3 axis = glm::vec3 (velocity);
                     axis.y = 0;
                     axis = glm::normalize(axis);
                     axis = glm::rotate(axis, float(PI/2), glm::vec3(0.0f,1.0f,0.0f));
 
-                    GLfloat pitch = glm::orientedAngle(glm::normalize(objects[i].velocity), glm::vec3(0.0f,1.0f,0.0f), axis);
+                    GLfloat pitch = glm::orientedAngle(glm::normalize(velocity), glm::vec3(0.0f,1.0f,0.0f), axis);
 
                     // Measure how far down the vector is from positive y
                    // model = glm::rotate(model, pitch, glm::vec3(1.0f,0.0f,0.0f)); // Rotate on z axis
                     model = glm::rotate(model, roll, glm::vec3(0.0f,1.0f,0.0f)); // Rotate on z axis
                     model = glm::rotate(model, pitch, glm::vec3(0.0f,0.0f,1.0f));
-                    model = glm::translate(model, glm::vec3(0.0f,objects[i].scale.x,0.0f));
-                    model = glm::scale(model, glm::vec3(1.0f, glm::distance(objects[i].velocity, glm::vec3(0.0f,0.0f,0.0f)), 1.0f)); // Apply dilation
+                    model = glm::translate(model, glm::vec3(0.0f,float(shown.bodies.radius[i]),0.0f));
+                    model = glm::scale(model, glm::vec3(1.0f, glm::distance(velocity, glm::vec3(0.0f,0.0f,0.0f)), 1.0f)); // Apply dilation
 
                     glUniformMatrix4fv (glGetUniformLocation (shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model)); // Apply all transformations
                     objects[1].model.Draw(shader);
@@ -513,10 +452,19 @@ int main(int argc, char *argv[])
             projection = glm::ortho(0.0f, (GLfloat)WIDTH, 0.0f, (GLfloat)HEIGHT);
             glUniformMatrix4fv(glGetUniformLocation(textShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
             guiBuffer.RenderText(textShader,"Press [P] to pause", 20.0f, 20.0f, 0.5f, glm::vec3(1.0f, 1.0f,1.0f));
+            // Formatted in place, so drawing a frame doesn't allocate
+            char text[128];
+            snprintf(text, sizeof(text), "Time warp %gx, [ and ] to change", timeWarp);
+            guiBuffer.RenderText(textShader, text, 20.0f, 50.0f, 0.5f, glm::vec3(1.0f, 1.0f, 1.0f));
+            if (replaying)
+            {
+                snprintf(text, sizeof(text), "Replay frame %llu of %llu, %g s%s, [R] reverses, [0]-[9] jump",
+                         (unsigned long long)replay.Position() + 1, (unsigned long long)replay.Frames(), shown.time,
+                         replayDirection < 0 ? " backwards" : "");
+                guiBuffer.RenderText(textShader, text, 20.0f, 80.0f, 0.5f, glm::vec3(1.0f, 1.0f, 1.0f));
+            }
         }
 
-        // Open info file
-        fin.open("files/info.txt");
         if (!simulate)
         {
             postShader.Use();
@@ -537,32 +485,30 @@ int main(int argc, char *argv[])
             guiBuffer.RenderText(textShader, "Use the mouse to look around", 20.0f, 650.0f, 0.5f, glm::vec3(1.0f, 1.0f, 1.0f));
             guiBuffer.RenderText(textShader, "Press [Esc] to quit", 20.0f, 600.0f, 0.5f, glm::vec3(1.0f, 1.0f, 1.0f));
             guiBuffer.RenderText(textShader, "Click on the chart to edit values", 20.0f, 550.0f, 0.5f, glm::vec3(1.0f, 1.0f, 1.0f));
-            // Go through file and print contents
-            string text;
-            // Read "hidden" information
-            for (int i = 2; i < NUMBER_OF_OBJECTS; i++)
+            // Draw the table
+            // "hidden" information
+            for (int column = 0; column < guiBuffer.tableColumns; column++)
             {
-                fin >> text;
-                guiBuffer.RenderText(textShader, text,(BOX_START_X + (i-2)*BOX_WIDTH + 50), (BOX_START_Y - 0*BOX_HEIGHT -90), 0.5f, glm::vec3(0.0f, 0.0f, 0.0f));
+                guiBuffer.RenderText(textShader, guiBuffer.table[0][column].c_str(),(BOX_START_X + column*BOX_WIDTH + 50), (BOX_START_Y - 0*BOX_HEIGHT -90), 0.5f, glm::vec3(0.0f, 0.0f, 0.0f));
             }
 
-            // Read all other information
-            for (int q = 1; q < 11; q++)
+            // All other information
+            for (int q = 1; q < GUI_ROWS; q++)
             {
-                for (int i = 2; i < NUMBER_OF_OBJECTS; i++)
+                for (int column = 0; column < guiBuffer.tableColumns; column++)
                 {
-                    fin >> text;
-                    guiBuffer.RenderText(textShader, text,(BOX_START_X + (i-2)*BOX_WIDTH + 10), (BOX_START_Y - q*BOX_HEIGHT -93), 0.5f, glm::vec3(0.0f, 0.0f, 0.0f));
+                    guiBuffer.RenderText(textShader, guiBuffer.table[q][column].c_str(),(BOX_START_X + column*BOX_WIDTH + 10), (BOX_START_Y - q*BOX_HEIGHT -93), 0.5f, glm::vec3(0.0f, 0.0f, 0.0f));
                 }
             }
         }
-        fin.close();
 
         // Swap screen buffers
         SDL_GL_SwapWindow(window);
         // Update the specified window
     }
     // CLEAN UP
+    sim.Stop();
+    recorder.Close();
     SDL_StopTextInput();
 
     SDL_DestroyWindow(window);																															// Destroy the window before exiting
@@ -621,6 +567,16 @@ void DoMovement(SDL_Event event)
         // cout << "P";
     }
 
+    // Speed up or slow down simulated time
+    if ( (keys [SDL_SCANCODE_RIGHTBRACKET] ) && (event.type == SDL_KEYDOWN))
+    {
+        timeWarp = min(timeWarp*2, double(MAX_TIME_WARP));
+    }
+    if ( (keys [SDL_SCANCODE_LEFTBRACKET] ) && (event.type == SDL_KEYDOWN))
+    {
+        timeWarp = max(timeWarp/2, MIN_TIME_WARP);
+    }
+
     // Check Mouse stuff
     if ((event.type == SDL_MOUSEMOTION) && (simulate))
     {